@@ -9,83 +9,196 @@
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <ctype.h>
 
-// OpenMP
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
+static CactusDiskShard *cactusDisk_getShard(CactusDisk *cactusDisk, Name name) {
+    // Names are issued sequentially, so are mixed before choosing the shard
+    return &(cactusDisk->shards[(((uint64_t)name) * 0x9E3779B97F4A7C15ULL) >> 58 & (CACTUS_DISK_SHARDS - 1)]);
+}
 
 /*
  * Functions on meta sequences.
  */
 
 void cactusDisk_addSequence(CactusDisk *cactusDisk, Sequence *sequence) {
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    assert(stSortedSet_search(cactusDisk->sequences, sequence) == NULL);
-    stSortedSet_insert(cactusDisk->sequences, sequence);
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequence_getName(sequence));
+    pthread_rwlock_wrlock(&(shard->lock));
+    assert(stSortedSet_search(shard->sequences, sequence) == NULL);
+    stSortedSet_insert(shard->sequences, sequence);
+    pthread_rwlock_unlock(&(shard->lock));
 }
 
 void cactusDisk_removeSequence(CactusDisk *cactusDisk, Sequence *sequence) {
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    assert(stSortedSet_search(cactusDisk->sequences, sequence) != NULL);
-    stSortedSet_remove(cactusDisk->sequences, sequence);
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequence_getName(sequence));
+    pthread_rwlock_wrlock(&(shard->lock));
+    assert(stSortedSet_search(shard->sequences, sequence) != NULL);
+    stSortedSet_remove(shard->sequences, sequence);
+    pthread_rwlock_unlock(&(shard->lock));
 }
 
 /*
  * Functions for strings
  */
 
+static int64_t packedString_baseCode(char c) {
+    switch (c) {
+        case 'A':
+            return 0;
+        case 'C':
+            return 1;
+        case 'G':
+            return 2;
+        case 'T':
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * Extends the last run if the position continues it, else appends a new run.
+ */
+static void packedString_addToRuns(PackedRun **runs, int64_t *runNumber, int64_t *maxRunNumber, int64_t i, char c) {
+    if (*runNumber > 0) {
+        PackedRun *run = &((*runs)[*runNumber - 1]);
+        if (run->start + run->length == i && run->c == c) {
+            run->length++;
+            return;
+        }
+    }
+    if (*runNumber == *maxRunNumber) {
+        *maxRunNumber = *maxRunNumber * 2 + 1;
+        *runs = st_realloc(*runs, sizeof(PackedRun) * *maxRunNumber);
+    }
+    PackedRun *run = &((*runs)[(*runNumber)++]);
+    run->start = i;
+    run->length = 1;
+    run->c = c;
+}
+
+static PackedString *packedString_construct(const char *string) {
+    PackedString *packedString = st_calloc(1, sizeof(PackedString));
+    packedString->length = strlen(string);
+    packedString->bases = st_calloc((packedString->length + 3) / 4, sizeof(uint8_t));
+    int64_t maxExceptionNumber = 0, maxMaskNumber = 0;
+    for (int64_t i = 0; i < packedString->length; i++) {
+        char c = string[i];
+        if (islower(c)) {
+            packedString_addToRuns(&packedString->masks, &packedString->maskNumber, &maxMaskNumber, i, 0);
+            c = toupper(c);
+        }
+        int64_t code = packedString_baseCode(c);
+        if (code == -1) { // Left as zero in the packed bases
+            packedString_addToRuns(&packedString->exceptions, &packedString->exceptionNumber, &maxExceptionNumber, i, c);
+        } else {
+            packedString->bases[i / 4] |= code << (2 * (i % 4));
+        }
+    }
+    // Trim the run tables to size
+    if (packedString->exceptionNumber > 0) {
+        packedString->exceptions = st_realloc(packedString->exceptions, sizeof(PackedRun) * packedString->exceptionNumber);
+    }
+    if (packedString->maskNumber > 0) {
+        packedString->masks = st_realloc(packedString->masks, sizeof(PackedRun) * packedString->maskNumber);
+    }
+    return packedString;
+}
+
+static void packedString_destruct(PackedString *packedString) {
+    free(packedString->bases);
+    free(packedString->exceptions);
+    free(packedString->masks);
+    free(packedString);
+}
+
+int64_t packedString_firstRunEndingAfter(const PackedRun *runs, int64_t runNumber, int64_t i) {
+    int64_t min = 0, max = runNumber;
+    while (min < max) {
+        int64_t mid = (min + max) / 2;
+        if (runs[mid].start + runs[mid].length > i) {
+            max = mid;
+        } else {
+            min = mid + 1;
+        }
+    }
+    return min;
+}
+
+void packedString_decode(const PackedString *packedString, int64_t start, int64_t length, int64_t strand,
+        char *buffer) {
+    assert(start >= 0 && length >= 0 && start + length <= packedString->length);
+    static const char bases[] = "ACGT";
+    int64_t end = start + length;
+    for (int64_t i = start; i < end; i++) {
+        buffer[i - start] = bases[(packedString->bases[i / 4] >> (2 * (i % 4))) & 3];
+    }
+    for (int64_t j = packedString_firstRunEndingAfter(packedString->exceptions, packedString->exceptionNumber, start);
+         j < packedString->exceptionNumber && packedString->exceptions[j].start < end; j++) {
+        const PackedRun *run = &packedString->exceptions[j];
+        int64_t runStart = run->start > start ? run->start : start;
+        int64_t runEnd = run->start + run->length < end ? run->start + run->length : end;
+        memset(buffer + runStart - start, run->c, runEnd - runStart);
+    }
+    for (int64_t j = packedString_firstRunEndingAfter(packedString->masks, packedString->maskNumber, start);
+         j < packedString->maskNumber && packedString->masks[j].start < end; j++) {
+        const PackedRun *run = &packedString->masks[j];
+        int64_t runStart = run->start > start ? run->start : start;
+        int64_t runEnd = run->start + run->length < end ? run->start + run->length : end;
+        for (int64_t i = runStart; i < runEnd; i++) {
+            buffer[i - start] = tolower(buffer[i - start]);
+        }
+    }
+    buffer[length] = '\0';
+    if (!strand) { // Reverse complement in place
+        for (int64_t i = 0, j = length - 1; i <= j; i++, j--) {
+            char c = stString_reverseComplementChar(buffer[i]);
+            buffer[i] = stString_reverseComplementChar(buffer[j]);
+            buffer[j] = c;
+        }
+    }
+}
+
 Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string) {
     /*
      * Adds a string to the database.
      */
     Name name = cactusDisk_getUniqueID(cactusDisk);
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    stHash_insert(cactusDisk->allStrings, (void *)name, stString_copy(string)); // Cheeky 64bit to pointer conversion
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    PackedString *packedString = packedString_construct(string); // Done outside of the lock
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, name);
+    pthread_rwlock_wrlock(&(shard->lock));
+    stHash_insert(shard->strings, (void *)name, packedString); // Cheeky 64bit to pointer conversion
+    pthread_rwlock_unlock(&(shard->lock));
     return name;
 }
 
+const PackedString *cactusDisk_getPackedString(CactusDisk *cactusDisk, Name name) {
+    // Strings are never modified once added, so only the lookup needs the (shared) lock
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, name);
+    pthread_rwlock_rdlock(&(shard->lock));
+    PackedString *packedString = stHash_search(shard->strings, (void *)name); // Cheeky 64bit int to pointer conversion
+    pthread_rwlock_unlock(&(shard->lock));
+    assert(packedString != NULL);
+    return packedString;
+}
+
+void cactusDisk_getStringInBuffer(CactusDisk *cactusDisk, Name name, int64_t start, int64_t length, int64_t strand,
+        char *buffer) {
+    assert(length >= 0);
+    if (length == 0) {
+        buffer[0] = '\0';
+        return;
+    }
+    packedString_decode(cactusDisk_getPackedString(cactusDisk, name), start, length, strand, buffer);
+}
+
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int64_t length, int64_t strand,
         int64_t totalSequenceLength) {
     /*
      * Gets a string from the database.
      *
      */
-    assert(length >= 0);
-    if (length == 0) {
-        return stString_copy("");
-    }
-
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    char *string = stHash_search(cactusDisk->allStrings, (void *)name); // Cheeky 64bit int to pointer conversion
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
-
-    assert(string != NULL);
-    string = stString_getSubString(string, start, length);
-    if(!strand) {
-        char *reverseComplement = stString_reverseComplementString(string);
-        free(string);
-        return reverseComplement;
-    }
+    char *string = st_malloc(sizeof(char) * (length + 1));
+    cactusDisk_getStringInBuffer(cactusDisk, name, start, length, strand, string);
     return string;
 }
 
@@ -111,65 +224,83 @@ static int cactusDisk_constructSequencesP(const void *o1, const void *o2) {
 
 CactusDisk *cactusDisk_construct() {
     CactusDisk *cactusDisk = st_calloc(1, sizeof(CactusDisk));
-    cactusDisk->sequences = stSortedSet_construct3(cactusDisk_constructSequencesP, NULL);
-    cactusDisk->flowers = stSortedSet_construct3(cactusDisk_constructFlowersP, NULL);
+    for (int64_t i = 0; i < CACTUS_DISK_SHARDS; i++) {
+        CactusDiskShard *shard = &(cactusDisk->shards[i]);
+        shard->sequences = stSortedSet_construct3(cactusDisk_constructSequencesP, NULL);
+        shard->flowers = stSortedSet_construct3(cactusDisk_constructFlowersP, NULL);
+        shard->strings = stHash_construct2(NULL, (void (*)(void *)) packedString_destruct);
+        pthread_rwlock_init(&(shard->lock), NULL);
+    }
     cactusDisk->eventTree = NULL;
-    cactusDisk->allStrings = stHash_construct2(NULL, free);
     cactusDisk->currentName = 1; // Start the naming of objects from 1
-#if defined(_OPENMP)
-        omp_init_lock(&(cactusDisk->writelock));
-#endif
     return cactusDisk;
 }
 
+/*
+ * Gets the flowers (or, if flowers is false, the sequences) of all the shards, sorted by name.
+ */
+static stList *cactusDisk_getAll(CactusDisk *cactusDisk, bool flowers) {
+    stList *objects = stList_construct();
+    for (int64_t i = 0; i < CACTUS_DISK_SHARDS; i++) {
+        stSortedSetIterator *it = stSortedSet_getIterator(flowers ? cactusDisk->shards[i].flowers : cactusDisk->shards[i].sequences);
+        void *o;
+        while ((o = stSortedSet_getNext(it)) != NULL) {
+            stList_append(objects, o);
+        }
+        stSortedSet_destructIterator(it);
+    }
+    stList_sort(objects, flowers ? cactusDisk_constructFlowersP : cactusDisk_constructSequencesP);
+    return objects;
+}
+
 void cactusDisk_destruct(CactusDisk *cactusDisk) {
-    Flower *flower;
-    while ((flower = stSortedSet_getFirst(cactusDisk->flowers)) != NULL) {
-        flower_destruct(flower, FALSE, FALSE);
+    // Flowers and sequences are destructed in name order
+    stList *flowers = cactusDisk_getAll(cactusDisk, 1);
+    for (int64_t i = 0; i < stList_length(flowers); i++) {
+        flower_destruct(stList_get(flowers, i), FALSE, FALSE);
     }
-    stSortedSet_destruct(cactusDisk->flowers);
+    stList_destruct(flowers);
 
-    Sequence *sequence;
-    while ((sequence = stSortedSet_getFirst(cactusDisk->sequences)) != NULL) {
-        sequence_destruct(sequence);
+    stList *sequences = cactusDisk_getAll(cactusDisk, 0);
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        sequence_destruct(stList_get(sequences, i));
+    }
+    stList_destruct(sequences);
+
+    for (int64_t i = 0; i < CACTUS_DISK_SHARDS; i++) {
+        CactusDiskShard *shard = &(cactusDisk->shards[i]);
+        assert(stSortedSet_size(shard->flowers) == 0);
+        stSortedSet_destruct(shard->flowers);
+        assert(stSortedSet_size(shard->sequences) == 0);
+        stSortedSet_destruct(shard->sequences);
+        stHash_destruct(shard->strings); // cleanup the library of strings we hold in memory
+        pthread_rwlock_destroy(&(shard->lock));
     }
-    stSortedSet_destruct(cactusDisk->sequences);
-    stHash_destruct(cactusDisk->allStrings); // cleanup the library of strings we hold in memory
 
     if(cactusDisk->eventTree != NULL) {
         eventTree_destruct(cactusDisk->eventTree);
     }
 
-#if defined(_OPENMP)
-    omp_destroy_lock(&(cactusDisk->writelock));
-#endif
-
     free(cactusDisk);
 }
 
 Flower *cactusDisk_getFlower(CactusDisk *cactusDisk, Name flowerName) {
     Flower flower;
     flower.name = flowerName;
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        Flower *flower2 = stSortedSet_search(cactusDisk->flowers, &flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flowerName);
+    pthread_rwlock_rdlock(&(shard->lock));
+    Flower *flower2 = stSortedSet_search(shard->flowers, &flower);
+    pthread_rwlock_unlock(&(shard->lock));
     return flower2;
 }
 
 Sequence *cactusDisk_getSequence(CactusDisk *cactusDisk, Name sequenceName) {
     Sequence sequence;
     sequence.name = sequenceName;
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    Sequence *sequence2 = stSortedSet_search(cactusDisk->sequences, &sequence);
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequenceName);
+    pthread_rwlock_rdlock(&(shard->lock));
+    Sequence *sequence2 = stSortedSet_search(shard->sequences, &sequence);
+    pthread_rwlock_unlock(&(shard->lock));
     return sequence2;
 }
 
@@ -178,25 +309,19 @@ Sequence *cactusDisk_getSequence(CactusDisk *cactusDisk, Name sequenceName) {
  */
 
 void cactusDisk_addFlower(CactusDisk *cactusDisk, Flower *flower) {
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        assert(stSortedSet_search(cactusDisk->flowers, flower) == NULL);
-        stSortedSet_insert(cactusDisk->flowers, flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flower_getName(flower));
+    pthread_rwlock_wrlock(&(shard->lock));
+    assert(stSortedSet_search(shard->flowers, flower) == NULL);
+    stSortedSet_insert(shard->flowers, flower);
+    pthread_rwlock_unlock(&(shard->lock));
 }
 
 void cactusDisk_removeFlower(CactusDisk *cactusDisk, Flower *flower) {
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        assert(stSortedSet_search(cactusDisk->flowers, flower) != NULL);
-        stSortedSet_remove(cactusDisk->flowers, flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flower_getName(flower));
+    pthread_rwlock_wrlock(&(shard->lock));
+    assert(stSortedSet_search(shard->flowers, flower) != NULL);
+    stSortedSet_remove(shard->flowers, flower);
+    pthread_rwlock_unlock(&(shard->lock));
 }
 
 void cactusDisk_setEventTree(CactusDisk *cactusDisk, EventTree *eventTree) {
@@ -208,14 +333,9 @@ void cactusDisk_setEventTree(CactusDisk *cactusDisk, EventTree *eventTree) {
  */
 
 int64_t cactusDisk_getUniqueIDInterval(CactusDisk *cactusDisk, int64_t intervalSize) {
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    Name n = cactusDisk->currentName;
-    cactusDisk->currentName += intervalSize;
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    Name n;
+#pragma omp atomic capture
+    { n = cactusDisk->currentName; cactusDisk->currentName += intervalSize; }
     return n;
 }
 
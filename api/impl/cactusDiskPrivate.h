@@ -8,19 +8,44 @@
 #define CACTUS_DISK_PRIVATE_H_
 
 #include "cactusGlobals.h"
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
+#include <pthread.h>
 
-struct _cactusDisk {
+#define CACTUS_DISK_SHARDS 64 // Must be a power of two
+
+/*
+ * Strings are stored packed, two bits per base, with the characters that are not A, C, G or T (such as runs of Ns)
+ * kept in a side table of runs and the soft-masked (lower case) intervals kept in a second table of runs.
+ */
+typedef struct _packedRun {
+    int64_t start;
+    int64_t length;
+    char c; // The character of the run, unused for soft-masked runs
+} PackedRun;
+
+struct _packedString {
+    int64_t length;
+    uint8_t *bases; // Four bases per byte, A=0, C=1, G=2, T=3
+    PackedRun *exceptions; // Runs of characters that are not A, C, G or T, sorted by start
+    int64_t exceptionNumber;
+    PackedRun *masks; // Runs of lower case characters, sorted by start
+    int64_t maskNumber;
+};
+
+/*
+ * The flowers, sequences and strings of the disk are split into shards by name, each with its own reader-writer lock,
+ * so that threads looking up different objects do not contend for a single lock.
+ */
+typedef struct _cactusDiskShard {
+    pthread_rwlock_t lock;
     stSortedSet *sequences;
     stSortedSet *flowers;
+    stHash *strings; // A map of names to packed strings
+} CactusDiskShard;
+
+struct _cactusDisk {
+    CactusDiskShard shards[CACTUS_DISK_SHARDS];
     EventTree *eventTree;
-#if defined(_OPENMP)
-    omp_lock_t writelock; // This lock used to gate access to concurrently accessed variables
-#endif
-    stHash *allStrings; // If the strings are being all stored in memory, a map of names to strings
-    Name currentName; // Used as a counter for issuing names
+    Name currentName; // Used as a counter for issuing names, updated atomically
 };
 
 ////////////////////////////////////////////////
@@ -62,7 +87,8 @@ void cactusDisk_removeSequence(CactusDisk *cactusDisk,
  */
 
 /*
- * Adds the sequence string to the database.
+ * Adds the sequence string to the database. The string is stored packed, two bits per base, with side tables for the
+ * runs of non-ACGT characters and of soft-masked bases, so any string round trips exactly.
  */
 Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string);
 
@@ -72,6 +98,30 @@ Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string);
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name,
         int64_t start, int64_t length, int64_t strand, int64_t totalSequenceLength);
 
+/*
+ * As cactusDisk_getString, but decodes the string into the given buffer, which must have space for length+1
+ * characters, rather than allocating it.
+ */
+void cactusDisk_getStringInBuffer(CactusDisk *cactusDisk, Name name, int64_t start, int64_t length, int64_t strand,
+        char *buffer);
+
+/*
+ * Gets the packed string with the given name. The string is never modified, so may be read without locking.
+ */
+const PackedString *cactusDisk_getPackedString(CactusDisk *cactusDisk, Name name);
+
+/*
+ * Decodes the interval [start, start+length) of the packed string into the buffer, which must have space for length+1
+ * characters. If strand is false the reverse complement of the interval is decoded.
+ */
+void packedString_decode(const PackedString *packedString, int64_t start, int64_t length, int64_t strand,
+        char *buffer);
+
+/*
+ * Returns the index of the first of the sorted runs that ends after the given position, or runNumber if there is none.
+ */
+int64_t packedString_firstRunEndingAfter(const PackedRun *runs, int64_t runNumber, int64_t i);
+
 /*
  * Set the event tree for this disk. (Hopefully this only happens once.)
  */
@@ -0,0 +1,231 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // For fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "sonLib.h"
+#include "cactusFile.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/*
+ * Compressed files are read through a stdio stream whose reads are served from a CompressedFile.
+ *
+ * A BGZF file is a series of gzip members, or blocks, each at most 64kb compressed and uncompressed, with the
+ * compressed size of the block stored in an extra field of its gzip header. So the blocks can be read from the
+ * file without inflating them, and inflated independently.
+ */
+
+#define BGZF_MAX_BLOCK_SIZE 65536
+#define BGZF_HEADER_SIZE 18
+#define BGZF_BATCH_SIZE 64 // The number of blocks inflated at once
+
+typedef struct _compressedFile {
+    gzFile gz; // For gzip files that are not BGZF, else NULL
+    FILE *fh; // For BGZF files, the compressed file
+    uint8_t *blocks; // The compressed blocks of the batch, each in a slot of BGZF_MAX_BLOCK_SIZE bytes
+    int64_t *block_sizes;
+    uint8_t *data; // The inflated blocks of the batch, each in a slot of BGZF_MAX_BLOCK_SIZE bytes
+    int64_t *data_sizes;
+    int64_t block_number; // The number of blocks in the batch
+    int64_t block; // The block of the batch being read
+    int64_t offset; // The offset in the inflated block being read
+} CompressedFile;
+
+static bool is_bgzf_header(const uint8_t *header) {
+    return header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0 &&
+           header[10] == 6 && header[11] == 0 && header[12] == 'B' && header[13] == 'C' &&
+           header[14] == 2 && header[15] == 0;
+}
+
+/*
+ * Reads the next block of the BGZF file into the buffer, returning its size, or 0 at the end of the file.
+ */
+static int64_t read_bgzf_block(FILE *fh, uint8_t *buffer) {
+    size_t i = fread(buffer, 1, BGZF_HEADER_SIZE, fh);
+    if (i == 0) {
+        return 0;
+    }
+    if (i != BGZF_HEADER_SIZE || !is_bgzf_header(buffer)) {
+        st_errAbort("Got a corrupt or non-BGZF block in a BGZF file");
+    }
+    int64_t block_size = (buffer[16] | (buffer[17] << 8)) + 1;
+    if (block_size <= BGZF_HEADER_SIZE ||
+        fread(buffer + BGZF_HEADER_SIZE, 1, block_size - BGZF_HEADER_SIZE, fh) != block_size - BGZF_HEADER_SIZE) {
+        st_errAbort("Got a truncated block in a BGZF file");
+    }
+    return block_size;
+}
+
+/*
+ * Inflates the BGZF block into the buffer, returning the inflated size.
+ */
+static int64_t inflate_bgzf_block(uint8_t *block, int64_t block_size, uint8_t *buffer) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 16 + 15) != Z_OK) { // Expect a gzip header
+        st_errAbort("Could not initialise zlib to inflate a BGZF block");
+    }
+    z.next_in = block;
+    z.avail_in = block_size;
+    z.next_out = buffer;
+    z.avail_out = BGZF_MAX_BLOCK_SIZE;
+    if (inflate(&z, Z_FINISH) != Z_STREAM_END) {
+        st_errAbort("Could not inflate a BGZF block: %s", z.msg != NULL ? z.msg : "corrupt block");
+    }
+    int64_t data_size = BGZF_MAX_BLOCK_SIZE - z.avail_out;
+    inflateEnd(&z);
+    return data_size;
+}
+
+/*
+ * Reads and inflates the next batch of blocks, returning 0 at the end of the file.
+ */
+static bool read_bgzf_batch(CompressedFile *f) {
+    f->block_number = 0;
+    f->block = 0;
+    f->offset = 0;
+    while (f->block_number < BGZF_BATCH_SIZE) {
+        int64_t block_size = read_bgzf_block(f->fh, f->blocks + f->block_number * BGZF_MAX_BLOCK_SIZE);
+        if (block_size == 0) {
+            break;
+        }
+        f->block_sizes[f->block_number++] = block_size;
+    }
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if(f->block_number > 1)
+#endif
+    for (int64_t i = 0; i < f->block_number; i++) {
+        f->data_sizes[i] = inflate_bgzf_block(f->blocks + i * BGZF_MAX_BLOCK_SIZE, f->block_sizes[i],
+                                              f->data + i * BGZF_MAX_BLOCK_SIZE);
+    }
+    return f->block_number > 0;
+}
+
+static int64_t compressedFile_read(CompressedFile *f, char *buffer, int64_t length) {
+    if (f->gz != NULL) {
+        int i = gzread(f->gz, buffer, length > INT32_MAX ? INT32_MAX : (unsigned int)length);
+        if (i < 0) {
+            int error;
+            st_logCritical("Error reading compressed file: %s\n", gzerror(f->gz, &error));
+        }
+        return i;
+    }
+    int64_t read = 0;
+    while (read < length) {
+        if (f->block == f->block_number) {
+            if (!read_bgzf_batch(f)) {
+                break;
+            }
+            continue;
+        }
+        int64_t available = f->data_sizes[f->block] - f->offset;
+        int64_t i = available < length - read ? available : length - read;
+        memcpy(buffer + read, f->data + f->block * BGZF_MAX_BLOCK_SIZE + f->offset, i);
+        read += i;
+        f->offset += i;
+        if (f->offset == f->data_sizes[f->block]) { // Move to the next block, which may be empty
+            f->block++;
+            f->offset = 0;
+        }
+    }
+    return read;
+}
+
+static int compressedFile_close(CompressedFile *f) {
+    int i = 0;
+    if (f->gz != NULL) {
+        i = gzclose(f->gz) == Z_OK ? 0 : EOF;
+    }
+    else {
+        i = fclose(f->fh);
+        free(f->blocks);
+        free(f->block_sizes);
+        free(f->data);
+        free(f->data_sizes);
+    }
+    free(f);
+    return i;
+}
+
+#if defined(__APPLE__)
+static int compressedFile_read2(void *cookie, char *buffer, int length) {
+    return compressedFile_read(cookie, buffer, length);
+}
+#else
+static ssize_t compressedFile_read2(void *cookie, char *buffer, size_t length) {
+    return compressedFile_read(cookie, buffer, length);
+}
+#endif
+
+static int compressedFile_close2(void *cookie) {
+    return compressedFile_close(cookie);
+}
+
+static FILE *compressedFile_getStream(CompressedFile *f) {
+#if defined(__APPLE__)
+    FILE *fh = funopen(f, compressedFile_read2, NULL, NULL, compressedFile_close2);
+#else
+    cookie_io_functions_t functions = { compressedFile_read2, NULL, NULL, compressedFile_close2 };
+    FILE *fh = fopencookie(f, "r", functions);
+#endif
+    if (fh == NULL) {
+        compressedFile_close(f);
+    }
+    return fh;
+}
+
+static FILE *open_gzip(gzFile gz) {
+    if (gz == NULL) {
+        return NULL;
+    }
+    gzbuffer(gz, 1 << 17);
+    CompressedFile *f = st_calloc(1, sizeof(CompressedFile));
+    f->gz = gz;
+    return compressedFile_getStream(f);
+}
+
+static FILE *open_bgzf(FILE *fh) {
+    CompressedFile *f = st_calloc(1, sizeof(CompressedFile));
+    f->fh = fh;
+    f->blocks = st_malloc(BGZF_BATCH_SIZE * BGZF_MAX_BLOCK_SIZE);
+    f->block_sizes = st_malloc(BGZF_BATCH_SIZE * sizeof(int64_t));
+    f->data = st_malloc(BGZF_BATCH_SIZE * BGZF_MAX_BLOCK_SIZE);
+    f->data_sizes = st_malloc(BGZF_BATCH_SIZE * sizeof(int64_t));
+    return compressedFile_getStream(f);
+}
+
+FILE *cactusFile_open(const char *fileName) {
+    if (fileName == NULL) { // zlib reads uncompressed input as is, so stdin need not be inspected
+        return open_gzip(gzdopen(dup(fileno(stdin)), "r"));
+    }
+    FILE *fh = fopen(fileName, "r");
+    if (fh == NULL) {
+        return NULL;
+    }
+    uint8_t header[BGZF_HEADER_SIZE];
+    size_t i = fread(header, 1, BGZF_HEADER_SIZE, fh);
+    if (fseek(fh, 0, SEEK_SET) != 0) { // Not seekable, so let zlib work out if it is compressed
+        fclose(fh);
+        return open_gzip(gzopen(fileName, "r"));
+    }
+    if (i == BGZF_HEADER_SIZE && is_bgzf_header(header)) {
+        return open_bgzf(fh);
+    }
+    if (i >= 2 && header[0] == 31 && header[1] == 139) {
+        fclose(fh);
+        return open_gzip(gzopen(fileName, "r"));
+    }
+    return fh;
+}
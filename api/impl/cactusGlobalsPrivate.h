@@ -50,6 +50,7 @@
 #include "cactusDisk.h"
 #include "cactusDiskPrivate.h"
 #include "cactusMisc.h"
+#include "cactusFile.h"
 #include "cactusFlowerPrivate.h"
 #include "cactusTestCommon.h"
 
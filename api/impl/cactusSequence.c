@@ -5,6 +5,7 @@
  */
 
 #include "cactusGlobalsPrivate.h"
+#include <ctype.h>
 
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -78,6 +79,97 @@ char *sequence_getString(Sequence *sequence, int64_t start, int64_t length, int6
 	return cactusDisk_getString(sequence->cactusDisk, sequence->stringName, start - sequence_getStart(sequence), length, strand, sequence->length);
 }
 
+SequenceView sequence_getView(Sequence *sequence, int64_t start, int64_t length, int64_t strand) {
+	assert(start >= sequence_getStart(sequence));
+	assert(length >= 0);
+	assert(start + length <= sequence_getStart(sequence) + sequence_getLength(sequence));
+	SequenceView view;
+	view.string = cactusDisk_getPackedString(sequence->cactusDisk, sequence->stringName);
+	view.start = start - sequence_getStart(sequence);
+	view.length = length;
+	view.strand = strand;
+	return view;
+}
+
+SequenceView sequenceView_getSubView(SequenceView *view, int64_t start, int64_t length) {
+	assert(start >= 0 && length >= 0 && start + length <= view->length);
+	SequenceView subView = *view;
+	subView.start = view->strand ? view->start + start : view->start + view->length - start - length;
+	subView.length = length;
+	return subView;
+}
+
+SequenceView sequenceView_getReverseComplement(SequenceView *view) {
+	SequenceView reverseView = *view;
+	reverseView.strand = !view->strand;
+	return reverseView;
+}
+
+void sequenceView_getString(SequenceView *view, char *buffer) {
+	packedString_decode(view->string, view->start, view->length, view->strand, buffer);
+}
+
+void sequenceView_getIterator(SequenceView *view, SequenceViewIterator *it) {
+	const PackedString *string = view->string;
+	it->string = string;
+	it->remaining = view->length;
+	it->strand = view->strand;
+	if (view->strand) { // Walk forwards from the first run that could contain the start
+		it->position = view->start;
+		it->exceptionIndex = packedString_firstRunEndingAfter(string->exceptions, string->exceptionNumber, it->position);
+		it->maskIndex = packedString_firstRunEndingAfter(string->masks, string->maskNumber, it->position);
+	} else { // Walk backwards from the last run that starts at or before the end
+		it->position = view->start + view->length - 1;
+		it->exceptionIndex = packedString_firstRunEndingAfter(string->exceptions, string->exceptionNumber, it->position);
+		if (it->exceptionIndex == string->exceptionNumber || string->exceptions[it->exceptionIndex].start > it->position) {
+			it->exceptionIndex--;
+		}
+		it->maskIndex = packedString_firstRunEndingAfter(string->masks, string->maskNumber, it->position);
+		if (it->maskIndex == string->maskNumber || string->masks[it->maskIndex].start > it->position) {
+			it->maskIndex--;
+		}
+	}
+}
+
+/*
+ * Returns true if the position is in the run with the given index, first moving the index past runs the iterator
+ * has walked beyond.
+ */
+static bool sequenceView_inRun(const PackedRun *runs, int64_t runNumber, int64_t *index, int64_t position, int64_t strand) {
+	if (strand) {
+		while (*index < runNumber && runs[*index].start + runs[*index].length <= position) {
+			(*index)++;
+		}
+		return *index < runNumber && runs[*index].start <= position;
+	}
+	while (*index >= 0 && runs[*index].start > position) {
+		(*index)--;
+	}
+	return *index >= 0 && runs[*index].start + runs[*index].length > position;
+}
+
+char sequenceView_getNext(SequenceViewIterator *it) {
+	if (it->remaining == 0) {
+		return '\0';
+	}
+	const PackedString *string = it->string;
+	int64_t i = it->position;
+	char c = "ACGT"[(string->bases[i / 4] >> (2 * (i % 4))) & 3];
+	if (sequenceView_inRun(string->exceptions, string->exceptionNumber, &it->exceptionIndex, i, it->strand)) {
+		c = string->exceptions[it->exceptionIndex].c;
+	}
+	if (sequenceView_inRun(string->masks, string->maskNumber, &it->maskIndex, i, it->strand)) {
+		c = tolower(c);
+	}
+	it->remaining--;
+	if (it->strand) {
+		it->position++;
+		return c;
+	}
+	it->position--;
+	return stString_reverseComplementChar(c);
+}
+
 const char *sequence_getHeader(Sequence *sequence) {
 	return sequence->header;
 }
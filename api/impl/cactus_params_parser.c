@@ -14,8 +14,69 @@
 #include "cactus.h"
 #include "cactus_params_parser.h"
 
+/*
+ * The value of a node or attribute in the table of parameters. Nodes have no string.
+ */
+typedef struct _paramValue {
+    char *string;
+    bool is_int; // If the string starts with an integer
+    int64_t int_value;
+    bool is_float; // If the string starts with a float
+    float float_value;
+} ParamValue;
+
+static ParamValue *param_value_construct(const char *string) {
+    ParamValue *v = st_calloc(1, sizeof(ParamValue));
+    if(string != NULL) {
+        v->string = stString_copy(string);
+        v->is_int = sscanf(string, "%" PRIi64 "", &v->int_value) == 1;
+        v->is_float = sscanf(string, "%f", &v->float_value) == 1;
+    }
+    return v;
+}
+
+static void param_value_destruct(ParamValue *v) {
+    free(v->string);
+    free(v);
+}
+
+/*
+ * Adds the node, its attributes and its descendants to the table, with the given path. As get_child_node
+ * finds the first child with a name, a node whose path is already in the table is skipped along with its
+ * descendants.
+ */
+static void add_to_table(stHash *table, xmlNodePtr node, const char *path) {
+    if(stHash_search(table, (void *)path) != NULL) {
+        return;
+    }
+    stHash_insert(table, stString_copy(path), param_value_construct(NULL));
+    for(xmlAttrPtr attribute = node->properties; attribute != NULL; attribute = attribute->next) {
+        char *value = (char *)xmlGetProp(node, attribute->name);
+        char *attribute_path = stString_print("%s@%s", path, (const char *)attribute->name);
+        if(value != NULL && stHash_search(table, attribute_path) == NULL) {
+            stHash_insert(table, attribute_path, param_value_construct(value));
+        }
+        else {
+            free(attribute_path);
+        }
+        xmlFree(value);
+    }
+    for(xmlNodePtr child = node->xmlChildrenNode; child != NULL; child = child->next) {
+        if(child->type == XML_ELEMENT_NODE) {
+            char *child_path = path[0] == '\0' ? stString_copy((const char *)child->name) :
+                               stString_print("%s/%s", path, (const char *)child->name);
+            add_to_table(table, child, child_path);
+            free(child_path);
+        }
+    }
+}
+
 void cactusParams_destruct(CactusParams *p) {
     xmlFreeDoc(p->doc);
+    if(p->table != NULL) {
+        stHash_destruct(p->table);
+    }
+    free(p->cur_path);
     free(p);
 }
 
@@ -47,6 +108,12 @@ CactusParams *cactusParams_load(char *file_name) {
 
     // Set the current root node pointer to the actual root of the xml tree.
     p->cur = p->root;
+    p->cur_path = stString_copy("");
+
+    // Build the table of parameters, after which the tree is not used to get parameters
+    p->table = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                 (void (*)(void *))param_value_destruct);
+    add_to_table(p->table, p->root, p->cur_path);
 
     return p;
 }
@@ -88,67 +155,99 @@ static xmlNodePtr get_descendant_node(xmlNodePtr cur, int num, va_list *args) {
     return cur;
 }
 
+/*
+ * Gets the path of the descendant node of the node with the given path, as for get_descendant_node.
+ */
+static char *get_descendant_path(const char *path, int num, va_list *args) {
+    va_list args2;
+    va_copy(args2, *args);
+    stList *names = stList_construct();
+    if(path[0] != '\0') {
+        stList_append(names, (void *)path);
+    }
+    for (int64_t i = 0; i < num; i++) {
+        stList_append(names, va_arg(args2, char *));
+    }
+    va_end(args2);
+    char *descendant_path = stString_join2("/", names);
+    stList_destruct(names);
+    return descendant_path;
+}
+
 void cactusParams_set_root(CactusParams *p, int num, ...) {
     va_list args;
     va_start(args, num);
     p->cur = get_descendant_node(p->root, num, &args);
+    free(p->cur_path);
+    p->cur_path = p->cur == NULL ? NULL : get_descendant_path("", num, &args);
     va_end(args);
 }
 
-static char *cactusParams_get_string2(CactusParams *p, int num, va_list *args) {
-    va_list args2;
-    va_copy(args2, *args); // to use the variable args we must copy it - see https://wiki.sei.cmu.edu/confluence/display/c/MSC39-C.+Do+not+call+va_arg%28%29+on+a+va_list+that+has+an+indeterminate+value
-    xmlNodePtr c = get_descendant_node(p->cur, num-1, &args2);
-
-    if(c == NULL) {
+/*
+ * Gets the value of the attribute, named by the last of the num strings, of the node given by the
+ * preceding strings. If the attribute is missing, returns NULL unless required, in which case it aborts.
+ */
+static ParamValue *cactusParams_get_value(CactusParams *p, bool required, int num, va_list *args) {
+    if(p->cur_path == NULL) {
         st_errAbort("ERROR: Failed to get string from cactus XML");
     }
+    va_list args2;
+    va_copy(args2, *args);
+    char *node_path = get_descendant_path(p->cur_path, num-1, &args2);
     const char *attribute_name = NULL;
     for (int64_t i = 0; i < num; i++) { // Loop to discard the earlier strings in the input
         attribute_name = va_arg(args2, char *);
     }
-    char *v =  (char *)xmlGetProp(c, (const xmlChar *)attribute_name);
+    va_end(args2);
 
-    if(v == NULL) {
+    char *attribute_path = stString_print("%s@%s", node_path, attribute_name);
+    ParamValue *v = stHash_search(p->table, attribute_path);
+    if(v == NULL && required) {
+        if(stHash_search(p->table, node_path) == NULL) {
+            st_errAbort("ERROR: Cactus XML param node %s not found", node_path);
+        }
         st_errAbort("ERROR: Failed to get attribute: %s from cactus XML", attribute_name);
     }
-
-    va_end(args2);
-
+    free(attribute_path);
+    free(node_path);
     return v;
 }
 
 char *cactusParams_get_string(CactusParams *p, int num, ...) {
     va_list args;
     va_start(args, num);
-    char *c = cactusParams_get_string2(p, num, &args);
+    ParamValue *v = cactusParams_get_value(p, 1, num, &args);
     va_end(args);
-    char *d = stString_copy(c);
-    xmlFree(c);
-    return d;
+    return stString_copy(v->string);
 }
 
 int64_t cactusParams_get_int(CactusParams *p, int num, ...) {
     va_list args;
     va_start(args, num);
+    ParamValue *v = cactusParams_get_value(p, 1, num, &args);
+    va_end(args);
+    assert(v->is_int);
+    return v->int_value;
+}
 
-    char *c = cactusParams_get_string2(p, num, &args);
-    int64_t j;
-    int i = sscanf(c, "%" PRIi64 "", &j);
-    xmlFree(c);
-    assert(i == 1);
-
+int64_t cactusParams_get_int_with_default(CactusParams *p, int64_t default_value, int num, ...) {
+    va_list args;
+    va_start(args, num);
+    ParamValue *v = cactusParams_get_value(p, 0, num, &args);
     va_end(args);
-    return j;
+    if(v == NULL) {
+        return default_value;
+    }
+    assert(v->is_int);
+    return v->int_value;
 }
 
 int64_t *cactusParams_get_ints(CactusParams *p, int64_t *length, int num, ...) {
     va_list args;
     va_start(args, num);
 
-    char *c = cactusParams_get_string2(p, num, &args);
-    stList *l = stString_split(c);
-    xmlFree(c);
+    ParamValue *v = cactusParams_get_value(p, 1, num, &args);
+    stList *l = stString_split(v->string);
     *length = stList_length(l);
     int64_t *ints = st_malloc(sizeof(int64_t) * *length);
     for(int64_t i=0; i<*length; i++) {
@@ -164,13 +263,8 @@ int64_t *cactusParams_get_ints(CactusParams *p, int64_t *length, int num, ...) {
 double cactusParams_get_float(CactusParams *p, int num, ...) {
     va_list args;
     va_start(args, num);
-
-    char *c = cactusParams_get_string2(p, num, &args);
-    float j;
-    int i = sscanf(c, "%f", &j);
-    xmlFree(c);
-    assert(i == 1);
-
+    ParamValue *v = cactusParams_get_value(p, 1, num, &args);
     va_end(args);
-    return j;
+    assert(v->is_float);
+    return v->float_value;
 }
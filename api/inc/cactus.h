@@ -21,6 +21,7 @@
 #include "cactusFlower.h"
 #include "cactusDisk.h"
 #include "cactusMisc.h"
+#include "cactusFile.h"
 #include "cactusTestCommon.h"
 #include "cactus_params_parser.h"
 
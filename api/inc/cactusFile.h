@@ -0,0 +1,19 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_FILE_H_
+#define CACTUS_FILE_H_
+
+#include <stdio.h>
+
+/*
+ * Opens the file for reading, transparently decompressing it if it is gzip compressed. BGZF files, which are
+ * compressed in independent blocks, are decompressed a batch of blocks at a time, with the blocks of a batch
+ * inflated in parallel. Uncompressed files are returned as opened by fopen. If fileName is NULL then stdin is
+ * read, decompressing it if it is gzip compressed. The returned file is closed with fclose. Returns NULL if the
+ * file can not be opened.
+ */
+FILE *cactusFile_open(const char *fileName);
+
+#endif
@@ -9,6 +9,29 @@
 
 #include "cactusGlobals.h"
 
+/*
+ * A view of an interval of a sequence on one of its strands. A view reads the stored string in place, so it is cheap
+ * to make and needs no cleanup, but it is only valid while the cactus disk holding the sequence is.
+ */
+typedef struct _sequenceView {
+    const PackedString *string;
+    int64_t start; // Offset of the interval in the stored (positive strand) string
+    int64_t length;
+    int64_t strand;
+} SequenceView;
+
+/*
+ * Iterates over the bases of a view in the order of its strand. Initialise with sequenceView_getIterator.
+ */
+typedef struct _sequenceViewIterator {
+    const PackedString *string;
+    int64_t position; // Position in the stored string of the next base
+    int64_t remaining; // Number of bases left to return
+    int64_t strand;
+    int64_t exceptionIndex; // Indices of the current runs of non-ACGT and soft-masked characters
+    int64_t maskIndex;
+} SequenceViewIterator;
+
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -56,6 +79,40 @@ Event *sequence_getEvent(Sequence *sequence);
  */
 char *sequence_getString(Sequence *sequence, int64_t start, int64_t length, int64_t strand);
 
+/*
+ * Gets a view of a subsequence of the meta sequence, with the same arguments as sequence_getString but without
+ * copying the string.
+ */
+SequenceView sequence_getView(Sequence *sequence, int64_t start, int64_t length, int64_t strand);
+
+/*
+ * Gets the view of the interval [start, start+length) of the given view, with coordinates relative to the
+ * view's strand.
+ */
+SequenceView sequenceView_getSubView(SequenceView *view, int64_t start, int64_t length);
+
+/*
+ * Gets the view of the same interval on the opposite strand.
+ */
+SequenceView sequenceView_getReverseComplement(SequenceView *view);
+
+/*
+ * Decodes the bases of the view into the buffer, which must have space for view->length+1 characters, and
+ * terminates it.
+ */
+void sequenceView_getString(SequenceView *view, char *buffer);
+
+/*
+ * Initialises the iterator to the first base of the view.
+ */
+void sequenceView_getIterator(SequenceView *view, SequenceViewIterator *it);
+
+/*
+ * Returns the next base of the view (reverse complemented if the view is on the negative strand), or '\0' if there
+ * are no more bases.
+ */
+char sequenceView_getNext(SequenceViewIterator *it);
+
 /*
  * Gets the header line associated with the meta sequence.
  */
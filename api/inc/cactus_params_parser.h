@@ -7,9 +7,14 @@
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
+#include "sonLib.h"
 
 /*
  * Cactus parameters object.
+ *
+ * When loaded, every node and attribute of the xml tree is put in a table keyed by its path from the root, so
+ * the parameters are looked up without walking the tree, and, as the table is not modified after loading, can be
+ * read from multiple threads at once.
  */
 typedef struct _cactusParams {
     xmlDocPtr doc; // The underlying xml document representing the parameters
@@ -17,6 +22,8 @@ typedef struct _cactusParams {
     xmlNodePtr cur; // The node of the xml tree we search from to retrieve parameters.
     // can be set by cactusParams_set_root(CactusParams *p, int, ...), by default is set
     // to the root of the tree.
+    stHash *table; // Map of node paths ("caf/divergence") and attribute paths ("caf@trim") to their values
+    char *cur_path; // The path of cur, which prefixes the paths looked up in the table
 } CactusParams;
 
 /*
@@ -46,6 +53,11 @@ char *cactusParams_get_string(CactusParams *p, int, ...);
  */
 int64_t cactusParams_get_int(CactusParams *p, int, ...);
 
+/*
+ * Get an integer parameter, or default_value if the attribute is not in the params.
+ */
+int64_t cactusParams_get_int_with_default(CactusParams *p, int64_t default_value, int, ...);
+
 /*
  * Get a float parameter.
  */
@@ -20,6 +20,7 @@ CuSuite *cactusDiskTestSuite();
 CuSuite *cactusMiscTestSuite();
 CuSuite *cactusFlowerTestSuite();
 CuSuite *cactusParamsTestSuite(void);
+CuSuite *cactusFileTestSuite(void);
 
 int cactusAPIRunAllTests(void) {
 	CuString *output = CuStringNew();
@@ -38,6 +39,7 @@ int cactusAPIRunAllTests(void) {
 	CuSuiteAddSuite(suite, cactusMiscTestSuite());
 	CuSuiteAddSuite(suite, cactusFlowerTestSuite());
     CuSuiteAddSuite(suite, cactusParamsTestSuite());
+    CuSuiteAddSuite(suite, cactusFileTestSuite());
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
@@ -85,6 +85,26 @@ void testCactusDisk_getUniqueID_UniqueIntervals(CuTest* testCase) {
     cactusDisk_destruct(cactusDisk);
 }
 
+void testCactusDisk_getUniqueID_Parallel(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    int64_t idNumber = 100000;
+    Name *names = st_malloc(sizeof(Name) * idNumber);
+#pragma omp parallel for schedule(static, 1)
+    for (int64_t i = 0; i < idNumber; i++) { // Get ids from many threads at once
+        names[i] = cactusDisk_getUniqueID(cactusDisk);
+    }
+    // Check the ids are all different
+    stSortedSet *uniqueNames = stSortedSet_construct3(testCactusDisk_getUniqueID_UniqueP, free);
+    for (int64_t i = 0; i < idNumber; i++) {
+        char *cA = cactusMisc_nameToString(names[i]);
+        CuAssertTrue(testCase, stSortedSet_search(uniqueNames, cA) == NULL);
+        stSortedSet_insert(uniqueNames, cA);
+    }
+    stSortedSet_destruct(uniqueNames);
+    free(names);
+    cactusDisk_destruct(cactusDisk);
+}
+
 CuSuite* cactusDiskTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testCactusDisk_getFlower);
@@ -92,6 +112,7 @@ CuSuite* cactusDiskTestSuite(void) {
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_Unique);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_UniqueIntervals);
+    SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_Parallel);
     SUITE_ADD_TEST(suite, testCactusDisk_constructAndDestruct);
     return suite;
 }
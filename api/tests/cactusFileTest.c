@@ -0,0 +1,103 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+#include <zlib.h>
+
+static char *tempFile = "tempFileForCactusFileTest";
+
+static char *getRandomText(int64_t length) {
+    char *text = st_malloc(length + 1);
+    for (int64_t i = 0; i < length; i++) {
+        text[i] = st_random() > 0.05 ? "ACGT"[st_randomInt(0, 4)] : '\n';
+    }
+    text[length] = '\0';
+    return text;
+}
+
+/*
+ * Writes the text as a BGZF file, in blocks of the given length, ending with an empty block.
+ */
+static void writeBgzf(const char *fileName, const char *text, int64_t length, int64_t blockLength) {
+    FILE *fh = fopen(fileName, "w");
+    uint8_t *block = st_malloc(2 * blockLength + 1024);
+    for (int64_t i = 0; i <= length; i += blockLength) {
+        int64_t dataLength = length - i < blockLength ? length - i : blockLength;
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY); // Raw deflate
+        z.next_in = (uint8_t *)text + i;
+        z.avail_in = dataLength;
+        z.next_out = block + 18;
+        z.avail_out = 2 * blockLength + 1024 - 26;
+        deflate(&z, Z_FINISH);
+        int64_t compressedLength = z.total_out;
+        deflateEnd(&z);
+        uint8_t header[18] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+        int64_t blockSize = 18 + compressedLength + 8 - 1;
+        header[16] = blockSize & 0xff;
+        header[17] = blockSize >> 8;
+        memcpy(block, header, 18);
+        uint32_t crc = crc32(0, (uint8_t *)text + i, dataLength);
+        for (int64_t j = 0; j < 4; j++) {
+            block[18 + compressedLength + j] = (crc >> (8 * j)) & 0xff;
+            block[22 + compressedLength + j] = (dataLength >> (8 * j)) & 0xff;
+        }
+        fwrite(block, 1, blockSize + 1, fh);
+        if (dataLength == 0) {
+            break;
+        }
+    }
+    free(block);
+    fclose(fh);
+}
+
+static void checkFile(CuTest *testCase, const char *text, int64_t length) {
+    FILE *fh = cactusFile_open(tempFile);
+    CuAssertTrue(testCase, fh != NULL);
+    char *text2 = st_malloc(length + 1);
+    int64_t i = 0, j;
+    while ((j = fread(text2 + i, 1, st_randomInt(1, 10000), fh)) > 0) { // Read in random sized pieces
+        i += j;
+        CuAssertTrue(testCase, i <= length);
+    }
+    CuAssertIntEquals(testCase, length, i);
+    CuAssertTrue(testCase, memcmp(text, text2, length) == 0);
+    fclose(fh);
+    free(text2);
+}
+
+static void testCactusFile_open(CuTest *testCase) {
+    for (int64_t test = 0; test < 20; test++) {
+        int64_t length = st_randomInt(0, 500000);
+        char *text = getRandomText(length);
+
+        // Uncompressed
+        FILE *fh = fopen(tempFile, "w");
+        fwrite(text, 1, length, fh);
+        fclose(fh);
+        checkFile(testCase, text, length);
+
+        // Gzip compressed
+        gzFile gz = gzopen(tempFile, "w");
+        gzwrite(gz, text, length);
+        gzclose(gz);
+        checkFile(testCase, text, length);
+
+        // BGZF compressed, in blocks of random length, or in alternate tests in blocks small enough that the file
+        // takes several of the batches of blocks that are inflated at once
+        writeBgzf(tempFile, text, length, test % 2 == 0 ? st_randomInt(1, 65536) : 1 + length / 1000);
+        checkFile(testCase, text, length);
+
+        free(text);
+    }
+    stFile_rmtree(tempFile);
+    CuAssertTrue(testCase, cactusFile_open(tempFile) == NULL);
+}
+
+CuSuite* cactusFileTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testCactusFile_open);
+    return suite;
+}
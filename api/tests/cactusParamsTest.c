@@ -44,8 +44,41 @@ static void testCactusParams(CuTest *testCase) {
     free(l);
 }
 
+static void testCactusParams_repeatedNodes(CuTest *testCase) {
+    // As when searching the xml tree, the first of a set of sibling nodes with the same name is used
+    char *temp_file = "tempFileForCactusParamsTest.xml";
+    FILE *fh = fopen(temp_file, "w");
+    fprintf(fh, "<cactusWorkflowConfig version=\"2\">\n"
+                "\t<a x=\"1\" y=\"1.5\"><b z=\"3\"/></a>\n"
+                "\t<a x=\"2\" w=\"4\"><b z=\"5\"/><c v=\"6 7\"/></a>\n"
+                "</cactusWorkflowConfig>\n");
+    fclose(fh);
+    CactusParams *p = cactusParams_load(temp_file);
+
+    CuAssertIntEquals(testCase, 2, cactusParams_get_int(p, 1, "version"));
+    CuAssertIntEquals(testCase, 1, cactusParams_get_int(p, 2, "a", "x"));
+    CuAssertDblEquals(testCase, 1.5, cactusParams_get_float(p, 2, "a", "y"), 0.000001);
+    CuAssertIntEquals(testCase, 3, cactusParams_get_int(p, 3, "a", "b", "z"));
+    char *c = cactusParams_get_string(p, 2, "a", "x");
+    CuAssertStrEquals(testCase, "1", c);
+    free(c);
+
+    CuAssertIntEquals(testCase, 1, cactusParams_get_int_with_default(p, 10, 2, "a", "x"));
+    CuAssertIntEquals(testCase, 10, cactusParams_get_int_with_default(p, 10, 2, "a", "u"));
+    CuAssertIntEquals(testCase, 10, cactusParams_get_int_with_default(p, 10, 2, "d", "x"));
+
+    cactusParams_set_root(p, 2, "a", "b");
+    CuAssertIntEquals(testCase, 3, cactusParams_get_int(p, 1, "z"));
+    cactusParams_set_root(p, 0);
+    CuAssertIntEquals(testCase, 1, cactusParams_get_int(p, 2, "a", "x"));
+
+    cactusParams_destruct(p);
+    stFile_rmtree(temp_file);
+}
+
 CuSuite* cactusParamsTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testCactusParams);
+    SUITE_ADD_TEST(suite, testCactusParams_repeatedNodes);
     return suite;
 }
@@ -69,6 +69,99 @@ void testSequence_getString(CuTest* testCase) {
     }
 }
 
+/*
+ * Makes a random string with runs of soft-masked bases, Ns and other IUPAC characters.
+ */
+static char *getRandomString(int64_t length) {
+    const char *alphabet = "ACGTNRYKMacgtnrykm";
+    char *string = st_malloc(sizeof(char) * (length + 1));
+    int64_t i = 0;
+    while (i < length) {
+        char c = alphabet[st_randomInt(0, strlen(alphabet))];
+        int64_t runLength = st_random() > 0.5 ? 1 : st_randomInt(1, 20);
+        for (int64_t j = 0; j < runLength && i < length; j++) {
+            string[i++] = st_random() > 0.5 ? c : alphabet[st_randomInt(0, 8)];
+        }
+    }
+    string[length] = '\0';
+    return string;
+}
+
+void testSequence_getString_random(CuTest* testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        cactusSequenceTestSetup(testCase);
+        int64_t length = st_randomInt(1, 200);
+        char *string = getRandomString(length);
+        Sequence *sequence2 = sequence_construct(5, length, string, headerString, event, cactusDisk);
+        for (int64_t i = 0; i < 100; i++) {
+            int64_t start = st_randomInt(0, length);
+            int64_t subLength = st_randomInt(0, length - start + 1);
+            char *expected = stString_getSubString(string, start, subLength);
+            char *decoded = sequence_getString(sequence2, 5 + start, subLength, 1);
+            CuAssertStrEquals(testCase, expected, decoded);
+            free(decoded);
+            char *reverseComplement = stString_reverseComplementString(expected);
+            decoded = sequence_getString(sequence2, 5 + start, subLength, 0);
+            CuAssertStrEquals(testCase, reverseComplement, decoded);
+            free(decoded);
+            free(reverseComplement);
+            free(expected);
+        }
+        sequence_destruct(sequence2);
+        free(string);
+        cactusSequenceTestTeardown(testCase);
+    }
+}
+
+void testSequence_getView_random(CuTest* testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        cactusSequenceTestSetup(testCase);
+        int64_t length = st_randomInt(1, 200);
+        char *string = getRandomString(length);
+        Sequence *sequence2 = sequence_construct(5, length, string, headerString, event, cactusDisk);
+        char *buffer = st_malloc(sizeof(char) * (length + 1));
+        for (int64_t i = 0; i < 100; i++) {
+            int64_t start = st_randomInt(0, length);
+            int64_t subLength = st_randomInt(0, length - start + 1);
+            int64_t strand = st_random() > 0.5;
+            char *expected = sequence_getString(sequence2, 5 + start, subLength, strand);
+            SequenceView view = sequence_getView(sequence2, 5 + start, subLength, strand);
+            CuAssertIntEquals(testCase, subLength, view.length);
+            sequenceView_getString(&view, buffer);
+            CuAssertStrEquals(testCase, expected, buffer);
+
+            // Iterate the bases
+            SequenceViewIterator it;
+            sequenceView_getIterator(&view, &it);
+            for (int64_t j = 0; j < subLength; j++) {
+                CuAssertIntEquals(testCase, expected[j], sequenceView_getNext(&it));
+            }
+            CuAssertIntEquals(testCase, '\0', sequenceView_getNext(&it));
+
+            // The reverse complement view
+            SequenceView reverseView = sequenceView_getReverseComplement(&view);
+            char *reverseComplement = sequence_getString(sequence2, 5 + start, subLength, !strand);
+            sequenceView_getString(&reverseView, buffer);
+            CuAssertStrEquals(testCase, reverseComplement, buffer);
+            free(reverseComplement);
+
+            // A sub view
+            int64_t subStart = st_randomInt(0, subLength + 1);
+            int64_t subSubLength = st_randomInt(0, subLength - subStart + 1);
+            SequenceView subView = sequenceView_getSubView(&view, subStart, subSubLength);
+            sequenceView_getString(&subView, buffer);
+            char *expectedSub = stString_getSubString(expected, subStart, subSubLength);
+            CuAssertStrEquals(testCase, expectedSub, buffer);
+            free(expectedSub);
+            free(expected);
+        }
+        free(buffer);
+        sequence_destruct(sequence2);
+        free(string);
+        cactusSequenceTestTeardown(testCase);
+    }
+}
+
 void testSequence_getHeader(CuTest* testCase) {
     cactusSequenceTestSetup(testCase);
     CuAssertStrEquals(testCase, headerString, sequence_getHeader(sequence));
@@ -92,6 +185,8 @@ CuSuite* cactusSequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testSequence_getLength);
     SUITE_ADD_TEST(suite, testSequence_getEvent);
     SUITE_ADD_TEST(suite, testSequence_getString);
+    SUITE_ADD_TEST(suite, testSequence_getString_random);
+    SUITE_ADD_TEST(suite, testSequence_getView_random);
     SUITE_ADD_TEST(suite, testSequence_isTrivialSequence);
     SUITE_ADD_TEST(suite, testSequence_getHeader);
     return suite;
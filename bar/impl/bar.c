@@ -49,6 +49,87 @@ bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     return !stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree, f->minimumOutgroupDegree, f->minimumDegree, f->minimumNumberOfSpecies);
 }
 
+typedef struct _flowerCost {
+    Flower *flower;
+    double cost; // Estimated time to align the flower, in arbitrary units
+    int64_t memory; // Estimated peak memory used aligning the flower, in bytes
+} FlowerCost;
+
+static int flowerCost_cmp(const void *a, const void *b) {
+    const FlowerCost *f1 = a, *f2 = b;
+    if (f1->cost != f2->cost) {
+        return f1->cost > f2->cost ? -1 : 1; // Sort in descending order of cost
+    }
+    // Break ties by name so that the order does not depend on the input order
+    return cactusMisc_nameCompare(flower_getName(f1->flower), flower_getName(f2->flower));
+}
+
+static int int64_cmpDescending(const void *a, const void *b) {
+    int64_t i = *(const int64_t *)a, j = *(const int64_t *)b;
+    return i < j ? 1 : (i > j ? -1 : 0);
+}
+
+/*
+ * Estimates the cost and peak memory of aligning the flower.
+ *
+ * For the cost, each base of an adjacency (up to maximumLength of it) is aligned against the other sequences of its
+ * end, whose extent is bounded by the longest adjacency of the end and by the band (the poa window, or maximumLength
+ * for pecan), and building the cactus costs roughly the number of caps.
+ *
+ * For the memory, abpoa holds five 32 bit DP matrices of the window length by the number of graph nodes, taken
+ * to be twice the window length, for each end being aligned, and at most threadNumber ends of a flower are aligned
+ * at once. Pecan aligns the ends one at a time, with a forward and backward matrix of five 64 bit states over at most
+ * pecanMatrixArea cells. The strings and the msas of all the ends are held until the flower is done.
+ */
+static void estimateFlowerCost(FlowerCost *flowerCost, int64_t maximumLength, bool usePoa, int64_t poaWindow,
+                               int64_t pecanMatrixArea, int64_t threadNumber) {
+    Flower *flower = flowerCost->flower;
+    int64_t band = usePoa ? poaWindow : maximumLength;
+    flowerCost->cost = flower_getCapNumber(flower);
+    flowerCost->memory = 0;
+    int64_t *endMemories = st_malloc(sizeof(int64_t) * (flower_getEndNumber(flower) + 1));
+    int64_t endNumber = 0;
+    End *end;
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        int64_t bases = 0, maxLength = 0, capNumber = 0;
+        Cap *cap;
+        End_InstanceIterator *capIt = end_getInstanceIterator(end);
+        while ((cap = end_getNext(capIt)) != NULL) {
+            if (cap_getSide(cap)) {
+                cap = cap_getReverse(cap);
+            }
+            if (cap_getSequence(cap) == NULL || cap_getAdjacency(cap) == NULL) {
+                continue;
+            }
+            int length;
+            get_adjacency_string(cap, &length, 0);
+            if (length > maximumLength) {
+                length = maximumLength;
+            }
+            bases += length;
+            capNumber++;
+            if (length > maxLength) {
+                maxLength = length;
+            }
+        }
+        end_destructInstanceIterator(capIt);
+        int64_t l = maxLength < band ? maxLength : band;
+        flowerCost->cost += (double)bases * l;
+        flowerCost->memory += bases + capNumber * 2 * l; // The strings and the msa
+        endMemories[endNumber++] = usePoa ? 5 * sizeof(int32_t) * 2 * l * l :
+                                   2 * 5 * sizeof(double) * (l * l < pecanMatrixArea ? l * l : pecanMatrixArea);
+    }
+    flower_destructEndIterator(endIt);
+
+    // Add the DP memory of the ends that may be aligned at once
+    qsort(endMemories, endNumber, sizeof(int64_t), int64_cmpDescending);
+    for (int64_t i = 0; i < endNumber && i < (usePoa ? threadNumber : 1); i++) {
+        flowerCost->memory += endMemories[i];
+    }
+    free(endMemories);
+}
+
 void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles) {
     //////////////////////////////////////////////
     //Parse the many, many necessary parameters from the params file
@@ -80,79 +161,147 @@ void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *
         st_errAbort("We have precomputed alignments but %" PRIi64 " flowers to align.\n", stList_length(flowers));
     }
 
+    // Order the flowers from the most to the least expensive, and align each in its own task, so that the
+    // most expensive flowers start first and the threads that finish early take the remaining flowers, or the ends
+    // of a large flower, which make_consistent_partial_order_alignments splits into tasks of their own
+    int64_t threadNumber = 1;
 #if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
+    threadNumber = omp_get_max_threads();
 #endif
-    for (int64_t j = 0; j<stList_length(flowers); j++) {
-        Flower *flower = stList_get(flowers, j);
-
-        // These are all variables used by the filter fns
-        FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
-        fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
-        fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
-        fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
-        fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
-        fa->flower = flower;
-
-        void *alignments;
-        if (usePoa) {
-            /*
-             * This makes a consistent set of alignments using abPoa.
-             *
-             * It does not use any precomputed alignments, if they are provided they will be ignored
-             */
-            alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter, poaParameters);
-            st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
-        } else {
-            alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
-                                              useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
-                                              pruneOutStubAlignments);
-            st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
-        }
+    int64_t flowerNumber = stList_length(flowers);
+    FlowerCost *flowerCosts = st_malloc(sizeof(FlowerCost) * flowerNumber);
+    for (int64_t j = 0; j < flowerNumber; j++) {
+        flowerCosts[j].flower = stList_get(flowers, j);
+        estimateFlowerCost(&flowerCosts[j], maximumLength, usePoa, poaWindow,
+                           pairwiseAlignmentParameters->splitMatrixBiggerThanThis, threadNumber);
+    }
+    qsort(flowerCosts, flowerNumber, sizeof(FlowerCost), flowerCost_cmp);
 
-        stPinchIterator *pinchIterator = NULL;
-        if(usePoa) {
-            pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
-        }
-        else {
-            pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
-        }
-        /*
-         * Run the cactus caf functions to build cactus.
-         */
+    // If there is a memory budget, a flower is only started when its estimated memory fits alongside the
+    // estimates of the flowers being aligned, taking the flowers in order but passing over those that do not yet fit.
+    // A flower is always started if nothing else is running, so flowers larger than the budget are still aligned.
+    int64_t memoryBudget = cactusParams_get_int_with_default(params, 0, 2, "bar", "memoryBudget"); // No budget if unset
+    int64_t reservedMemory = 0; // The summed estimates of the flowers being aligned
+    bool *started = st_calloc(flowerNumber, sizeof(bool));
+    int64_t firstUnstarted = 0;
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+    while (firstUnstarted < flowerNumber) {
+        bool startedAny = 0;
+        for (int64_t j = firstUnstarted; j < flowerNumber; j++) {
+            if (started[j]) {
+                continue;
+            }
+            int64_t memory = flowerCosts[j].memory, reserved;
+#if defined(_OPENMP)
+#pragma omp atomic read
+#endif
+            reserved = reservedMemory;
+            if (memoryBudget > 0 && reserved > 0 && reserved + memory > memoryBudget) {
+                continue;
+            }
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+            reservedMemory += memory;
+            started[j] = 1;
+            startedAny = 1;
+            if (j == firstUnstarted) {
+                while (firstUnstarted < flowerNumber && started[firstUnstarted]) {
+                    firstUnstarted++;
+                }
+            }
+#if defined(_OPENMP)
+#pragma omp task firstprivate(j, memory)
+#endif
+            {
+                Flower *flower = flowerCosts[j].flower;
 
-        stPinchThreadSet *threadSet = stCaf_setup(flower);
+                // These are all variables used by the filter fns
+                FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
+                fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
+                fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
+                fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
+                fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
+                fa->flower = flower;
 
-        stCaf_anneal(threadSet, pinchIterator, NULL, flower);
+                void *alignments;
+                if (usePoa) {
+                    /*
+                     * This makes a consistent set of alignments using abPoa.
+                     *
+                     * It does not use any precomputed alignments, if they are provided they will be ignored
+                     */
+                    alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter, poaParameters);
+                    st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
+                } else {
+                    alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
+                                                      useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
+                                                      pruneOutStubAlignments);
+                    st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
+                }
 
-        if (fa->minimumDegree < 2) {
-            stCaf_makeDegreeOneBlocks(threadSet);
-        }
+                stPinchIterator *pinchIterator = NULL;
+                if(usePoa) {
+                    pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
+                }
+                else {
+                    pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
+                }
+                /*
+                 * Run the cactus caf functions to build cactus.
+                 */
 
-        if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
-            stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
-        }
+                stPinchThreadSet *threadSet = stCaf_setup(flower);
 
-        stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+                stCaf_anneal(threadSet, pinchIterator, NULL, flower);
 
-        stPinchThreadSet_destruct(threadSet);
-        st_logDebug("Ran the cactus core script.\n");
+                if (fa->minimumDegree < 2) {
+                    stCaf_makeDegreeOneBlocks(threadSet);
+                }
 
-        /*
-         * Cleanup
-         */
-        //Clean up the sorted set after cleaning up the iterator
-        stPinchIterator_destruct(pinchIterator);
-        if(usePoa) {
-            stList_destruct(alignments);
+                if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
+                    stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
+                }
+
+                stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+
+                stPinchThreadSet_destruct(threadSet);
+                st_logDebug("Ran the cactus core script.\n");
+
+                /*
+                 * Cleanup
+                 */
+                //Clean up the sorted set after cleaning up the iterator
+                stPinchIterator_destruct(pinchIterator);
+                if(usePoa) {
+                    stList_destruct(alignments);
+                }
+                else {
+                    stSortedSet_destruct(alignments);
+                }
+                free(fa);
+
+                st_logDebug("Finished filling in the alignments for the flower\n");
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+                reservedMemory -= memory;
+            }
         }
-        else {
-            stSortedSet_destruct(alignments);
+        if (!startedAny) {
+            // Everything left is waiting for memory, so wait for the running flowers, aligning them on this thread
+            // if no other thread has taken them (as with one thread), which releases their memory
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
         }
-        free(fa);
-
-        st_logDebug("Finished filling in the alignments for the flower\n");
     }
+    free(flowerCosts);
+    free(started);
 
     //////////////////////////////////////////////
     //Clean up
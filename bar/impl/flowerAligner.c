@@ -237,12 +237,41 @@ void getScore(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, st
     stHash_insert(capScoresFnHash, cap, maxScore);
 }
 
-static int sortCapsFn(const void *cap1, const void *cap2, void *capScoresFnHash) {
-    assert(stHash_search((stHash *)capScoresFnHash, (void *) cap1) != NULL);
-    assert(stHash_search((stHash *)capScoresFnHash, (void *) cap2) != NULL);
-    int64_t i = ((int64_t *) stHash_search((stHash *)capScoresFnHash, (void *) cap1))[0] - ((int64_t *) stHash_search(
-            (stHash *)capScoresFnHash, (void *) cap2))[0];
-    return (i > 0) ? 1 : ((i < 0) ? -1 : 0); 
+/*
+ * A cap with its cut off score, looked up once before sorting rather than in each comparison.
+ */
+typedef struct _capScore {
+    Cap *cap;
+    int64_t score;
+    int64_t index; // Position of the cap before sorting, to break ties
+} CapScore;
+
+static int capScore_cmp(const void *a, const void *b) {
+    const CapScore *c1 = a, *c2 = b;
+    if (c1->score != c2->score) {
+        return c1->score > c2->score ? 1 : -1;
+    }
+    return c1->index > c2->index ? 1 : (c1->index < c2->index ? -1 : 0);
+}
+
+/*
+ * Sorts the caps in ascending order according to their cut off scores.
+ */
+static void sortCaps(stList *caps, stHash *capScoresFnHash) {
+    int64_t capNumber = stList_length(caps);
+    CapScore *capScores = st_malloc(sizeof(CapScore) * (capNumber + 1));
+    for (int64_t i = 0; i < capNumber; i++) {
+        capScores[i].cap = stList_get(caps, i);
+        int64_t *score = stHash_search(capScoresFnHash, capScores[i].cap);
+        assert(score != NULL);
+        capScores[i].score = score[0];
+        capScores[i].index = i;
+    }
+    qsort(capScores, capNumber, sizeof(CapScore), capScore_cmp);
+    for (int64_t i = 0; i < capNumber; i++) {
+        stList_set(caps, i, capScores[i].cap);
+    }
+    free(capScores);
 }
 
 bool isAlignedToStubSequence(AlignedPair *alignedPair, Flower *flower) {
@@ -365,7 +394,7 @@ static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments,
     }
     flower_destructEndIterator(endIterator);
     assert(stHash_size(capScoresFnHash) == stList_length(caps));
-    stList_sort2(caps, sortCapsFn, capScoresFnHash); //sorts the caps in ascending order according to their cut off score.
+    sortCaps(caps, capScoresFnHash); //sorts the caps in ascending order according to their cut off score.
 
     //Now do the actual pruning
     stHash *deletedAlignedPairCounts = stHash_construct3((uint64_t (*)(const void *))stIntTuple_hashKey,
@@ -17,9 +17,9 @@
 //#define CACTUS_ABPOA_FROM_COMMAND_LINE
 
 // OpenMP
-//#if defined(_OPENMP)
-//#include <omp.h>
-//#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params) {
     abpoa_para_t *abpt = abpoa_init_para();
@@ -80,9 +80,8 @@ abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params) {
     return abpt;
 }
 
-// It turns out abpoa can write to these, so we make a quick copy before using
-static abpoa_para_t *copy_abpoa_params(abpoa_para_t *abpt) {
-    abpoa_para_t *abpt_cpy = abpoa_init_para();
+// It turns out abpoa can write to these, so we reset a working copy from them before each use
+static void set_abpoa_params(abpoa_para_t *abpt_cpy, abpoa_para_t *abpt) {
     abpt_cpy->out_msa = 1;
     abpt_cpy->out_cons = 0;
     abpt_cpy->align_mode = abpt->align_mode;
@@ -108,7 +107,28 @@ static abpoa_para_t *copy_abpoa_params(abpoa_para_t *abpt) {
     }
     abpt_cpy->max_mat = abpt->max_mat;
     abpt_cpy->min_mis = abpt->min_mis;
-    return abpt_cpy;
+}
+
+/*
+ * The abpoa graph and parameters used by one thread, kept across windows and alignments so that they are only
+ * allocated once. abpoa_msa resets the graph at the start of each alignment.
+ */
+typedef struct _abpoaContext {
+    abpoa_t *ab;
+    abpoa_para_t *abpt;
+} AbpoaContext;
+
+static AbpoaContext *abpoa_context_construct(void) {
+    AbpoaContext *context = st_malloc(sizeof(AbpoaContext));
+    context->ab = abpoa_init();
+    context->abpt = abpoa_init_para();
+    return context;
+}
+
+static void abpoa_context_destruct(AbpoaContext *context) {
+    abpoa_free(context->ab);
+    abpoa_free_para(context->abpt);
+    free(context);
 }
 
 // char <--> uint8_t conversion copied over from abPOA example
@@ -160,11 +180,9 @@ uint8_t msa_to_byte(char c) {
     return nst_nt4_table[(int)c];
 }
 
-static uint8_t rc_table[6] = { 3, 2, 1, 0, 4, 5 };
-
-static inline uint8_t msa_to_rc(uint8_t n) {
-    return rc_table[n];
-}
+// the gap in our alphabet. abpoa emits the aligned bases in the codes they were given in (0-4, see msa_to_byte())
+// and gaps as abpt->m, which is 5 for nucleotides, so its output is already in our alphabet and needs no conversion
+static const uint8_t msa_gap = 5;
 
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
 // dump the abpoa input to files, and return a command line for running abpoa on them
@@ -296,56 +314,40 @@ void msa_print(Msa *msa, FILE *f) {
     fprintf(f, "\n");
 }
 
-/**
- * flip msa to its reverse complement (for trimming purposees)
- */
-static void flip_msa_seq(Msa* msa) {
-    if (msa != NULL) {
-        int64_t middle = msa->column_no / 2;
-        bool odd = msa->column_no % 2 == 1;
-        for (int64_t i = 0; i < msa->seq_no; ++i) {
-            for (int64_t j = 0; j < middle; ++j) {
-                uint8_t buf = msa->msa_seq[i][j];
-                msa->msa_seq[i][j] = msa_to_rc(msa->msa_seq[i][msa->column_no - 1 - j]);
-                msa->msa_seq[i][msa->column_no - 1 - j] = msa_to_rc(buf);
-            }
-            if (odd) {
-                msa->msa_seq[i][middle] = msa_to_rc(msa->msa_seq[i][middle]);
-            }
-        }
-    }
-}
-
 /**
  * Returns an array of floats, one for each corresponding column in the MSA. Each float
  * is the score of the column in the alignment.
  */
 static float *make_column_scores(Msa *msa) {
-    float *column_scores = st_calloc(msa->column_no, sizeof(float));
-    for(int64_t i=0; i<msa->column_no; i++) {
-        // Score is simply max(number of aligned bases in the column - 1, 0)
-        for(int64_t j=0; j<msa->seq_no; j++) {
-            if(msa_to_base(msa->msa_seq[j][i]) != '-') {
-                column_scores[i]++;
-            }
-        }
-        if(column_scores[i] >= 1.0) {
-            column_scores[i]--;
+    // Count the bases in each column a row at a time, so the msa is read contiguously and the compiler can
+    // vectorize the inner loop
+    int32_t *base_counts = st_calloc(msa->column_no, sizeof(int32_t));
+    for(int64_t j=0; j<msa->seq_no; j++) {
+        uint8_t *row = msa->msa_seq[j];
+        for(int64_t i=0; i<msa->column_no; i++) {
+            base_counts[i] += row[i] != msa_gap;
         }
-        assert(column_scores[i] >= 0.0);
     }
+    // Score is simply max(number of aligned bases in the column - 1, 0)
+    float *column_scores = st_malloc(msa->column_no * sizeof(float));
+    for(int64_t i=0; i<msa->column_no; i++) {
+        column_scores[i] = base_counts[i] > 1 ? base_counts[i] - 1 : 0;
+    }
+    free(base_counts);
     return column_scores;
 }
 
 /**
  * Fills in cu_column_scores with the cumulative sum of column scores, from left-to-right, of columns
- * containing a non-gap character in the given "row".
+ * containing a non-gap character in the given "row". If reversed, the columns are taken from right-to-left.
  */
-static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float *cu_column_scores) {
+static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float *cu_column_scores, bool reversed) {
     float cu_score = 0.0; // The cumulative sum of column scores containing bases for the given row
     int64_t j=0; // The index in the DNA string for the given row
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
+    uint8_t *msa_row = msa->msa_seq[row];
+    for(int64_t k=0; k<msa->column_no; k++) {
+        int64_t i = reversed ? msa->column_no - 1 - k : k;
+        if(msa_row[i] != msa_gap) {
             cu_score += column_scores[i];
             cu_column_scores[j++] = cu_score;
         }
@@ -355,14 +357,16 @@ static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float
 
 /**
  * Removes the suffix of the given row from the MSA and updates the column scores. suffix_start is the beginning
- * suffix to remove.
+ * suffix to remove. If reversed, the row is read from right-to-left, so it is a prefix of the row that is removed.
  */
-static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t suffix_start) {
+static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t suffix_start, bool reversed) {
     int64_t seq_index = 0;
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
+    uint8_t *msa_row = msa->msa_seq[row];
+    for(int64_t k=0; k<msa->column_no; k++) {
+        int64_t i = reversed ? msa->column_no - 1 - k : k;
+        if(msa_row[i] != msa_gap) {
             if(seq_index++ >= suffix_start) {
-                msa->msa_seq[row][i] = msa_to_byte('-');
+                msa_row[i] = msa_gap;
                 column_scores[i] = column_scores[i] > 1 ? column_scores[i]-1 : 0;
                 assert(column_scores[i] >= 0.0);
             }
@@ -371,9 +375,12 @@ static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t
 }
 
 /**
- * Used to make two MSAs consistent with each other for a shared sequence
+ * Used to make two MSAs consistent with each other for a shared sequence. The shared sequence is the suffix of
+ * row1 of msa1 and, reverse complemented, the suffix of row2 of msa2. If reversed1 is true then msa1 is read from
+ * right-to-left, as if it had been reverse complemented, so the shared sequence is instead a prefix of row1 on the
+ * same strand as msa2, which is how consecutive windows of an alignment overlap.
  */
-static void trim(int64_t row1, Msa *msa1, float *column_scores1,
+static void trim(int64_t row1, Msa *msa1, float *column_scores1, bool reversed1,
                  int64_t row2, Msa *msa2, float *column_scores2, int64_t overlap) {
     if(overlap == 0) { // There is no overlap, so no need to trim either MSA
         return;
@@ -389,8 +396,8 @@ static void trim(int64_t row1, Msa *msa1, float *column_scores1,
     // Get the cumulative cut scores for the columns containing the shared sequence
     float *cu_column_scores1 = st_malloc(msa1->column_no * sizeof(float));
     float *cu_column_scores2 = st_malloc(msa2->column_no * sizeof(float));
-    sum_column_scores(row1, msa1, column_scores1, cu_column_scores1);
-    sum_column_scores(row2, msa2, column_scores2, cu_column_scores2);
+    sum_column_scores(row1, msa1, column_scores1, cu_column_scores1, reversed1);
+    sum_column_scores(row2, msa2, column_scores2, cu_column_scores2, 0);
 
     // The score if we cut all of the overlap in msa1 and keep all of the overlap in msa2
     assert(seq_len2 <= msa2->column_no);
@@ -426,42 +433,55 @@ static void trim(int64_t row1, Msa *msa1, float *column_scores1,
 
     // Now trim back the two MSAs
     assert(max_overlap_cut_point <= overlap);
-    trim_msa_suffix(msa1, column_scores1, row1, seq_len1 - overlap + max_overlap_cut_point);
-    trim_msa_suffix(msa2, column_scores2, row2, seq_len2 - max_overlap_cut_point);
+    trim_msa_suffix(msa1, column_scores1, row1, seq_len1 - overlap + max_overlap_cut_point, reversed1);
+    trim_msa_suffix(msa2, column_scores2, row2, seq_len2 - max_overlap_cut_point, 0);
 
     free(cu_column_scores1);
     free(cu_column_scores2);
 }
 
 /**
- * recompute the seq_lens of a trimmed msa and clip off empty suffix columns
+ * recompute the seq_lens of a trimmed msa and clip off empty suffix columns, or empty prefix columns if
+ * trim_prefix is true, keeping the column scores in step with the columns
  * (todo: can this be built into trimming code?)
  */
-static void msa_fix_trimmed(Msa* msa) {
+static void msa_fix_trimmed(Msa* msa, float *column_scores, bool trim_prefix) {
     for (int64_t i = 0; i < msa->seq_no; ++i) {
         // recompute the seq_len
-        msa->seq_lens[i] = 0;
+        uint8_t *row = msa->msa_seq[i];
+        int seq_len = 0;
         for (int64_t j = 0; j < msa->column_no; ++j) {
-            if (msa_to_base(msa->msa_seq[i][j]) != '-') {
-                ++msa->seq_lens[i];
-            }
+            seq_len += row[j] != msa_gap;
         }
+        msa->seq_lens[i] = seq_len;
     }
     // trim empty columns
     int64_t empty_columns = 0;
     for (bool still_empty = true; empty_columns < msa->column_no; ++empty_columns) {
+        int64_t column = trim_prefix ? empty_columns : msa->column_no - 1 - empty_columns;
         for (int64_t i = 0; i < msa->seq_no && still_empty; ++i) {
-            still_empty = msa_to_base(msa->msa_seq[i][msa->column_no - 1 - empty_columns]) == '-';
+            still_empty = msa->msa_seq[i][column] == msa_gap;
         }
         if (!still_empty) {
             break;
         }
     }
     msa->column_no -= empty_columns;
+    if (trim_prefix && empty_columns > 0) {
+        for (int64_t i = 0; i < msa->seq_no; ++i) {
+            memmove(msa->msa_seq[i], msa->msa_seq[i] + empty_columns, msa->column_no * sizeof(uint8_t));
+        }
+        memmove(column_scores, column_scores + empty_columns, msa->column_no * sizeof(float));
+    }
 }
 
-Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
-                                      abpoa_para_t *poa_parameters) {
+/*
+ * As msa_make_partial_order_alignment, but using the given abpoa context for all the windows. The column scores
+ * of the msa, as computed by make_column_scores(), are returned in column_scores.
+ */
+static Msa *msa_make_partial_order_alignment2(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                              abpoa_para_t *poa_parameters, AbpoaContext *context,
+                                              float **column_scores) {
 
     assert(seq_no > 0);
 
@@ -479,6 +499,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         for (int64_t i = 0; i < msa->column_no; ++i) {
             msa->msa_seq[0][i] = msa_to_byte(msa->seqs[0][i]);
         }
+        *column_scores = make_column_scores(msa);
         return msa;
     }
     
@@ -498,19 +519,28 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
     // keep track of overlaps
     int64_t* row_overlaps = (int64_t*)st_calloc(seq_no, sizeof(int64_t));
 
-    // allocate the poa input buffer
-    uint8_t **bseqs = (uint8_t**)st_malloc(sizeof(uint8_t*) * seq_no);
+    // convert the sequences to the poa alphabet once, the windows then point into them
+    uint8_t **encoded_seqs = (uint8_t**)st_malloc(sizeof(uint8_t*) * seq_no);
     for (int64_t i = 0; i < seq_no; ++i) {
-        int64_t row_size = seq_lens[i] < window_size ? seq_lens[i] : window_size;
-        bseqs[i] = (uint8_t*)st_malloc(sizeof(uint8_t) * row_size);
+        encoded_seqs[i] = (uint8_t*)st_malloc(sizeof(uint8_t) * seq_lens[i]);
+        for (int64_t j = 0; j < seq_lens[i]; ++j) {
+            // todo: support iupac characters?
+            encoded_seqs[i][j] = msa_to_byte(seqs[i][j]);
+        }
         bases_remaining += seq_lens[i];
     }
+    // the poa input for the current window
+    uint8_t **bseqs = (uint8_t**)st_malloc(sizeof(uint8_t*) * seq_no);
+    uint8_t empty_seq[1] = { msa_to_byte('N') };
      
     // collect our windowed outputs here, to be stiched at the end. 
     stList* msa_windows = stList_construct3(0, (void(*)(void *)) msa_destruct);
+    // and the column scores of each window, which are kept up to date as the windows are trimmed
+    stList* window_column_scores = stList_construct3(0, free);
     
     // remember the previous window
     Msa* prev_msa = NULL;
+    float* prev_column_scores = NULL;
     
     int64_t prev_bases_remaining = bases_remaining;
     for (int64_t iteration = 0; bases_remaining > 0; ++iteration) {
@@ -522,9 +552,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
                 assert(prev_msa->column_no > window_overlap_size);
                 row_overlaps[i] = 0;
                 for (int64_t j = prev_msa->column_no - window_overlap_size; j < prev_msa->column_no; ++j) {
-                    if (msa_to_base(prev_msa->msa_seq[i][j]) != '-') {
-                        ++row_overlaps[i];
-                    }
+                    row_overlaps[i] += prev_msa->msa_seq[i][j] != msa_gap;
                 }
                 // take the overlaps into account in other other counters
                 assert(seq_offsets[i] >= row_overlaps[i]);
@@ -539,13 +567,10 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         msa->seqs = NULL;
         msa->seq_lens = st_malloc(sizeof(int) * msa->seq_no);
         
-        // load up to window_size of each sequence into the input matrix for poa
+        // point the input matrix for poa at up to window_size of each sequence
         for (int64_t i = 0; i < msa->seq_no; ++i) {
-            msa->seq_lens[i] = 0;
-            for (int64_t j = seq_offsets[i]; j < seq_lens[i] && msa->seq_lens[i] < window_size; ++j, ++msa->seq_lens[i]) {
-                // todo: support iupac characters?
-                bseqs[i][msa->seq_lens[i]] = msa_to_byte(seqs[i][j]);
-            }
+            msa->seq_lens[i] = seq_lens[i] - seq_offsets[i] < window_size ? seq_lens[i] - seq_offsets[i] : window_size;
+            bseqs[i] = encoded_seqs[i] + seq_offsets[i];
         }
 
         // poa can't handle empty sequences.  this is a hack to get around that
@@ -554,16 +579,17 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
             if (msa->seq_lens[i] == 0) {
                 empty_seqs[i] = true;
                 msa->seq_lens[i] = 1;
-                bseqs[i][0] = msa_to_byte('N');
+                bseqs[i] = empty_seq;
                 ++emptyCount;
             } else {
                 empty_seqs[i] = false;
             }
         }
 
-        // init abpoa
-        abpoa_t *ab = abpoa_init();
-        abpoa_para_t *abpt = copy_abpoa_params(poa_parameters);
+        // reuse the abpoa state of the context, resetting the parameters abpoa may have written to
+        abpoa_t *ab = context->ab;
+        abpoa_para_t *abpt = context->abpt;
+        set_abpoa_params(abpt, poa_parameters);
         
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
         // dump the input to file
@@ -600,13 +626,15 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         }
         free(test_msa);
 #else
-        // perform abpoa-msa
+        // perform abpoa-msa, whose output is in our alphabet as long as gaps are emitted as msa_gap
+        assert(abpt->m == msa_gap);
         abpoa_msa(ab, abpt, msa->seq_no, NULL, msa->seq_lens, bseqs, NULL, NULL);
         // abpoa's interface has changed a bit -- instead of passing in pointers to the results, they
         // end up in the ab->abc struct -- we extract them here
         msa->msa_seq = ab->abc->msa_base;
-        ab->abc->msa_base = NULL;
         msa->column_no = ab->abc->msa_len;
+        ab->abc->msa_base = NULL; // so that abpoa does not free the alignment when it is next reset
+        ab->abc->msa_len = 0;
 #endif
 
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
@@ -618,10 +646,6 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         free(abpoa_command_line);
 #endif
 
-        // free abpoa
-        abpoa_free(ab);
-        abpoa_free_para(abpt);
-
         // mask out empty sequences that were phonied in as Ns above
         for (int64_t i = 0; i < msa->seq_no && emptyCount > 0; ++i) {
             if (empty_seqs[i] == true) {
@@ -647,49 +671,35 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         //msa_print(msa, stderr);
         // remember how much we aligned this round
         for (int64_t i = 0; i < msa->seq_no; ++i) {
-            //////////////////////////////////////////////////////////////////////////////////////
-            // todo: why is this hack necessary?  using it in order for trim to work properly   //
-            // after abpoa switched to weirdo 256-bit values  (nst_nt256_table)                //
-            for (int64_t j = 0; j < msa->column_no; ++j) {
-                msa->msa_seq[i][j] = msa_to_byte(msa_to_base(msa->msa_seq[i][j]));
-            }
             bases_remaining -= msa->seq_lens[i];
             seq_offsets[i] += msa->seq_lens[i];
         }
 
-        // todo: there is obviously room for optimization here, as we compute full scores twice for each msa
-        //       in addition to flipping the prev_msa back and forth
-        //       (not sure if this is at all noticeable on top of abpoa running time though)
+        // the scores are computed once per window, then updated as the window is trimmed against its neighbours
+        float* column_scores = make_column_scores(msa);
         if (prev_msa) {
-            // trim() presently assumes we're looking at reverse-complement sequence:
-            flip_msa_seq(msa);
-            float* prev_column_scores = make_column_scores(prev_msa);
-            float* column_scores = make_column_scores(msa);
-
-            // trim with the previous alignment
+            // the overlap with the previous alignment is a prefix of this one, so read this msa from right to left
+            // to trim it with the previous alignment
             for (int64_t i = 0; i < msa->seq_no; ++i) {
                 int64_t overlap = msa->seq_lens[i] < row_overlaps[i] ? msa->seq_lens[i] : row_overlaps[i];
                 if (overlap > 0) {
-                    trim(i, msa, column_scores, i, prev_msa, prev_column_scores, overlap);
+                    trim(i, msa, column_scores, 1, i, prev_msa, prev_column_scores, overlap);
                 }
             }
             // todo: can this be done as part of trim?
-            msa_fix_trimmed(msa);
-            msa_fix_trimmed(prev_msa);            
-            // flip our msa back to its original strand
-            flip_msa_seq(msa);
-
-            free(prev_column_scores);
-            free(column_scores);
+            msa_fix_trimmed(msa, column_scores, 1);
+            msa_fix_trimmed(prev_msa, prev_column_scores, 0);
         }
 
         // add the msa to our list
         stList_append(msa_windows, msa);
+        stList_append(window_column_scores, column_scores);
         
         // sanity check        
         assert(prev_bases_remaining > bases_remaining && bases_remaining >= 0);
 
         prev_msa = msa;
+        prev_column_scores = column_scores;
         
         //used only for sanity check
         prev_bases_remaining = bases_remaining; 
@@ -700,6 +710,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
     if (num_windows == 1) {
         // if we have only one window, return it
         output_msa = stList_removeFirst(msa_windows);
+        *column_scores = stList_removeFirst(window_column_scores);
         output_msa->seqs = seqs;
         free(output_msa->seq_lens); // cleanup old memory
         output_msa->seq_lens = seq_lens;
@@ -728,35 +739,85 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
             }
             assert(offset == output_msa->column_no);
         }
+        // as the score of a column only depends on the column, the scores of the windows can be concatenated too
+        *column_scores = st_malloc(sizeof(float) * output_msa->column_no);
+        int64_t offset = 0;
+        for (int64_t j = 0; j < num_windows; ++j) {
+            Msa* msa_j = stList_get(msa_windows, j);
+            memcpy(*column_scores + offset, stList_get(window_column_scores, j), sizeof(float) * msa_j->column_no);
+            offset += msa_j->column_no;
+        }
     } 
 
     // Clean up
     for (int64_t i = 0; i < seq_no; ++i) {
-        free(bseqs[i]);
+        free(encoded_seqs[i]);
     }
+    free(encoded_seqs);
     free(bseqs);
     free(seq_offsets);
     free(empty_seqs);
     free(row_overlaps);
     stList_destruct(msa_windows);
+    stList_destruct(window_column_scores);
 
     return output_msa;
 }
 
+Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                      abpoa_para_t *poa_parameters) {
+    AbpoaContext *context = abpoa_context_construct();
+    float *column_scores;
+    Msa *msa = msa_make_partial_order_alignment2(seqs, seq_lens, seq_no, window_size, poa_parameters, context,
+                                                 &column_scores);
+    abpoa_context_destruct(context);
+    free(column_scores);
+    return msa;
+}
+
 Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
         int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
         int64_t window_size, abpoa_para_t *poa_parameters) {
     // Calculate the initial, potentially inconsistent msas and column scores for each msa
-    float *column_scores[end_no];
+    float **column_scores = st_malloc(sizeof(float *) * end_no);
     Msa **msas = st_malloc(sizeof(Msa *) * end_no);
-//#if defined(_OPENMP)
-//#pragma omp parallel for schedule(dynamic)
-//#endif
+
+    // Each end is aligned in its own task. When called within the flower level parallel loop of bar() the tasks
+    // belong to that loop's team, so threads that have run out of flowers help with the ends of a large flower.
+    // Each thread uses its own abpoa context, made the first time it runs one of the tasks, and results are stored
+    // by end index so do not depend on the order the tasks run in.
+    int64_t context_no = 1;
+#if defined(_OPENMP)
+    context_no = omp_get_num_threads();
+#endif
+    AbpoaContext **contexts = st_calloc(context_no, sizeof(AbpoaContext *));
     for(int64_t i=0; i<end_no; i++) {
-        msas[i] = msa_make_partial_order_alignment(end_strings[i], end_string_lengths[i], end_lengths[i], window_size,
-                                                   poa_parameters);
-        column_scores[i] = make_column_scores(msas[i]);
+#if defined(_OPENMP)
+#pragma omp task default(shared) firstprivate(i)
+#endif
+        {
+            int64_t thread = 0;
+#if defined(_OPENMP)
+            thread = omp_get_thread_num();
+#endif
+            assert(thread < context_no);
+            if(contexts[thread] == NULL) {
+                contexts[thread] = abpoa_context_construct();
+            }
+            msas[i] = msa_make_partial_order_alignment2(end_strings[i], end_string_lengths[i], end_lengths[i],
+                                                        window_size, poa_parameters, contexts[thread],
+                                                        &column_scores[i]);
+        }
     }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+    for(int64_t i=0; i<context_no; i++) {
+        if(contexts[i] != NULL) {
+            abpoa_context_destruct(contexts[i]);
+        }
+    }
+    free(contexts);
 
     // Make the msas consistent with one another
     for(int64_t i=0; i<end_no; i++) { // For each end
@@ -767,7 +828,7 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
 
             // If it hasn't already been trimmed
             if(right_end_index > i || (right_end_index == i /* self loop */ && right_end_row_index > j)) {
-                trim(j, msa, column_scores[i],
+                trim(j, msa, column_scores[i], 0,
                         right_end_row_index, msas[right_end_index], column_scores[right_end_index], overlaps[i][j]);
             }
         }
@@ -777,6 +838,7 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
     for(int64_t i=0; i<end_no; i++) {
         free(column_scores[i]);
     }
+    free(column_scores);
 
     return msas;
 }
@@ -795,7 +857,10 @@ void alignmentBlock_destruct(AlignmentBlock *alignmentBlock) {
     }
 }
 
-char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
+/*
+ * Gets a view of the sequence between the cap and its adjacency, on the strand of the cap.
+ */
+static SequenceView get_adjacency_view(Cap *cap) {
     assert(!cap_getSide(cap));
     Sequence *sequence = cap_getSequence(cap);
     assert(sequence != NULL);
@@ -804,31 +869,39 @@ char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
     assert(cap_getSide(cap2));
     if (cap_getStrand(cap)) {
         assert(cap_getCoordinate(cap2) > cap_getCoordinate(cap));
-        *length = cap_getCoordinate(cap2) - cap_getCoordinate(cap) - 1;
-        assert(*length >= 0);
-        return return_string ? sequence_getString(sequence, cap_getCoordinate(cap) + 1, *length, 1) : NULL;
+        return sequence_getView(sequence, cap_getCoordinate(cap) + 1, cap_getCoordinate(cap2) - cap_getCoordinate(cap) - 1, 1);
     } else {
         assert(cap_getCoordinate(cap) > cap_getCoordinate(cap2));
-        *length = cap_getCoordinate(cap) - cap_getCoordinate(cap2) - 1;
-        assert(*length >= 0);
-        return return_string ? sequence_getString(sequence, cap_getCoordinate(cap2) + 1, *length, 0) : NULL;
+        return sequence_getView(sequence, cap_getCoordinate(cap2) + 1, cap_getCoordinate(cap) - cap_getCoordinate(cap2) - 1, 0);
+    }
+}
+
+char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
+    SequenceView view = get_adjacency_view(cap);
+    *length = view.length;
+    assert(*length >= 0);
+    if (!return_string) {
+        return NULL;
     }
+    char *string = st_malloc(sizeof(char) * (view.length + 1));
+    sequenceView_getString(&view, string);
+    return string;
 }
 
 /**
  * Used to find where a run of masked (hard or soft) of at least mask_filter bases starts
- * @param seq : The string
- * @param seq_length : The length of the string
+ * @param view : The sequence
  * @param length : The maximum length we want to search in
- * @param reversed : If true, scan from the end of the string
  * @param mask_filter : Cut a string as soon as we hit more than this many hard or softmasked bases (cut is before first masked base)
  * @return length of the filtered string
  */
-static int get_unmasked_length(char* seq, int64_t seq_length, int64_t length, bool reversed, int64_t mask_filter) {
+static int get_unmasked_length(SequenceView *view, int64_t length, int64_t mask_filter) {
     if (mask_filter >= 0) {
         int64_t run_start = -1;
+        SequenceViewIterator it;
+        sequenceView_getIterator(view, &it);
         for (int64_t i = 0; i < length; ++i) {
-            char base = reversed ? seq[seq_length - 1 - i] : seq[i];
+            char base = sequenceView_getNext(&it);
             if (islower(base) || base == 'N') {
                 if (run_start == -1) {
                     // start masked run
@@ -855,9 +928,9 @@ static int get_unmasked_length(char* seq, int64_t seq_length, int64_t length, bo
  * @return
  */
 char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap, int64_t max_seq_length, int64_t mask_filter) {
-    // Get the complete adjacency string
-    int seq_length;
-    char *adjacency_string = get_adjacency_string(cap, &seq_length, 1);
+    // Get a view of the complete adjacency, only the prefix of which is copied
+    SequenceView view = get_adjacency_view(cap);
+    int seq_length = view.length;
     assert(seq_length >= 0);
 
     // Calculate the length of the prefix up to max_seq_length
@@ -867,15 +940,16 @@ char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap,
 
     if (mask_filter >= 0) {
         // apply the mask filter on the forward strand
-        *length = get_unmasked_length(adjacency_string, seq_length, *length, false, mask_filter);
-        length_backward = get_unmasked_length(adjacency_string, seq_length, *length, true, mask_filter);
+        *length = get_unmasked_length(&view, *length, mask_filter);
+        // and from the end of the adjacency, reading the reverse complement as masking is the same on both strands
+        SequenceView reverse_view = sequenceView_getReverseComplement(&view);
+        length_backward = get_unmasked_length(&reverse_view, *length, mask_filter);
     }
 
-    // Cleanup the string
-    adjacency_string[*length] = '\0'; // Terminate the string at the given length
-    char *c = stString_copy(adjacency_string);
-    free(adjacency_string);
-    adjacency_string = c;
+    // Copy the prefix
+    SequenceView prefix_view = sequenceView_getSubView(&view, 0, *length);
+    char *adjacency_string = st_malloc(sizeof(char) * (*length + 1));
+    sequenceView_getString(&prefix_view, adjacency_string);
 
     // Calculate the overlap with the reverse complement
     if (*length + length_backward > seq_length) { // There is overlap
@@ -894,29 +968,44 @@ char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap,
  * @param start The start of the gapless block
  * @param rows_in_block A boolean array of which sequences are present in the block
  * @param sequences_in_block The number of in the block
+ * @param row_run_ends For each row, the end of the run of bases or gaps in the row last found by this function.
+ * Must be initialized to zero before the first block of the msa, and is updated for the successive blocks.
  * @return
  */
-int64_t get_next_maximal_block_dimensions(Msa *msa, int64_t start, bool *rows_in_block, int64_t *sequences_in_block) {
+int64_t get_next_maximal_block_dimensions(Msa *msa, int64_t start, bool *rows_in_block, int64_t *sequences_in_block,
+                                          int64_t *row_run_ends) {
     assert(start < msa->column_no);
 
     // Calculate which sequences are in the block
     *sequences_in_block = 0;
     for(int64_t i=0; i<msa->seq_no; i++) {
-        rows_in_block[i] = msa_to_base(msa->msa_seq[i][start]) != '-';
+        rows_in_block[i] = msa->msa_seq[i][start] != msa_gap;
         if(rows_in_block[i]) {
             *sequences_in_block += 1;
         }
     }
 
-    // Calculate the maximal block length by looking at successive columns of the MSA and
-    // checking they have the same set of sequences present as in the first block
-    int64_t end = start;
-    while(++end < msa->column_no) {
-        for(int64_t i=0; i<msa->seq_no; i++) {
-            bool p = msa_to_base(msa->msa_seq[i][end]) != '-'; // Is not a gap
-            if(p != rows_in_block[i]) {
-                return end;
+    // The maximal block ends where the first row changes between bases and gaps. Each row is scanned along its
+    // length to the end of its current run, which is remembered, so across all the blocks of the msa each row is
+    // only read once
+    int64_t end = msa->column_no;
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        if(row_run_ends[i] <= start) {
+            uint8_t *row = msa->msa_seq[i];
+            int64_t j = start + 1;
+            if(rows_in_block[i]) {
+                uint8_t *gap = memchr(row + j, msa_gap, msa->column_no - j);
+                j = gap == NULL ? msa->column_no : gap - row;
+            }
+            else {
+                while(j < msa->column_no && row[j] == msa_gap) {
+                    j++;
+                }
             }
+            row_run_ends[i] = j;
+        }
+        if(row_run_ends[i] < end) {
+            end = row_run_ends[i];
         }
     }
     return end;
@@ -1001,6 +1090,10 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
     for(int64_t k=0; k<msa->seq_no; k++) { // Initialize to zero
         seq_indexes[k] = 0;
     }
+    int64_t row_run_ends[msa->seq_no]; // The ends of the current runs of bases or gaps in each row
+    for(int64_t k=0; k<msa->seq_no; k++) {
+        row_run_ends[k] = 0;
+    }
     int64_t sequences_in_block; // The number of sequences in the block
 
     //fprintf(stderr, "Start. Col no: %i\n", (int)msa->column_no);
@@ -1008,7 +1101,7 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
 
     // Walk through successive gapless blocks
     while(i < msa->column_no) {
-        int64_t j = get_next_maximal_block_dimensions(msa, i, rows_in_block, &sequences_in_block);
+        int64_t j = get_next_maximal_block_dimensions(msa, i, rows_in_block, &sequences_in_block, row_run_ends);
         assert(j > i);
         assert(j <= msa->column_no);
 
@@ -1032,11 +1125,21 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
 }
 
 
-int caps_comp_by_adjacency_length(const void *a, const void *b) {
-    int length1, length2;
-    get_adjacency_string((Cap *)a, &length1, 0);
-    get_adjacency_string((Cap *)b, &length2, 0);
-    return length1 > length2 ? -1 : (length1 < length2 ? 1 : 0); // sort in descending order of length
+/*
+ * A cap with its adjacency length, computed once before sorting rather than in each comparison
+ */
+typedef struct _cap_length {
+    Cap *cap;
+    int length;
+    int64_t index; // order of the cap in the end, to break ties
+} CapLength;
+
+static int cap_length_cmp(const void *a, const void *b) {
+    const CapLength *c1 = a, *c2 = b;
+    if(c1->length != c2->length) {
+        return c1->length > c2->length ? -1 : 1; // sort in descending order of length
+    }
+    return c1->index < c2->index ? -1 : (c1->index > c2->index ? 1 : 0);
 }
 
 /*
@@ -1051,19 +1154,26 @@ void get_end_sequences(End *end, char **end_strings, int *end_string_lengths, in
 
     // sorting the caps by length from longest to shortest (to make a consistent ordering, also POA seems to
     // create better alignments this way)
-    stList *caps = stList_construct();
+    int64_t cap_no = end_getInstanceNumber(end);
+    CapLength *caps = st_malloc(sizeof(CapLength) * cap_no);
     while ((cap = end_getNext(capIterator)) != NULL) {
         if (cap_getSide(cap)) {
             cap = cap_getReverse(cap);
         }
-        stList_append(caps, cap);
+        assert(j < cap_no);
+        caps[j].cap = cap;
+        get_adjacency_string(cap, &(caps[j].length), 0);
+        caps[j].index = j;
+        j++;
     }
-    stList_sort(caps, caps_comp_by_adjacency_length); // sort by descending order of length
+    assert(j == cap_no);
+    qsort(caps, cap_no, sizeof(CapLength), cap_length_cmp); // sort by descending order of length
     end_destructInstanceIterator(capIterator);
 
     // Now create the actual end sequences
-    for(int64_t i=0; i<stList_length(caps); i++) {
-        Cap *cap = stList_get(caps, i);
+    j = 0;
+    for(int64_t i=0; i<cap_no; i++) {
+        Cap *cap = caps[i].cap;
         assert(!cap_getSide(cap));
         // Get the prefix of the adjacency string and its length and overlap with its reverse complement
         end_strings[j] = get_adjacency_string_and_overlap(cap, &(end_string_lengths[j]),
@@ -1072,7 +1182,7 @@ void get_end_sequences(End *end, char **end_strings, int *end_string_lengths, in
         // Populate the caps to end/row indices, and vice versa, data structures
         indices_to_caps[j++] = cap;
     }
-    stList_destruct(caps); // cleanup
+    free(caps); // cleanup
 }
 
 int64_t getMaxSequenceLength(End *end) {
@@ -5,6 +5,7 @@
 #include "stPinchIterator.h"
 #include "stGiantComponent.h"
 #include "stCafPhylogeny.h"
+#include "paf.h"
 
 static bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     FilterArgs *f = extraArg;
@@ -196,6 +197,12 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
     int64_t minimumBlockDegreeToCheckSupport = cactusParams_get_int(params, 2, "caf", "minimumBlockDegreeToCheckSupport");
     double minimumBlockHomologySupport = cactusParams_get_float(params, 2, "caf", "minimumBlockHomologySupport");
 
+    // The memory to use caching the pinches read from each alignment file, by default none, so the files are read
+    // again in each annealing round
+    int64_t pinchCacheMemory = cactusParams_get_int_with_default(params, 0, 2, "caf", "pinchCacheMemory");
+    // The memory to use sorting the alignments by score, larger inputs are sorted on disk, by default no limit
+    int64_t sortMemory = cactusParams_get_int_with_default(params, INT64_MAX, 2, "caf", "sortMemory");
+
     // Setting the alignment filters
     char *alignmentFilter = (char *)cactusParams_get_string(params, 2, "caf", "alignmentFilter");
     bool sortAlignments = false;
@@ -288,7 +295,7 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
     stPinchIterator *pinchIteratorForConstraints = NULL;
     if (constraintsFile != NULL) {
-        pinchIteratorForConstraints = stPinchIterator_constructFromFile(constraintsFile);
+        pinchIteratorForConstraints = stPinchIterator_constructFromFile(constraintsFile, pinchCacheMemory);
         st_logDebug("Created an iterator for the alignment constaints from file: %s\n", constraintsFile);
     }
 
@@ -325,19 +332,19 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
         if (sortAlignments) {
             tempFile1 = getTempFile();
-            //stCaf_sortCigarsFileByScoreInDescendingOrder(alignmentsFile, tempFile1);
-            pinchIterator = stPinchIterator_constructFromFile(tempFile1);
+            paf_sort_file_by_descending_score(alignmentsFile, tempFile1, sortMemory);
+            pinchIterator = stPinchIterator_constructFromFile(tempFile1, pinchCacheMemory);
         } else {
-            pinchIterator = stPinchIterator_constructFromFile(alignmentsFile);
+            pinchIterator = stPinchIterator_constructFromFile(alignmentsFile, pinchCacheMemory);
         }
 
         if(secondaryAlignmentsFile != NULL) {
             if (sortSecondaryAlignments) {
                 tempFile2 = getTempFile();
-                //stCaf_sortCigarsFileByScoreInDescendingOrder(secondaryAlignmentsFile, tempFile2);
-                secondaryPinchIterator = stPinchIterator_constructFromFile(tempFile2);
+                paf_sort_file_by_descending_score(secondaryAlignmentsFile, tempFile2, sortMemory);
+                secondaryPinchIterator = stPinchIterator_constructFromFile(tempFile2, pinchCacheMemory);
             } else {
-                secondaryPinchIterator = stPinchIterator_constructFromFile(secondaryAlignmentsFile);
+                secondaryPinchIterator = stPinchIterator_constructFromFile(secondaryAlignmentsFile, pinchCacheMemory);
             }
         }
 
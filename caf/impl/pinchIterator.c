@@ -6,6 +6,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 #include "sonLib.h"
 #include "stPinchGraphs.h"
 #include "stPinchIterator.h"
@@ -43,7 +44,7 @@ typedef struct _pairwiseAlignmentToPinch {
     Paf *(*getPairwiseAlignment)(void *);
     Paf *paf;
     int64_t xCoordinate, yCoordinate, xName, yName;
-    Cigar *op;
+    int64_t op; // Index of the next cigar run
     bool freeAlignments;
 } PairwiseAlignmentToPinch;
 
@@ -63,35 +64,35 @@ static stPinch *pairwiseAlignmentToPinch_getNext(PairwiseAlignmentToPinch *pA, s
             if (pA->paf == NULL) {
                 return NULL;
             }
-            pA->op = pA->paf->cigar;
+            pA->op = 0;
             pA->xCoordinate = pA->paf->same_strand ? pA->paf->query_start : pA->paf->query_end;
             pA->yCoordinate = pA->paf->target_start;
             pA->xName = cactusMisc_stringToName(pA->paf->query_name);
             pA->yName = cactusMisc_stringToName(pA->paf->target_name);
         }
-        while (pA->op != NULL) {
-            assert(pA->op->length >= 1);
-            if (pA->op->op == match) { //deal with the possibility of a zero length match (strange, but not illegal)
+        while (pA->op < cigar_count(pA->paf->cigar)) {
+            CigarOp op = cigar_get_op(pA->paf->cigar, pA->op);
+            int64_t length = cigar_get_length(pA->paf->cigar, pA->op++);
+            assert(length >= 1);
+            if (op == match) { //deal with the possibility of a zero length match (strange, but not illegal)
                 if (pA->paf->same_strand) {
-                    stPinch_fillOut(pinchToFillOut, pA->xName, pA->yName, pA->xCoordinate, pA->yCoordinate, pA->op->length,
+                    stPinch_fillOut(pinchToFillOut, pA->xName, pA->yName, pA->xCoordinate, pA->yCoordinate, length,
                                     1);
-                    pA->xCoordinate += pA->op->length;
+                    pA->xCoordinate += length;
                 } else {
-                    pA->xCoordinate -= pA->op->length;
-                    stPinch_fillOut(pinchToFillOut, pA->xName, pA->yName, pA->xCoordinate, pA->yCoordinate, pA->op->length,
+                    pA->xCoordinate -= length;
+                    stPinch_fillOut(pinchToFillOut, pA->xName, pA->yName, pA->xCoordinate, pA->yCoordinate, length,
                                     0);
                 }
-                pA->yCoordinate += pA->op->length;
-                pA->op = pA->op->next;
+                pA->yCoordinate += length;
                 return pinchToFillOut;
             }
-            if (pA->op->op != query_delete) {
-                pA->xCoordinate += pA->paf->same_strand ? pA->op->length : -pA->op->length;
+            if (op != query_delete) {
+                pA->xCoordinate += pA->paf->same_strand ? length : -length;
             }
-            if (pA->op->op != query_insert) {
-                pA->yCoordinate += pA->op->length;
+            if (op != query_insert) {
+                pA->yCoordinate += length;
             }
-            pA->op = pA->op->next;
         }
         if (pA->paf->same_strand) {
             assert(pA->xCoordinate == pA->paf->query_end);
@@ -109,23 +110,165 @@ static stPinch *pairwiseAlignmentToPinch_getNext(PairwiseAlignmentToPinch *pA, s
 }
 
 static PairwiseAlignmentToPinch *pairwiseAlignmentToPinch_resetForFile(PairwiseAlignmentToPinch *pA) {
-    fseek(pA->alignmentArg, 0, SEEK_SET);
+    paf_reader_reset(pA->alignmentArg);
     pA->paf = NULL;
     return pA;
 }
 
 static void pairwiseAlignmentToPinch_destructForFile(PairwiseAlignmentToPinch *pA) {
-    fclose(pA->alignmentArg);
+    paf_reader_destruct(pA->alignmentArg);
     free(pA);
 }
 
-stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile) {
+/*
+ * A pinch, as stored in a pinch cache.
+ */
+typedef struct _pinchRecord {
+    int64_t name1, name2, start1, start2;
+    int64_t lengthAndStrand; // length << 1 | strand
+} PinchRecord;
+
+/*
+ * Caches the pinches read from an alignment file, so that after the first pass over the file resetting the iterator
+ * replays the decoded pinches rather than re-reading and re-parsing the alignments. Once the pinches exceed the memory
+ * budget the records are spilled to a temporary binary file and replayed from there.
+ */
+typedef struct _pinchCache {
+    PairwiseAlignmentToPinch *pA; // Source of the pinches in the first pass, NULL once the whole file is cached
+    PinchRecord *records; // Buffer of records, the whole cache if it has not been spilled
+    int64_t recordNumber, allocatedRecordNumber, maxRecordNumber, nextRecord;
+    FILE *spillFile; // Temporary file containing the records, if spilled
+    char *spillFileName; // Made with getTempFile, so in the temporary directory cactus is given
+} PinchCache;
+
+static PinchCache *pinchCache_construct(PairwiseAlignmentToPinch *pA, int64_t maxCacheMemory) {
+    PinchCache *cache = st_calloc(1, sizeof(PinchCache));
+    cache->pA = pA;
+    cache->maxRecordNumber = maxCacheMemory / sizeof(PinchRecord);
+    if (cache->maxRecordNumber < 1) {
+        cache->maxRecordNumber = 1;
+    }
+    // The buffer grows as needed up to the budget, so small files do not use the whole budget
+    cache->allocatedRecordNumber = cache->maxRecordNumber < 1024 ? cache->maxRecordNumber : 1024;
+    cache->records = st_malloc(sizeof(PinchRecord) * cache->allocatedRecordNumber);
+    return cache;
+}
+
+static void pinchCache_closeSpillFile(PinchCache *cache) {
+    if (cache->spillFile != NULL) {
+        fclose(cache->spillFile);
+        unlink(cache->spillFileName);
+        free(cache->spillFileName);
+        cache->spillFile = NULL;
+        cache->spillFileName = NULL;
+    }
+}
+
+static void pinchCache_writeRecords(PinchCache *cache) {
+    if (cache->spillFile == NULL) {
+        cache->spillFileName = getTempFile();
+        cache->spillFile = fopen(cache->spillFileName, "w+");
+        if (cache->spillFile == NULL) {
+            st_errnoAbort("Could not create the temporary file %s to spill the pinch cache to", cache->spillFileName);
+        }
+        st_logDebug("Spilling the pinch cache to a temporary file\n");
+    }
+    if (fwrite(cache->records, sizeof(PinchRecord), cache->recordNumber, cache->spillFile) != cache->recordNumber) {
+        st_errAbort("Could not write the pinch cache to a temporary file");
+    }
+    cache->recordNumber = 0;
+}
+
+static void pinchCache_addRecord(PinchCache *cache, stPinch *pinch) {
+    if (cache->recordNumber == cache->maxRecordNumber) { // Over budget, so spill
+        pinchCache_writeRecords(cache);
+    }
+    if (cache->recordNumber == cache->allocatedRecordNumber) {
+        cache->allocatedRecordNumber = cache->allocatedRecordNumber * 2 < cache->maxRecordNumber ?
+                                       cache->allocatedRecordNumber * 2 : cache->maxRecordNumber;
+        cache->records = st_realloc(cache->records, sizeof(PinchRecord) * cache->allocatedRecordNumber);
+    }
+    PinchRecord *record = &cache->records[cache->recordNumber++];
+    record->name1 = pinch->name1;
+    record->name2 = pinch->name2;
+    record->start1 = pinch->start1;
+    record->start2 = pinch->start2;
+    record->lengthAndStrand = (pinch->length << 1) | (pinch->strand ? 1 : 0);
+}
+
+static stPinch *pinchCache_getNext(PinchCache *cache, stPinch *pinchToFillOut) {
+    if (cache->pA != NULL) { // First pass, reading from the file
+        stPinch *pinch = pairwiseAlignmentToPinch_getNext(cache->pA, pinchToFillOut);
+        if (pinch != NULL) {
+            pinchCache_addRecord(cache, pinch);
+            return pinch;
+        }
+        // The whole file is now cached, so the file is no longer needed
+        if (cache->spillFile != NULL) {
+            pinchCache_writeRecords(cache);
+        }
+        pairwiseAlignmentToPinch_destructForFile(cache->pA);
+        cache->pA = NULL;
+        cache->nextRecord = cache->recordNumber; // Nothing more to replay until reset
+        return NULL;
+    }
+    if (cache->nextRecord == cache->recordNumber) {
+        if (cache->spillFile == NULL) {
+            return NULL;
+        }
+        // Read the next chunk of spilled records
+        cache->recordNumber = fread(cache->records, sizeof(PinchRecord), cache->maxRecordNumber, cache->spillFile);
+        cache->nextRecord = 0;
+        if (cache->recordNumber == 0) {
+            return NULL;
+        }
+    }
+    PinchRecord *record = &cache->records[cache->nextRecord++];
+    stPinch_fillOut(pinchToFillOut, record->name1, record->name2, record->start1, record->start2,
+                    record->lengthAndStrand >> 1, record->lengthAndStrand & 1);
+    return pinchToFillOut;
+}
+
+static PinchCache *pinchCache_reset(PinchCache *cache) {
+    if (cache->pA != NULL) { // Reset part way through the first pass, so start caching again
+        pairwiseAlignmentToPinch_resetForFile(cache->pA);
+        cache->recordNumber = 0;
+        pinchCache_closeSpillFile(cache);
+    } else if (cache->spillFile != NULL) { // Replay from the start of the spilled records
+        rewind(cache->spillFile);
+        cache->recordNumber = 0;
+        cache->nextRecord = 0;
+    } else {
+        cache->nextRecord = 0;
+    }
+    return cache;
+}
+
+static void pinchCache_destruct(PinchCache *cache) {
+    if (cache->pA != NULL) {
+        pairwiseAlignmentToPinch_destructForFile(cache->pA);
+    }
+    pinchCache_closeSpillFile(cache);
+    free(cache->records);
+    free(cache);
+}
+
+stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile, int64_t maxCacheMemory) {
     stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
-    pinchIterator->alignmentArg = pairwiseAlignmentToPinch_construct(fopen(alignmentFile, "r"),
-            (Paf *(*)(void *)) paf_read, 1);
-    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pairwiseAlignmentToPinch_getNext;
-    pinchIterator->destructAlignmentArg = (void(*)(void *)) pairwiseAlignmentToPinch_destructForFile;
-    pinchIterator->startAlignmentStack = (void *(*)(void *)) pairwiseAlignmentToPinch_resetForFile;
+    // The reader (which handles both text and binary pafs) owns and recycles the pafs, so they are not freed here
+    PairwiseAlignmentToPinch *pA = pairwiseAlignmentToPinch_construct(paf_reader_open(alignmentFile),
+            (Paf *(*)(void *)) paf_reader_next, 0);
+    if (maxCacheMemory <= 0) { // No cache, so the file is read again after each reset
+        pinchIterator->alignmentArg = pA;
+        pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pairwiseAlignmentToPinch_getNext;
+        pinchIterator->destructAlignmentArg = (void(*)(void *)) pairwiseAlignmentToPinch_destructForFile;
+        pinchIterator->startAlignmentStack = (void *(*)(void *)) pairwiseAlignmentToPinch_resetForFile;
+        return pinchIterator;
+    }
+    pinchIterator->alignmentArg = pinchCache_construct(pA, maxCacheMemory);
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pinchCache_getNext;
+    pinchIterator->destructAlignmentArg = (void(*)(void *)) pinchCache_destruct;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) pinchCache_reset;
     return pinchIterator;
 }
 
@@ -38,9 +38,12 @@ void stPinchIterator_destruct(
         stPinchIterator *stPinchIterator);
 
 /*
- * Get a pairwise alignment iterator from a file.
+ * Get a pairwise alignment iterator from a file. The pinches read in the first pass over the file are cached, so
+ * resetting the iterator replays them without re-reading the file. Up to maxCacheMemory bytes of pinches are kept
+ * in memory, beyond which they are spilled to a temporary file, made with getTempFile and removed when the iterator is
+ * destructed. If maxCacheMemory is 0 nothing is cached, and the file is read again after each reset.
  */
-stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile);
+stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile, int64_t maxCacheMemory);
 
 /*
  * Constructs iterator from aligned pairs.
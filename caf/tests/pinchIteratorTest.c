@@ -10,6 +10,7 @@
 #include "pairwiseAlignment.h"
 #include "paf.h"
 #include <math.h>
+#include <zlib.h>
 
 static void testIterator(CuTest *testCase, stPinchIterator *pinchIterator, stList *randomPairwiseAlignments) {
     for (int64_t trim = 0; trim < 10; trim++) {
@@ -24,27 +25,28 @@ static void testIterator(CuTest *testCase, stPinchIterator *pinchIterator, stLis
             int64_t x = paf->same_strand ? paf->query_start : paf->query_end;
             int64_t y = paf->target_start;
             Cigar *c = paf->cigar;
-            while(c != NULL) {
-                if (c->op == match) {
-                    if (c->length > 2 * trim) {
+            for (int64_t k = 0; k < cigar_count(c); k++) {
+                CigarOp op = cigar_get_op(c, k);
+                int64_t length = cigar_get_length(c, k);
+                if (op == match) {
+                    if (length > 2 * trim) {
                         stPinch *pinch = stPinchIterator_getNext(pinchIterator, &pinchToFillOut);
                         CuAssertTrue(testCase, pinch != NULL);
                         CuAssertIntEquals(testCase, contigX, pinch->name1);
                         CuAssertIntEquals(testCase, contigY, pinch->name2);
-                        CuAssertIntEquals(testCase, (paf->same_strand ? x : x - c->length) + trim, pinch->start1);
+                        CuAssertIntEquals(testCase, (paf->same_strand ? x : x - length) + trim, pinch->start1);
                         CuAssertIntEquals(testCase, y + trim, pinch->start2);
-                        CuAssertIntEquals(testCase, c->length - 2 * trim, pinch->length);
+                        CuAssertIntEquals(testCase, length - 2 * trim, pinch->length);
                         CuAssertTrue(testCase, pinch->length > 0);
                         CuAssertIntEquals(testCase, paf->same_strand, pinch->strand);
                     }
                 }
-                if (c->op != query_delete) {
-                    x += paf->same_strand ? c->length : -c->length;
+                if (op != query_delete) {
+                    x += paf->same_strand ? length : -length;
                 }
-                if (c->op != query_insert) {
-                    y += c->length;
+                if (op != query_insert) {
+                    y += length;
                 }
-                c = c->next;
             }
         }
         CuAssertPtrEquals(testCase, NULL, stPinchIterator_getNext(pinchIterator, &pinchToFillOut));
@@ -65,19 +67,17 @@ static stList *getRandomPairwiseAlignments() {
         paf->target_start = st_randomInt(100000, 1000000);
         paf->same_strand = st_random() > 0.5;
         int64_t i = paf->query_start, j = paf->target_start;
-        Cigar **pc = &(paf->cigar);
+        paf->cigar = cigar_construct(1);
         do {
-            Cigar *c = st_calloc(1, sizeof(Cigar));
-            c->length = st_randomInt(1, 10);
-            c->op = st_random() > 0.3 ? (st_random() > 0.5 ? match : query_insert): query_delete;
-            if (c->op != query_delete) {
-                i += c->length;
+            int64_t length = st_randomInt(1, 10);
+            CigarOp op = st_random() > 0.3 ? (st_random() > 0.5 ? match : query_insert): query_delete;
+            if (op != query_delete) {
+                i += length;
             }
-            if (c->op != query_insert) {
-                j += c->length;
+            if (op != query_insert) {
+                j += length;
             }
-            *pc = c;
-            pc = &(c->next);
+            cigar_append(paf->cigar, op, length);
         } while(st_random() > 0.1 || paf->query_start == i || paf->target_start == j);
         paf->query_end = i;
         paf->target_end = j;
@@ -93,14 +93,29 @@ static void testPinchIteratorFromFile(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
         stList *pairwiseAlignments = getRandomPairwiseAlignments();
         st_logInfo("Doing a random pinch iterator from file test %" PRIi64 " with %" PRIi64 " alignments\n", test, stList_length(pairwiseAlignments));
-        //Put alignments in a file
+        //Put alignments in a file, gzip compressed in half the tests
         char *tempFile = "tempFileForPinchIteratorTest.cig";
-        FILE *fileHandle = fopen(tempFile, "w");
-        assert(fileHandle != NULL);
-        write_pafs(fileHandle, pairwiseAlignments);
-        fclose(fileHandle);
-        //Get an iterator
-        stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(tempFile);
+        if (test % 4 < 2) {
+            FILE *fileHandle = fopen(tempFile, "w");
+            assert(fileHandle != NULL);
+            write_pafs(fileHandle, pairwiseAlignments);
+            fclose(fileHandle);
+        } else {
+            gzFile gz = gzopen(tempFile, "w");
+            assert(gz != NULL);
+            for (int64_t i = 0; i < stList_length(pairwiseAlignments); i++) {
+                char *line = paf_print(stList_get(pairwiseAlignments, i));
+                gzprintf(gz, "%s\n", line);
+                free(line);
+            }
+            gzclose(gz);
+        }
+        //Get an iterator, using a cache that holds all the pinches, a cache small enough to be spilled to disk, or
+        //no cache, in a third of the tests each, in which case the file is read again on each reset
+        int64_t maxCacheMemory = test % 3 == 0 ? 1000000 : (test % 3 == 1 ? 100 : 0);
+        stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(tempFile, maxCacheMemory);
+        //Reset before reading anything, as stCaf_anneal does
+        stPinchIterator_reset(pinchIterator);
         //Now test it
         testIterator(testCase, pinchIterator, pairwiseAlignments);
         //Cleanup
@@ -14,6 +14,7 @@
 #include "bioioC.h"
 #include "commonC.h"
 #include "sonLib.h"
+#include "cactusFile.h"
 
 static FILE *chunkFileHandle = NULL;
 static const char *chunksDir = "./temp_fastas";
@@ -180,7 +181,7 @@ int main(int argc, char *argv[]) {
     while(optind < argc) {
         char *seq_file = argv[optind++];
         st_logInfo("Chunking sequence file : %s\n", seq_file);
-        FILE *fileHandle2 = fopen(seq_file, "r");
+        FILE *fileHandle2 = cactusFile_open(seq_file);
         fastaReadToFunction(fileHandle2, NULL, processSequenceToChunk);
         fclose(fileHandle2);
     }
@@ -10,35 +10,247 @@
 #include <float.h>
 #include <getopt.h>
 #include <time.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bioioC.h"
 #include "commonC.h"
 #include "sonLib.h"
+#include "cactusFile.h"
 
 static int64_t flank = 10;
 static int64_t min_size = 100;
+static int64_t threads = 1;
 
 void usage() {
     fprintf(stderr, "fasta_extract [fasta_file]xN [options], version 0.1\n");
     fprintf(stderr, "Extracts subsequences from a fasta file according to intervals in a bed file.\n"
                     "To encode the subsequence information each faster header is appended |x,"
-                    "where x is the start coordinate (0-based) of the extracted sequence in the original sequence\n");
+                    "where x is the start coordinate (0-based) of the extracted sequence in the original sequence.\n"
+                    "Sequences are read using the fasta file's .fai index if it is present and up to date, else the file is indexed\n");
     fprintf(stderr, "-i --bedFile : The input bed file for the regions to extract. If omitted then reads bed intervals from stdin\n");
     fprintf(stderr, "-o --outFile : The output fasta file. If omitted then sequences will be written to stdout\n");
     fprintf(stderr, "-f --flank : How much flanking sequence to include at each end of each extracted sequence, by default: %" PRIi64 "\n", flank);
     fprintf(stderr, "-m --minSize : The minimum size of a sequence (before adding the flanks) to extract, by default: %" PRIi64 "\n", min_size);
+    fprintf(stderr, "-T --threads [INT] : Number of threads to extract sequences with (default:%" PRIi64 ")\n", threads);
     fprintf(stderr, "-n --skipMissing : Skip bed intervals that reference missing sequences instead of causing an error\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
-void report_interval(FILE *output, char *seq_name, int64_t start, int64_t end, stHash *sequences, stHash *sequenceLengths) {
-    char *sequence = stHash_search(sequences, seq_name);
-    assert(sequence != NULL);
-    int64_t seq_length = (int64_t)stHash_search(sequenceLengths, seq_name);
-    assert(0 <= start); assert(start <= end); assert(end <= seq_length);
-    char *s = stString_getSubString(sequence, start, end-start);
-    fprintf(output, ">%s|%" PRIi64 "|%" PRIi64 "\n%s\n", seq_name, seq_length, start, s);
-    free(s);
+/*
+ * A sequence of an indexed fasta file, located as in a samtools .fai index: the bases of the sequence start at
+ * offset in the file, on lines of line_bases bases that are each line_width bytes including the line ending, except
+ * the last. So the sequence can be read straight from the mapped file without reading the rest of it.
+ */
+typedef struct _faidxEntry {
+    char *name;
+    int64_t length;
+    int64_t offset;
+    int64_t line_bases, line_width;
+    const char *data; // The mapped file
+    char *sequence; // If the lines of the sequence are not all the same length a copy of the sequence, else NULL
+} FaidxEntry;
+
+void faidx_entry_destruct(FaidxEntry *e) {
+    free(e->name);
+    free(e->sequence);
+    free(e);
+}
+
+/*
+ * Gets the bases [start, end) of the sequence.
+ */
+char *faidx_entry_get_substring(FaidxEntry *e, int64_t start, int64_t end) {
+    assert(0 <= start); assert(start <= end); assert(end <= e->length);
+    if(e->sequence != NULL) {
+        return stString_getSubString(e->sequence, start, end-start);
+    }
+    char *s = st_malloc(end - start + 1);
+    for(int64_t i=start; i<end;) { // Copy the bases a line at a time
+        int64_t column = i % e->line_bases;
+        int64_t j = e->line_bases - column < end - i ? e->line_bases - column : end - i;
+        memcpy(s + i - start, e->data + e->offset + (i / e->line_bases) * e->line_width + column, j);
+        i += j;
+    }
+    s[end - start] = '\0';
+    return s;
+}
+
+/*
+ * A fasta file, mapped if it is uncompressed, else decompressed into memory.
+ */
+typedef struct _fastaFile {
+    char *data;
+    int64_t length;
+    bool mapped;
+} FastaFile;
+
+FastaFile *fasta_file_open(const char *file) {
+    FastaFile *f = st_calloc(1, sizeof(FastaFile));
+    int fd = open(file, O_RDONLY);
+    if(fd == -1) {
+        st_errnoAbort("Could not open fasta file: %s", file);
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0) {
+        st_errnoAbort("Could not stat fasta file: %s", file);
+    }
+    unsigned char magic[2];
+    if(S_ISREG(file_stat.st_mode) && (pread(fd, magic, 2, 0) != 2 || magic[0] != 31 || magic[1] != 139)) { // Not gzipped
+        f->length = file_stat.st_size;
+        if(f->length > 0) {
+            f->data = mmap(NULL, f->length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(f->data == MAP_FAILED) {
+                st_errnoAbort("Could not mmap fasta file: %s", file);
+            }
+            f->mapped = 1;
+        }
+        close(fd); // The mapping remains valid after the file descriptor is closed
+        return f;
+    }
+    close(fd);
+
+    // Compressed, or not a regular file, so read it all into memory
+    FILE *fh = cactusFile_open(file);
+    if(fh == NULL) {
+        st_errnoAbort("Could not open fasta file: %s", file);
+    }
+    int64_t capacity = 1 << 20;
+    f->data = st_malloc(capacity);
+    int64_t i;
+    while((i = fread(f->data + f->length, 1, capacity - f->length, fh)) > 0) {
+        f->length += i;
+        if(f->length == capacity) {
+            capacity *= 2;
+            f->data = st_realloc(f->data, capacity);
+        }
+    }
+    fclose(fh);
+    return f;
+}
+
+void fasta_file_destruct(FastaFile *f) {
+    if(f->mapped) {
+        munmap(f->data, f->length);
+    }
+    else {
+        free(f->data);
+    }
+    free(f);
+}
+
+/*
+ * Reads the .fai index of the file into the map of names to entries, if the index exists and is not older than
+ * the file. Returns non-zero if the index was read.
+ */
+bool faidx_read(const char *file, FastaFile *f, stHash *entries) {
+    char *index_file = stString_print("%s.fai", file);
+    struct stat file_stat, index_stat;
+    FILE *fh = NULL;
+    if(!f->mapped || stat(file, &file_stat) != 0 || stat(index_file, &index_stat) != 0 ||
+       index_stat.st_mtime < file_stat.st_mtime || (fh = fopen(index_file, "r")) == NULL) {
+        free(index_file);
+        return 0;
+    }
+    char *line;
+    while((line = stFile_getLineFromFile(fh)) != NULL) {
+        FaidxEntry *e = st_calloc(1, sizeof(FaidxEntry));
+        char name[strlen(line) + 1];
+        if(sscanf(line, "%s %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "", name, &e->length, &e->offset,
+                  &e->line_bases, &e->line_width) != 5 || e->length < 0 || e->offset < 0 ||
+           (e->length > 0 && (e->line_bases <= 0 || e->line_width < e->line_bases ||
+            e->offset + ((e->length - 1) / e->line_bases) * e->line_width + (e->length - 1) % e->line_bases >= f->length))) {
+            st_errAbort("Fasta index %s does not match its fasta file, got line: %s\n", index_file, line);
+        }
+        e->name = stString_copy(name);
+        e->data = f->data;
+        if(stHash_search(entries, e->name) == NULL) {
+            stHash_insert(entries, e->name, e);
+        }
+        else {
+            faidx_entry_destruct(e);
+        }
+        free(line);
+    }
+    fclose(fh);
+    free(index_file);
+    return 1;
+}
+
+/*
+ * Scans the file, adding an entry for each of its sequences to the map of names to entries.
+ */
+void faidx_build(FastaFile *f, stHash *entries) {
+    const char *data = f->data, *end = f->data + f->length;
+    const char *c = data;
+    while(c < end && *c != '>') { // Skip anything before the first header
+        const char *d = memchr(c, '\n', end - c);
+        c = d == NULL ? end : d + 1;
+    }
+    while(c < end) {
+        // Parse the header, the name of the sequence being its first word, as in a .fai index
+        const char *d = memchr(c, '\n', end - c);
+        const char *line_end = d == NULL ? end : d;
+        int64_t name_length = 0;
+        while(c + 1 + name_length < line_end && !isspace(c[1 + name_length])) {
+            name_length++;
+        }
+        FaidxEntry *e = st_calloc(1, sizeof(FaidxEntry));
+        e->name = stString_getSubString(c, 1, name_length);
+        e->data = data;
+        c = d == NULL ? end : d + 1;
+        e->offset = c - data;
+
+        // Parse the lines of the sequence
+        const char *sequence_start = c;
+        bool short_line = 0, irregular = 0;
+        while(c < end && *c != '>') {
+            d = memchr(c, '\n', end - c);
+            line_end = d == NULL ? end : d;
+            int64_t width = d == NULL ? end - c : d + 1 - c;
+            int64_t bases = line_end > c && line_end[-1] == '\r' ? line_end - 1 - c : line_end - c;
+            if(bases == 0) {
+                if(e->length == 0) { // Blank lines before the first bases
+                    e->offset += width;
+                }
+                short_line = 1;
+            }
+            else if(e->length == 0) {
+                e->line_bases = bases;
+                e->line_width = width;
+                short_line = 0;
+            }
+            else if(short_line || bases > e->line_bases ||
+                    (d != NULL && width - bases != e->line_width - e->line_bases)) {
+                irregular = 1;
+            }
+            else if(bases < e->line_bases) {
+                short_line = 1;
+            }
+            e->length += bases;
+            c += width;
+        }
+        if(irregular) { // Copy the sequence, dropping the line endings
+            e->sequence = st_malloc(e->length + 1);
+            int64_t j = 0;
+            for(const char *b = sequence_start; b < c; b++) {
+                if(*b != '\n' && *b != '\r') {
+                    e->sequence[j++] = *b;
+                }
+            }
+            assert(j == e->length);
+            e->sequence[j] = '\0';
+        }
+        if(stHash_search(entries, e->name) == NULL) {
+            stHash_insert(entries, e->name, e);
+        }
+        else {
+            faidx_entry_destruct(e);
+        }
+    }
 }
 
 typedef struct _interval {
@@ -46,6 +258,14 @@ typedef struct _interval {
     char *name;
 } Interval;
 
+Interval *interval_construct(const char *name, int64_t start, int64_t end) {
+    Interval *i = st_malloc(sizeof(Interval));
+    i->name = stString_copy(name);
+    i->start = start;
+    i->end = end;
+    return i;
+}
+
 void interval_destruct(Interval *i) {
     free(i->name);
     free(i);
@@ -81,11 +301,12 @@ int main(int argc, char *argv[]) {
                                                 { "flank", required_argument, 0, 'f' },
                                                 { "minSize", required_argument, 0, 'm' },
                                                 { "skipMissing", no_argument, 0, 'n' },
+                                                { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:o:f:hnm:i:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:o:f:hnm:i:T:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -109,6 +330,12 @@ int main(int argc, char *argv[]) {
             case 'n':
                 skipMissing = 1;
                 break;
+            case 'T':
+                threads = atoi(optarg);
+                if(threads < 1) {
+                    st_errAbort("Invalid number of threads: %s\n", optarg);
+                }
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -126,31 +353,25 @@ int main(int argc, char *argv[]) {
     st_logInfo("Bed file : %s\n", bed_file);
     st_logInfo("Flank size : %" PRIi64 "\n", flank);
     st_logInfo("Minimum sequence size (minSize) : %" PRIi64 "\n", min_size);
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
 
     //////////////////////////////////////////////
-    // Parse the sequences
+    // Index the sequences
     //////////////////////////////////////////////
 
-    stHash *sequences = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
+    stHash *sequences = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                          (void (*)(void *))faidx_entry_destruct);
+    stList *fasta_files = stList_construct3(0, (void (*)(void *))fasta_file_destruct);
     while(optind < argc) {
         char *seq_file = argv[optind++];
-        st_logInfo("Parsing sequence file : %s\n", seq_file);
-        FILE *seq_file_handle = fopen(seq_file, "r");
-        fastaReadToFunction(seq_file_handle, sequences, fastaRead_readToMapFunction);
-        fclose(seq_file_handle);
-    }
-    st_logInfo("Read %i sequences from sequence files\n", (int)stHash_size(sequences));
-
-    stHash *sequenceLengths = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
-    stHashIterator *it = stHash_getIterator(sequences);
-    char *seq_name;
-    while((seq_name = stHash_getNext(it)) != NULL) {
-        // Add the sequence length (storing an integer directly within the hashtable as opposed to a pointer)
-        stHash_insert(sequenceLengths, seq_name, (void *)strlen((char *)stHash_search(sequences, seq_name)));
-        // Check we get back what we expect
-        assert((int64_t)stHash_search(sequenceLengths, seq_name) == strlen((char *)stHash_search(sequences, seq_name)));
+        st_logInfo("Indexing sequence file : %s\n", seq_file);
+        FastaFile *f = fasta_file_open(seq_file);
+        stList_append(fasta_files, f);
+        if(!faidx_read(seq_file, f, sequences)) { // Use the existing index, if there is one
+            faidx_build(f, sequences);
+        }
     }
-    stHash_destructIterator(it);
+    st_logInfo("Indexed %i sequences from sequence files\n", (int)stHash_size(sequences));
 
     //////////////////////////////////////////////
     // Now parse the bed file and extract the sequences, ensuring they are non-overlapping
@@ -187,7 +408,8 @@ int main(int argc, char *argv[]) {
     // Sort the intervals
     stList_sort(intervals, (int (*)(const void *, const void *))interval_cmp);
 
-    // Now extract the sequences for the intervals
+    // Now merge the overlapping intervals
+    stList *merged_intervals = stList_construct3(0, (void (*)(void *))interval_destruct);
     char *p_seq_name = NULL;
     int64_t p_start = -1, p_end = -1; // Initial values don't matter here
     for(int64_t k=0; k<stList_length(intervals); k++) {
@@ -197,7 +419,7 @@ int main(int argc, char *argv[]) {
             st_logDebug("Processing sequence fragment: %s start:%" PRIi64 " end:%" PRIi64 " \n", interval->name, interval->start, interval->end);
 
             // Get coordinates of interval, adding on flanks
-            int64_t seq_length = (int64_t)stHash_search(sequenceLengths, interval->name);
+            int64_t seq_length = ((FaidxEntry *)stHash_search(sequences, interval->name))->length;
             int64_t i = interval->start - flank > 0 ? interval->start - flank : 0, j = interval->end + flank <= seq_length ? interval->end + flank : seq_length; // Get expanded bounds of sequence with flanks
             assert(0 <= i); assert(i <= interval->start); assert(interval->start <= interval->end); assert(interval->end <= j); assert(j <= seq_length);
 
@@ -207,29 +429,43 @@ int main(int argc, char *argv[]) {
                     continue; // Go to next interval without creating a new one, no need to print it yet
                 }
                 else { // Does not overlap previous interval
-                    // Print out the previous interval
-                    report_interval(output, p_seq_name, p_start, p_end, sequences, sequenceLengths);
-                    free(p_seq_name);
+                    // Keep the previous interval
+                    stList_append(merged_intervals, interval_construct(p_seq_name, p_start, p_end));
                 }
             }
-            // Create a new interval - either because there was no prior interval or because we have printed out the previous interval
-            p_seq_name = stString_copy(interval->name);
+            // Create a new interval - either because there was no prior interval or because we have kept the previous interval
+            p_seq_name = interval->name;
             p_start = i; p_end = j;
         }
     }
     if(p_seq_name != NULL) { // Has a final interval
-        // Report the last interval
-        report_interval(output, p_seq_name, p_start, p_end, sequences, sequenceLengths);
-        free(p_seq_name);
+        // Keep the last interval
+        stList_append(merged_intervals, interval_construct(p_seq_name, p_start, p_end));
+    }
+
+    // Extract the sequences of the intervals, reading them from the mapped files, and write them out in order
+#if defined(_OPENMP)
+#pragma omp parallel for ordered schedule(dynamic) num_threads(threads)
+#endif
+    for(int64_t k=0; k<stList_length(merged_intervals); k++) {
+        Interval *interval = stList_get(merged_intervals, k);
+        FaidxEntry *e = stHash_search(sequences, interval->name);
+        char *s = faidx_entry_get_substring(e, interval->start, interval->end);
+#if defined(_OPENMP)
+#pragma omp ordered
+#endif
+        fprintf(output, ">%s|%" PRIi64 "|%" PRIi64 "\n%s\n", interval->name, e->length, interval->start, s);
+        free(s);
     }
 
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
+    stList_destruct(merged_intervals);
     stList_destruct(intervals);
     stHash_destruct(sequences);
-    stHash_destruct(sequenceLengths);
+    stList_destruct(fasta_files);
     if(bed_file != NULL) {
         fclose(input);
     }
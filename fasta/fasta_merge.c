@@ -21,6 +21,7 @@
 
 #include "bioioC.h"
 #include "commonC.h"
+#include "cactusFile.h"
 
 void usage() {
     fprintf(stderr, "fasta_merge [options], version 0.1\n");
@@ -150,7 +151,7 @@ int main(int argc, char *argv[]) {
     while((line = stFile_getLineFromFile(input)) != NULL) {
         stList *files = stString_split(line);
         for(int64_t i=0; i<stList_length(files); i++) {
-            FILE* chunkFile = fopen(stList_get(files, i), "r");
+            FILE* chunkFile = cactusFile_open(stList_get(files, i));
             fastaReadToFunction(chunkFile, NULL, readFastaCallback);
             fclose(chunkFile);
         }
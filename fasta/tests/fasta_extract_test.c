@@ -8,14 +8,19 @@
  */
 
 static char *test_fa_file = "./fasta/tests/temp.fa";
+static char *test_fai_file = "./fasta/tests/temp.fa.fai";
 static char *test_bed_file = "./fasta/tests/temp.bed";
 static char *test_out_file = "./fasta/tests/out.fa";
 
 static void test_fasta_extract(CuTest *testCase) {
     for(int64_t test=0; test<1000; test++) {
-        // Write some random sequences to the file
+        // Write some random sequences to the file, in lines of a random width, with headers that have a description
+        // after the sequence name in half the tests, and a .fai index of the file in alternate pairs of tests
+        bool multi_word_headers = test % 2, write_index = test / 2 % 2;
         FILE *fh = fopen(test_fa_file, "w");
+        FILE *index_fh = write_index ? fopen(test_fai_file, "w") : NULL;
         int64_t seq_no = st_randomInt64(1, 10);
+        int64_t line_bases = st_randomInt64(1, 100);
         stHash *dna_strings = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
         stHash *dna_strings_with_xs = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, free);
         for(int64_t i=0; i<seq_no; i++) {
@@ -23,9 +28,19 @@ static void test_fasta_extract(CuTest *testCase) {
             char *header = stString_print("%i", i);
             stHash_insert(dna_strings, header, r_string);
             stHash_insert(dna_strings_with_xs, header, stString_copy(r_string));
-            fastaWrite(r_string, header, fh);
+            fprintf(fh, ">%s%s\n", header, multi_word_headers ? " a description\tof the sequence" : "");
+            if(index_fh != NULL) {
+                fprintf(index_fh, "%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", header,
+                        (int64_t)strlen(r_string), (int64_t)ftell(fh), line_bases, line_bases + 1);
+            }
+            for(int64_t j=0; j<strlen(r_string); j+=line_bases) {
+                fprintf(fh, "%.*s\n", (int)line_bases, r_string + j);
+            }
         }
         fclose(fh);
+        if(index_fh != NULL) {
+            fclose(index_fh);
+        }
 
         // Choose a random flank length
         int64_t flank = st_randomInt64(0, 10);
@@ -100,7 +115,7 @@ static void test_fasta_extract(CuTest *testCase) {
         stHash_destruct(sub_seqs);
         stHash_destruct(dna_strings);
         stHash_destruct(dna_strings_with_xs);
-        st_system("rm %s %s %s", test_fa_file, test_bed_file, test_out_file);
+        st_system("rm -f %s %s %s %s", test_fa_file, test_fai_file, test_bed_file, test_out_file);
     }
 }
 
@@ -0,0 +1,204 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sonLib.h"
+#include "c2h.h"
+
+char *c2h_writeInt(int64_t i, char *buffer) {
+    assert(i >= 0);
+    uint64_t j = (uint64_t)i + 1; // Plus one, so no byte is zero
+    while (j >= 0x80) {
+        *buffer++ = (char)((j & 0x7f) | 0x80);
+        j >>= 7;
+    }
+    *buffer++ = (char)j;
+    return buffer;
+}
+
+char *c2h_printRecord(char tag, int64_t fieldNumber, ...) {
+    char *string = st_malloc(sizeof(char) * (2 + fieldNumber * C2H_MAX_INT_LENGTH));
+    char *end = string;
+    *end++ = tag;
+    va_list args;
+    va_start(args, fieldNumber);
+    for (int64_t i = 0; i < fieldNumber; i++) {
+        end = c2h_writeInt(va_arg(args, int64_t), end);
+    }
+    va_end(args);
+    *end = '\0';
+    return string;
+}
+
+struct _c2hReader {
+    FILE *fileHandle;
+    bool isBinary;
+    stList *names; // The names defined so far, for binary files
+    char *eventName; // The names of the current sequence, for text files
+    char *sequenceName;
+};
+
+C2hReader *c2hReader_construct(FILE *fileHandle) {
+    C2hReader *reader = st_calloc(1, sizeof(C2hReader));
+    reader->fileHandle = fileHandle;
+    reader->names = stList_construct3(0, free);
+    int i = getc(fileHandle);
+    if (i == (uint8_t)C2H_BINARY_MAGIC[0]) { // Text files start with a sequence line
+        char magic[C2H_BINARY_MAGIC_LENGTH];
+        if (fread(magic, sizeof(char), C2H_BINARY_MAGIC_LENGTH - 1, fileHandle) != C2H_BINARY_MAGIC_LENGTH - 1 ||
+            memcmp(magic, C2H_BINARY_MAGIC + 1, C2H_BINARY_MAGIC_LENGTH - 1) != 0) {
+            st_errAbort("Got a c2h file with an unrecognised binary header");
+        }
+        reader->isBinary = 1;
+    } else if (i != EOF) {
+        ungetc(i, fileHandle);
+    }
+    return reader;
+}
+
+void c2hReader_destruct(C2hReader *reader) {
+    stList_destruct(reader->names);
+    free(reader->eventName);
+    free(reader->sequenceName);
+    free(reader);
+}
+
+bool c2hReader_isBinary(C2hReader *reader) {
+    return reader->isBinary;
+}
+
+static int64_t readInt(C2hReader *reader) {
+    uint64_t i = 0;
+    for (int64_t shift = 0; shift < 64; shift += 7) {
+        int j = getc(reader->fileHandle);
+        if (j == EOF) {
+            st_errAbort("Got a truncated record in a binary c2h file");
+        }
+        i |= ((uint64_t)(j & 0x7f)) << shift;
+        if ((j & 0x80) == 0) {
+            if (i == 0 || i > INT64_MAX) {
+                break;
+            }
+            return (int64_t)(i - 1);
+        }
+    }
+    st_errAbort("Got a corrupt integer in a binary c2h file");
+    return -1;
+}
+
+static const char *getName(C2hReader *reader) {
+    int64_t i = readInt(reader);
+    if (i >= stList_length(reader->names)) {
+        st_errAbort("Got an undefined name: %" PRIi64 " in a binary c2h file", i);
+    }
+    return stList_get(reader->names, i);
+}
+
+static bool readBinaryRecord(C2hReader *reader, C2hRecord *record) {
+    int tag;
+    while ((tag = getc(reader->fileHandle)) == C2H_NAME) {
+        int64_t length = readInt(reader);
+        char *name = st_malloc(sizeof(char) * (length + 1));
+        if (fread(name, sizeof(char), length, reader->fileHandle) != length) {
+            st_errAbort("Got a truncated name in a binary c2h file");
+        }
+        name[length] = '\0';
+        stList_append(reader->names, name);
+    }
+    record->parentSegment = -1;
+    switch (tag) {
+        case EOF:
+            return 0;
+        case C2H_SEQUENCE:
+            record->type = c2h_sequence;
+            record->eventName = getName(reader);
+            record->sequenceName = getName(reader);
+            record->isBottom = readInt(reader);
+            return 1;
+        case C2H_BOTTOM_SEGMENT:
+            record->type = c2h_bottomSegment;
+            record->segmentName = readInt(reader);
+            record->start = readInt(reader);
+            record->length = readInt(reader);
+            return 1;
+        case C2H_POSITIVE_TOP_SEGMENT:
+        case C2H_NEGATIVE_TOP_SEGMENT:
+            record->type = c2h_topSegment;
+            record->start = readInt(reader);
+            record->length = readInt(reader);
+            record->parentSegment = readInt(reader);
+            record->orientation = tag == C2H_POSITIVE_TOP_SEGMENT;
+            return 1;
+        case C2H_INSERTION:
+            record->type = c2h_topSegment;
+            record->start = readInt(reader);
+            record->length = readInt(reader);
+            return 1;
+        case C2H_SEQUENCE_END:
+            record->type = c2h_sequenceEnd;
+            return 1;
+        default:
+            st_errAbort("Got an unrecognised record tag: %i in a binary c2h file", tag);
+            return 0;
+    }
+}
+
+static bool readTextRecord(C2hReader *reader, C2hRecord *record) {
+    char *line = stFile_getLineFromFile(reader->fileHandle);
+    if (line == NULL) {
+        return 0;
+    }
+    record->parentSegment = -1;
+    if (line[0] == '\0') { // The blank line after the segments of a sequence
+        record->type = c2h_sequenceEnd;
+    } else if (line[0] == 's') {
+        //s 'eventName' 'sequenceName' isBottom
+        char *i = strstr(line, "'\t'"), *j = strrchr(line, '\'');
+        if (strncmp(line, "s\t'", 3) != 0 || i == NULL || j <= i + 2 || j[1] != '\t') {
+            st_errAbort("Got a malformed sequence line in a c2h file: %s", line);
+        }
+        free(reader->eventName);
+        free(reader->sequenceName);
+        reader->eventName = stString_getSubString(line, 3, i - line - 3);
+        reader->sequenceName = stString_getSubString(line, i - line + 3, j - i - 3);
+        record->type = c2h_sequence;
+        record->eventName = reader->eventName;
+        record->sequenceName = reader->sequenceName;
+        record->isBottom = atoi(j + 2);
+    } else {
+        int64_t fields[4];
+        int fieldNumber = line[0] == 'a' ? sscanf(line + 1, "%" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64,
+                                                  &fields[0], &fields[1], &fields[2], &fields[3]) : 0;
+        if (fieldNumber == 3) {
+            //a segmentName start length
+            record->type = c2h_bottomSegment;
+            record->segmentName = fields[0];
+            record->start = fields[1];
+            record->length = fields[2];
+        } else if (fieldNumber == 2 || fieldNumber == 4) {
+            //a start length [parentSegment alignmentOrientation]
+            record->type = c2h_topSegment;
+            record->start = fields[0];
+            record->length = fields[1];
+            if (fieldNumber == 4) {
+                record->parentSegment = fields[2];
+                record->orientation = fields[3];
+            }
+        } else {
+            st_errAbort("Got a malformed line in a c2h file: %s", line);
+        }
+    }
+    free(line);
+    return 1;
+}
+
+bool c2hReader_next(C2hReader *reader, C2hRecord *record) {
+    return reader->isBinary ? readBinaryRecord(reader, record) : readTextRecord(reader, record);
+}
@@ -3,12 +3,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "cactus.h"
 #include "sonLib.h"
 #include "recursiveThreadBuilder.h"
+#include "c2h.h"
 
-static Name globalReferenceEventName;
+/*
+ * The state of a call writing the records of a flower, passed to the write functions as their extra argument, so
+ * concurrent calls for different flowers do not share any state.
+ */
+typedef struct _halWriter {
+    Name referenceEventName;
+    bool binary; // If the records are written in the binary format, see c2h.h
+    stHash *nameIds; // The numbers of the names defined so far in the binary file being written
+} HalWriter;
 
 /*
  * Hal encodes a hierarchical alignment format.
@@ -75,20 +85,57 @@ static Name globalReferenceEventName;
  * alignmentOrientation :
  *      0
  *      1
+ *
+ * The same records can instead be written in the more compact binary format described in c2h.h.
  */
 
-static void writeSequenceHeader(FILE *fileHandle, Sequence *sequence) {
+static int64_t getNameId(HalWriter *writer, FILE *fileHandle, const char *name) {
+    /*
+     * Gets the number of the name in the binary file, first defining the name if it is new.
+     */
+    void *i = stHash_search(writer->nameIds, (void *)name);
+    if (i != NULL) {
+        return (int64_t)i - 1;
+    }
+    int64_t nameId = stHash_size(writer->nameIds), length = strlen(name);
+    char buffer[C2H_MAX_INT_LENGTH + 1];
+    buffer[0] = C2H_NAME;
+    fwrite(buffer, sizeof(char), c2h_writeInt(length, buffer + 1) - buffer, fileHandle);
+    fwrite(name, sizeof(char), length, fileHandle);
+    stHash_insert(writer->nameIds, stString_copy(name), (void *)(nameId + 1));
+    return nameId;
+}
+
+static void writeSequenceHeader(HalWriter *writer, FILE *fileHandle, Sequence *sequence) {
     //s eventName sequenceName isBottom
     Event *event = sequence_getEvent(sequence);
     assert(event != NULL);
     assert(event_getHeader(event) != NULL);
     assert(sequence_getHeader(sequence) != NULL);
+    if (writer->binary) {
+        char *record = c2h_printRecord(C2H_SEQUENCE, 3, getNameId(writer, fileHandle, event_getHeader(event)),
+                                       getNameId(writer, fileHandle, sequence_getHeader(sequence)),
+                                       (int64_t)(event_getName(event) == writer->referenceEventName));
+        fputs(record, fileHandle);
+        free(record);
+        return;
+    }
     fprintf(fileHandle, "s\t'%s'\t'%s'\t%i\n", event_getHeader(event), sequence_getHeader(sequence),
-            event_getName(event) == globalReferenceEventName);
+            event_getName(event) == writer->referenceEventName);
+}
+
+static bool writeThreadHeader(Cap *cap, void *extraArg, FILE *fileHandle) {
+    //Trivial sequences are not written
+    if (sequence_isTrivialSequence(cap_getSequence(cap))) {
+        return 0;
+    }
+    writeSequenceHeader(extraArg, fileHandle, cap_getSequence(cap));
+    return 1;
 }
 
 static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
     //a start length reference-segment block-orientation
+    HalWriter *writer = extraArg;
     Cap *adjacentCap = cap_getAdjacency(cap);
     assert(adjacentCap != NULL);
     int64_t adjacencyLength = cap_getCoordinate(adjacentCap) - cap_getCoordinate(cap) - 1;
@@ -97,9 +144,16 @@ static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
         Sequence *sequence = cap_getSequence(cap);
         assert(sequence != NULL);
         assert(cap_getEvent(cap) != NULL);
-        if (event_getName(cap_getEvent(cap)) == globalReferenceEventName) {
+        int64_t start = cap_getCoordinate(cap) + 1 - sequence_getStart(sequence);
+        if (event_getName(cap_getEvent(cap)) == writer->referenceEventName) {
+            if (writer->binary) {
+                return c2h_printRecord(C2H_BOTTOM_SEGMENT, 3, (int64_t)cap_getName(cap), start, adjacencyLength);
+            }
             return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", cap_getName(cap), cap_getCoordinate(cap) + 1 - sequence_getStart(sequence), adjacencyLength);
         }
+        if (writer->binary) {
+            return c2h_printRecord(C2H_INSERTION, 2, start, adjacencyLength);
+        }
         return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\n", cap_getCoordinate(cap) + 1 - sequence_getStart(sequence), adjacencyLength);
     }
     else {
@@ -108,49 +162,71 @@ static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
 }
 
 static char *writeSegment(Segment *segment, void *extraArg) {
+    HalWriter *writer = extraArg;
     Block *block = segment_getBlock(segment);
-    Segment *referenceSegment = block_getSegmentForEvent(block, globalReferenceEventName);
+    Segment *referenceSegment = block_getSegmentForEvent(block, writer->referenceEventName);
     if (referenceSegment == NULL) {
         Cap *cap5 = segment_get5Cap(segment);
         Cap *cap3 = segment_get3Cap(segment);
         Sequence *sequence = cap_getSequence(cap5);
+        if (writer->binary) {
+            return c2h_printRecord(C2H_INSERTION, 2, cap_getCoordinate(cap5) - sequence_getStart(sequence),
+                                   cap_getCoordinate(cap3) - cap_getCoordinate(cap5) + 1);
+        }
         return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\n", cap_getCoordinate(cap5) - sequence_getStart(sequence), cap_getCoordinate(cap3) - cap_getCoordinate(cap5) + 1);
     }
     Sequence *sequence = segment_getSequence(segment);
     assert(sequence != NULL);
     Name eventName = event_getName(segment_getEvent(segment));
-    if (referenceSegment != segment && eventName != globalReferenceEventName) { //Is a top segment
+    if (referenceSegment != segment && eventName != writer->referenceEventName) { //Is a top segment
+        if (writer->binary) {
+            return c2h_printRecord(segment_getStrand(referenceSegment) ? C2H_POSITIVE_TOP_SEGMENT : C2H_NEGATIVE_TOP_SEGMENT, 3,
+                                   segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment),
+                                   (int64_t)segment_getName(referenceSegment));
+        }
         return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment), segment_getName(referenceSegment), segment_getStrand(referenceSegment));
     } else {
         //Is a bottom segment
+        if (writer->binary) {
+            return c2h_printRecord(C2H_BOTTOM_SEGMENT, 3, (int64_t)segment_getName(segment),
+                                   segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment));
+        }
         return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", segment_getName(segment), segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment));
     }
 }
 
-static int compareCaps(Cap *cap, Cap *cap2) {
-    Event *event = cap_getEvent(cap);
-    Event *event2 = cap_getEvent(cap2);
-    int i = cactusMisc_nameCompare(event_getName(event), event_getName(event2));
+/*
+ * The fields caps are ordered by, looked up once for each cap before sorting.
+ */
+typedef struct _capKey {
+    Cap *cap;
+    Name eventName;
+    bool isReference;
+    Name sequenceName;
+    int64_t coordinate;
+} CapKey;
+
+static int compareCaps(const void *a, const void *b) {
+    const CapKey *key = a, *key2 = b;
+    int i = cactusMisc_nameCompare(key->eventName, key2->eventName);
     if (i != 0) {
-        return event_getName(event) == globalReferenceEventName ? -1 : (event_getName(event2) == globalReferenceEventName ? 1 : i);
+        return key->isReference ? -1 : (key2->isReference ? 1 : i);
     }
-    Sequence *sequence = cap_getSequence(cap);
-    Sequence *sequence2 = cap_getSequence(cap2);
-    i = cactusMisc_nameCompare(sequence_getName(sequence), sequence_getName(sequence2));
+    i = cactusMisc_nameCompare(key->sequenceName, key2->sequenceName);
     if (i == 0) {
-        i = cap_getCoordinate(cap) > cap_getCoordinate(cap2) ? 1 : (cap_getCoordinate(cap) < cap_getCoordinate(cap2) ? -1 : 0);
+        i = key->coordinate > key2->coordinate ? 1 : (key->coordinate < key2->coordinate ? -1 : 0);
     }
     return i;
 }
 
-static stList *getCaps(Flower *flower) {
+static stList *getCaps(Flower *flower, Name referenceEventName) {
     //Get the caps in order
     stList *caps = stList_construct();
     End *end;
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     while ((end = flower_getNextEnd(endIt)) != NULL) {
         if (end_isStubEnd(end)) { // && end_isAttached(end)) {
-            Cap *cap; // = end_getCapForEvent(end, globalReferenceEventName);
+            Cap *cap; // = end_getCapForEvent(end, referenceEventName);
             End_InstanceIterator *capIt = end_getInstanceIterator(end);
             while ((cap = end_getNext(capIt)) != NULL) {
                 if (cap_getSequence(cap) != NULL) {
@@ -164,23 +240,39 @@ static stList *getCaps(Flower *flower) {
         }
     }
     flower_destructEndIterator(endIt);
-    stList_sort(caps, (int(*)(const void *, const void *)) compareCaps);
+
+    // Sort by event, with the reference first, then sequence and coordinate
+    int64_t capNumber = stList_length(caps);
+    CapKey *capKeys = st_malloc(sizeof(CapKey) * (capNumber + 1));
+    for (int64_t i = 0; i < capNumber; i++) {
+        Cap *cap = stList_get(caps, i);
+        capKeys[i].cap = cap;
+        capKeys[i].eventName = event_getName(cap_getEvent(cap));
+        capKeys[i].isReference = capKeys[i].eventName == referenceEventName;
+        capKeys[i].sequenceName = sequence_getName(cap_getSequence(cap));
+        capKeys[i].coordinate = cap_getCoordinate(cap);
+    }
+    qsort(capKeys, capNumber, sizeof(CapKey), compareCaps);
+    for (int64_t i = 0; i < capNumber; i++) {
+        stList_set(caps, i, capKeys[i].cap);
+    }
+    free(capKeys);
     return caps;
 }
 
 void makeHalFormat(Flower *flower, stKVDatabase *database, Name referenceEventName, FILE *fileHandle) {
-    globalReferenceEventName = referenceEventName;
-    stList *caps = getCaps(flower);
+    HalWriter writer = { referenceEventName, 0, NULL };
+    stList *caps = getCaps(flower, referenceEventName);
     if (fileHandle == NULL) {
-        buildRecursiveThreads(database, caps, writeSegment, writeTerminalAdjacency, NULL);
+        buildRecursiveThreads(database, caps, writeSegment, writeTerminalAdjacency, &writer);
     } else {
-        stList *threadStrings = buildRecursiveThreadsInList(database, caps, writeSegment, writeTerminalAdjacency, NULL);
+        stList *threadStrings = buildRecursiveThreadsInList(database, caps, writeSegment, writeTerminalAdjacency, &writer);
         assert(stList_length(threadStrings) == stList_length(caps));
         for (int64_t i = 0; i < stList_length(threadStrings); i++) {
             Cap *cap = stList_get(caps, i);
             if(!sequence_isTrivialSequence(cap_getSequence(cap))) {
                 char *threadString = stList_get(threadStrings, i);
-                writeSequenceHeader(fileHandle, cap_getSequence(cap));
+                writeSequenceHeader(&writer, fileHandle, cap_getSequence(cap));
                 fprintf(fileHandle, "%s\n", threadString);
             }
         }
@@ -188,23 +280,20 @@ void makeHalFormat(Flower *flower, stKVDatabase *database, Name referenceEventNa
     stList_destruct(caps);
 }
 
-void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle) {
-    globalReferenceEventName = referenceEventName;
-    stList *caps = getCaps(flower);
+void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, bool binary, FILE *fileHandle) {
+    HalWriter writer = { referenceEventName, binary, NULL };
+    stList *caps = getCaps(flower, referenceEventName);
     if (fileHandle == NULL) {
-        buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
+        buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, &writer, 1);
     } else {
-        stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
-        assert(stList_length(threadStrings) == stList_length(caps));
-        for (int64_t i = 0; i < stList_length(threadStrings); i++) {
-            Cap *cap = stList_get(caps, i);
-            if(!sequence_isTrivialSequence(cap_getSequence(cap))) {
-                char *threadString = stList_get(threadStrings, i);
-                writeSequenceHeader(fileHandle, cap_getSequence(cap));
-                fprintf(fileHandle, "%s\n", threadString);
-            }
+        if (binary) { // The names are numbered afresh in each file
+            fwrite(C2H_BINARY_MAGIC, sizeof(char), C2H_BINARY_MAGIC_LENGTH, fileHandle);
+            writer.nameIds = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+        }
+        writeRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, &writer, 1, writeThreadHeader, fileHandle);
+        if (binary) {
+            stHash_destruct(writer.nameIds);
         }
-        stList_destruct(threadStrings);
     }
     stList_destruct(caps);
 }
\ No newline at end of file
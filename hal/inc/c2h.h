@@ -0,0 +1,91 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef C2H_H_
+#define C2H_H_
+
+#include "sonLib.h"
+
+/*
+ * The binary variant of the .c2h format written by makeHalFormatNoDb (see hal.c for the text format).
+ *
+ * The file starts with C2H_BINARY_MAGIC, and is then a series of records, each a one byte tag followed by
+ * its fields, which are all unsigned varints:
+ *
+ *      'n' length bytes                             #Defines the next name, numbered from 0, the bytes of the name
+ *      's' eventName sequenceName isBottom          #A sequence, the names given by the numbers of their definitions
+ *      'b' segmentName start length                 #A bottom segment
+ *      '+' start length parentSegment               #A top segment aligned to its parent on the positive strand
+ *      '-' start length parentSegment               #A top segment aligned to its parent on the negative strand
+ *      'i' start length                             #A top segment that is an insertion
+ *      '\n'                                         #The end of the segments of the sequence
+ *
+ * A varint is little endian, seven bits per byte, with the high bit set on all but the last byte, and stores
+ * the value plus one. So no byte of a record is ever zero, and the segment records can be built as C strings.
+ */
+
+#define C2H_BINARY_MAGIC "\xc2" "c2h1"
+#define C2H_BINARY_MAGIC_LENGTH 5
+#define C2H_MAX_INT_LENGTH 10 // The most bytes a varint takes
+
+#define C2H_NAME 'n'
+#define C2H_SEQUENCE 's'
+#define C2H_BOTTOM_SEGMENT 'b'
+#define C2H_POSITIVE_TOP_SEGMENT '+'
+#define C2H_NEGATIVE_TOP_SEGMENT '-'
+#define C2H_INSERTION 'i'
+#define C2H_SEQUENCE_END '\n'
+
+/*
+ * Writes the integer, which must be >= 0, as a varint to the buffer, returning a pointer to the byte after it.
+ */
+char *c2h_writeInt(int64_t i, char *buffer);
+
+/*
+ * Returns a string of the binary record with the given tag and integer fields.
+ */
+char *c2h_printRecord(char tag, int64_t fieldNumber, ...);
+
+typedef enum _c2hRecordType {
+    c2h_sequence, // The start of a sequence, whose segments follow
+    c2h_bottomSegment,
+    c2h_topSegment,
+    c2h_sequenceEnd
+} C2hRecordType;
+
+/*
+ * A record of a c2h file, as returned by c2hReader_next. The names are owned by the reader.
+ */
+typedef struct _c2hRecord {
+    C2hRecordType type;
+    const char *eventName; // For sequences
+    const char *sequenceName; // For sequences
+    bool isBottom; // For sequences
+    int64_t segmentName; // For bottom segments
+    int64_t start; // For segments
+    int64_t length; // For segments
+    int64_t parentSegment; // For top segments, -1 if the segment is an insertion
+    bool orientation; // For top segments with a parent, 1 if aligned on the positive strand
+} C2hRecord;
+
+typedef struct _c2hReader C2hReader;
+
+/*
+ * Makes a reader of the records of a c2h file, which may be either binary or text, reading the file as a stream.
+ */
+C2hReader *c2hReader_construct(FILE *fileHandle);
+
+void c2hReader_destruct(C2hReader *reader);
+
+/*
+ * Reads the next record of the file into the record, returning 0 if at the end of the file.
+ */
+bool c2hReader_next(C2hReader *reader, C2hRecord *record);
+
+/*
+ * Returns non-zero if the file being read is binary.
+ */
+bool c2hReader_isBinary(C2hReader *reader);
+
+#endif /* C2H_H_ */
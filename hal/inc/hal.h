@@ -11,11 +11,16 @@
 #include "sonLib.h"
 #include "cactus.h"
 #include "recursiveThreadBuilder.h"
+#include "c2h.h"
 
 void makeHalFormat(Flower *flower, stKVDatabase *database, Name referenceEventName,
                    FILE *fileHandle);
 
-void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle);
+/*
+ * As makeHalFormat, but building the threads in the record holder rather than a database. If binary the records
+ * are written in the binary format of c2h.h, which must be the same for every call of a traversal.
+ */
+void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, bool binary, FILE *fileHandle);
 
 void printFastaSequences(Flower *flower, FILE *fileHandle, Name referenceEventName);
 
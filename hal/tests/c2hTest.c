@@ -0,0 +1,201 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdlib.h>
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "CuTest.h"
+#include "hal.h"
+
+static const char *tempDir = "c2hTestTempDir";
+
+/*
+ * Reads all the records of the c2h file, as strings, so the records of text and binary files can be compared.
+ */
+static stList *readRecords(const char *fileName, bool isBinary, CuTest *testCase) {
+    FILE *fileHandle = fopen(fileName, "r");
+    C2hReader *reader = c2hReader_construct(fileHandle);
+    CuAssertIntEquals(testCase, isBinary, c2hReader_isBinary(reader));
+    stList *records = stList_construct3(0, free);
+    C2hRecord record;
+    while (c2hReader_next(reader, &record)) {
+        if (record.type == c2h_sequence) {
+            stList_append(records, stString_print("s %s %s %i", record.eventName, record.sequenceName, record.isBottom));
+        } else if (record.type == c2h_bottomSegment) {
+            stList_append(records, stString_print("b %" PRIi64 " %" PRIi64 " %" PRIi64, record.segmentName,
+                                                  record.start, record.length));
+        } else if (record.type == c2h_topSegment) {
+            stList_append(records, stString_print("t %" PRIi64 " %" PRIi64 " %" PRIi64 " %i", record.start,
+                                                  record.length, record.parentSegment,
+                                                  record.parentSegment == -1 ? 0 : record.orientation));
+        } else {
+            stList_append(records, stString_copy("e"));
+        }
+    }
+    c2hReader_destruct(reader);
+    fclose(fileHandle);
+    return records;
+}
+
+static void checkRecords(CuTest *testCase, stList *records, const char **expectedRecords, int64_t length) {
+    CuAssertIntEquals(testCase, length, stList_length(records));
+    for (int64_t i = 0; i < length; i++) {
+        CuAssertStrEquals(testCase, expectedRecords[i], stList_get(records, i));
+    }
+}
+
+static void testC2hReader(CuTest *testCase) {
+    stFile_mkdir(tempDir);
+    char *textFile = stFile_pathJoin(tempDir, "test.c2h");
+    char *binaryFile = stFile_pathJoin(tempDir, "test.c2hb");
+
+    FILE *fileHandle = fopen(textFile, "w");
+    fprintf(fileHandle, "s\t'anc'\t'anc seq'\t1\na\t10\t0\t5\na\t11\t5\t200\n\n"
+                        "s\t'leaf'\t'leaf seq'\t0\na\t0\t5\t10\t1\na\t5\t3\na\t8\t200\t11\t0\n\n"
+                        "s\t'leaf'\t'leaf seq2'\t0\n\n");
+    fclose(fileHandle);
+
+    fileHandle = fopen(binaryFile, "w");
+    fwrite(C2H_BINARY_MAGIC, sizeof(char), C2H_BINARY_MAGIC_LENGTH, fileHandle);
+    const char *names[] = { "anc", "anc seq", "leaf", "leaf seq", "leaf seq2" };
+    for (int64_t i = 0; i < 5; i++) {
+        char buffer[C2H_MAX_INT_LENGTH + 1];
+        buffer[0] = C2H_NAME;
+        fwrite(buffer, sizeof(char), c2h_writeInt(strlen(names[i]), buffer + 1) - buffer, fileHandle);
+        fputs(names[i], fileHandle);
+    }
+    char *records[] = { c2h_printRecord(C2H_SEQUENCE, 3, (int64_t)0, (int64_t)1, (int64_t)1),
+                        c2h_printRecord(C2H_BOTTOM_SEGMENT, 3, (int64_t)10, (int64_t)0, (int64_t)5),
+                        c2h_printRecord(C2H_BOTTOM_SEGMENT, 3, (int64_t)11, (int64_t)5, (int64_t)200),
+                        c2h_printRecord(C2H_SEQUENCE_END, 0),
+                        c2h_printRecord(C2H_SEQUENCE, 3, (int64_t)2, (int64_t)3, (int64_t)0),
+                        c2h_printRecord(C2H_POSITIVE_TOP_SEGMENT, 3, (int64_t)0, (int64_t)5, (int64_t)10),
+                        c2h_printRecord(C2H_INSERTION, 2, (int64_t)5, (int64_t)3),
+                        c2h_printRecord(C2H_NEGATIVE_TOP_SEGMENT, 3, (int64_t)8, (int64_t)200, (int64_t)11),
+                        c2h_printRecord(C2H_SEQUENCE_END, 0),
+                        c2h_printRecord(C2H_SEQUENCE, 3, (int64_t)2, (int64_t)4, (int64_t)0),
+                        c2h_printRecord(C2H_SEQUENCE_END, 0) };
+    for (int64_t i = 0; i < 11; i++) {
+        // A varint of a value less than 127 takes one byte
+        CuAssertIntEquals(testCase, i == 2 || i == 7 ? 5 : (i == 6 ? 3 : (i == 3 || i == 8 || i == 10 ? 1 : 4)),
+                          strlen(records[i]));
+        fputs(records[i], fileHandle);
+        free(records[i]);
+    }
+    fclose(fileHandle);
+
+    const char *expectedRecords[] = { "s anc anc seq 1", "b 10 0 5", "b 11 5 200", "e",
+                                      "s leaf leaf seq 0", "t 0 5 10 1", "t 5 3 -1 0", "t 8 200 11 0", "e",
+                                      "s leaf leaf seq2 0", "e" };
+    stList *textRecords = readRecords(textFile, 0, testCase);
+    stList *binaryRecords = readRecords(binaryFile, 1, testCase);
+    checkRecords(testCase, textRecords, expectedRecords, 11);
+    checkRecords(testCase, binaryRecords, expectedRecords, 11);
+
+    stList_destruct(textRecords);
+    stList_destruct(binaryRecords);
+    free(textFile);
+    free(binaryFile);
+    stFile_rmtree(tempDir);
+}
+
+static void testC2h_writeInt(CuTest *testCase) {
+    for (int64_t test = 0; test < 1000; test++) {
+        int64_t i = test < 10 ? test : (int64_t)(st_random() * INT64_MAX) >> st_randomInt(0, 63);
+        char buffer[C2H_MAX_INT_LENGTH];
+        char *end = c2h_writeInt(i, buffer);
+        CuAssertTrue(testCase, end - buffer <= C2H_MAX_INT_LENGTH);
+        uint64_t j = 0;
+        for (int64_t k = 0; k < end - buffer; k++) {
+            CuAssertTrue(testCase, buffer[k] != '\0');
+            CuAssertIntEquals(testCase, k < end - buffer - 1, (buffer[k] & 0x80) != 0);
+            j |= ((uint64_t)(buffer[k] & 0x7f)) << (7 * k);
+        }
+        CuAssertTrue(testCase, j - 1 == (uint64_t)i);
+    }
+}
+
+/*
+ * Writes the c2h file for a flower with one nested flower, as in recursiveThreadBuilderTest.
+ */
+static void writeC2h(const char *fileName, bool binary) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    eventTree_construct2(cactusDisk);
+    Flower *flower = flower_construct(cactusDisk);
+    End *end1 = end_construct2(0, 1, flower);
+    End *end2 = end_construct2(1, 1, flower);
+    Event *referenceEvent = eventTree_getRootEvent(flower_getEventTree(flower));
+    Sequence *sequence = sequence_construct(1, 5, "ACGTA", "ref sequence", referenceEvent, cactusDisk);
+    flower_addSequence(flower, sequence);
+    Cap *cap1 = cap_construct2(end1, 0, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, 6, 1, sequence);
+    cap_makeAdjacent(cap1, cap2);
+    Group *group = group_construct2(flower);
+    end_setGroup(end1, group);
+    end_setGroup(end2, group);
+
+    Flower *nestedFlower = group_makeNestedFlower(group);
+    Block *block = block_construct(3, nestedFlower);
+    Segment *segment = segment_construct2(block, 1, 1, flower_getSequence(nestedFlower, sequence_getName(sequence)));
+    cap_makeAdjacent(flower_getCap(nestedFlower, cap_getName(cap1)), segment_get5Cap(segment));
+    cap_makeAdjacent(segment_get3Cap(segment), flower_getCap(nestedFlower, cap_getName(cap2)));
+    Group *nestedGroup = group_construct2(nestedFlower);
+    End *end;
+    Flower_EndIterator *endIt = flower_getEndIterator(nestedFlower);
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        end_setGroup(end, nestedGroup);
+    }
+    flower_destructEndIterator(endIt);
+
+    RecordHolder *rh = recordHolder_construct();
+    makeHalFormatNoDb(nestedFlower, rh, event_getName(referenceEvent), binary, NULL);
+    FILE *fileHandle = fopen(fileName, "w");
+    makeHalFormatNoDb(flower, rh, event_getName(referenceEvent), binary, fileHandle);
+    fclose(fileHandle);
+    assert(recordHolder_size(rh) == 0);
+    recordHolder_destruct(rh);
+    cactusDisk_destruct(cactusDisk);
+}
+
+static int64_t getFileSize(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "r");
+    fseek(fileHandle, 0, SEEK_END);
+    int64_t size = ftell(fileHandle);
+    fclose(fileHandle);
+    return size;
+}
+
+static void testMakeHalFormatNoDb(CuTest *testCase) {
+    stFile_mkdir(tempDir);
+    char *textFile = stFile_pathJoin(tempDir, "test.c2h");
+    char *binaryFile = stFile_pathJoin(tempDir, "test.c2hb");
+    writeC2h(textFile, 0);
+    writeC2h(binaryFile, 1);
+
+    stList *textRecords = readRecords(textFile, 0, testCase);
+    stList *binaryRecords = readRecords(binaryFile, 1, testCase);
+    CuAssertIntEquals(testCase, 4, stList_length(textRecords));
+    CuAssertStrEquals(testCase, "s ROOT ref sequence 1", stList_get(textRecords, 0));
+    CuAssertStrEquals(testCase, "e", stList_get(textRecords, 3));
+    CuAssertIntEquals(testCase, stList_length(textRecords), stList_length(binaryRecords));
+    for (int64_t i = 0; i < stList_length(textRecords); i++) {
+        CuAssertStrEquals(testCase, stList_get(textRecords, i), stList_get(binaryRecords, i));
+    }
+    CuAssertTrue(testCase, getFileSize(binaryFile) < getFileSize(textFile));
+
+    stList_destruct(textRecords);
+    stList_destruct(binaryRecords);
+    free(textFile);
+    free(binaryFile);
+    stFile_rmtree(tempDir);
+}
+
+CuSuite* c2hTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testC2h_writeInt);
+    SUITE_ADD_TEST(suite, testC2hReader);
+    SUITE_ADD_TEST(suite, testMakeHalFormatNoDb);
+    return suite;
+}
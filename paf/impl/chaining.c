@@ -1,5 +1,10 @@
 #include "paf.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 /*
  * Functions for chaining together pafs
  */
@@ -54,13 +59,14 @@ static int chain_cmp_by_location(const void *a, const void *b) {
 }
 
 /*
- * Compare two chains by score.
+ * Compare two chains by score. Ties are broken by the location of the chains' pafs, rather than the chain
+ * pointers, so that the order does not depend on the order in which chains are allocated.
  */
 static int chain_cmp_by_score(const void *a, const void *b) {
     Chain *c1 = (Chain *)a, *c2 = (Chain *)b;
     int64_t i = intcmp(c1->score, c2->score);
-    if(i == 0) { // if equal, compare by pointer to ensure any two different pafs are not considered equal
-        i = intcmp((int64_t)c1, (int64_t)c2);
+    if(i == 0) { // if equal, compare by location to ensure any two different pafs are not considered equal
+        i = paf_cmp_by_query_location(c1->paf, c2->paf);
     }
     return i;
 }
@@ -131,10 +137,11 @@ static void chain_to_pafs(Chain *chain, int64_t (*gap_cost)(int64_t, int64_t, vo
 }
 
 /*
- * Chains together the input pafs. Ignores strand.
+ * Chains together the input pafs. Ignores strand. Returns the chains in the order they were
+ * picked, from highest scoring to lowest, each represented by its last link.
  */
 static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *),
-                                void *gap_cost_params, int64_t max_gap_length, int64_t *chain_id) {
+                                       void *gap_cost_params, int64_t max_gap_length) {
     stList_sort(pafs, paf_cmp_by_query_location); // Sort alignments by query start coordinate
 
     stSortedSet *active_chained_alignments = stSortedSet_construct3(chain_cmp_by_location, NULL); // The set of
@@ -232,20 +239,105 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
         }
     }
 
-    // Now finally convert chains back to single pafs
-    stList *output_pafs = stList_construct();
-    for(int64_t i=0; i<stList_length(outputChains); i++) {
-        chain_to_pafs(stList_get(outputChains, i), gap_cost, gap_cost_params, output_pafs, (*chain_id)++);
-    }
-
     // Cleanup
-    stList_destruct(outputChains);
     assert(stList_length(to_remove) == 0);
     stList_destruct(to_remove);
     stSortedSet_destruct(active_chained_alignments);
     assert(stSortedSet_size(chains) == 0);
     stSortedSet_destruct(chains);
 
+    return outputChains;
+}
+
+/*
+ * The pafs of one pair of query and target sequences, and their chains.
+ */
+typedef struct _shard {
+    stList *pafs;
+    stList *chains;
+    int64_t next_chain; // index of the next chain to merge
+} Shard;
+
+static void shard_destruct(Shard *shard) {
+    stList_destruct(shard->pafs);
+    if(shard->chains != NULL) {
+        stList_destruct(shard->chains);
+    }
+    free(shard);
+}
+
+static int shard_cmp_by_descending_size(const void *a, const void *b) {
+    return intcmp(stList_length(((Shard *)b)->pafs), stList_length(((Shard *)a)->pafs));
+}
+
+/*
+ * Chains the pafs of one strand. As pafs can only be chained with pafs with the same query and target sequence,
+ * the pafs are split into shards, one per pair of sequences, which are chained independently using the given number of
+ * threads. The per shard lists of chains are then merged in score order, which gives the same order as chaining
+ * all the pafs together, so the chain ids and output do not depend on the number of threads.
+ */
+static stList *paf_chain_sharded(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *),
+                                 void *gap_cost_params, int64_t max_gap_length, int64_t *chain_id, int64_t threads) {
+    // Split the pafs into shards by query and target sequence
+    stHash *names_to_shards = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    stList *shards = stList_construct3(0, (void (*)(void *))shard_destruct);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        Paf *paf = stList_get(pafs, i);
+        char *names = stString_print("%s\t%s", paf->query_name, paf->target_name); // names do not contain whitespace
+        Shard *shard = stHash_search(names_to_shards, names);
+        if(shard == NULL) {
+            shard = st_calloc(1, sizeof(Shard));
+            shard->pafs = stList_construct();
+            stHash_insert(names_to_shards, names, shard);
+            stList_append(shards, shard);
+        }
+        else {
+            free(names);
+        }
+        stList_append(shard->pafs, paf);
+    }
+    stHash_destruct(names_to_shards);
+
+    // Chain each shard, largest shards first to balance the load
+    stList *shards_by_size = stList_copy(shards, NULL);
+    stList_sort(shards_by_size, shard_cmp_by_descending_size);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads > 0 ? threads : 1)
+    for(int64_t i=0; i<stList_length(shards_by_size); i++) {
+        Shard *shard = stList_get(shards_by_size, i);
+        shard->chains = paf_chain_ignore_strand(shard->pafs, gap_cost, gap_cost_params, max_gap_length);
+    }
+    stList_destruct(shards_by_size);
+
+    // Merge the shards' chains, which are each in descending score order, by repeatedly picking the highest
+    // scoring chain at the head of a shard
+    stSortedSet *heads = stSortedSet_construct3(chain_cmp_by_score, NULL);
+    stHash *heads_to_shards = stHash_construct();
+    for(int64_t i=0; i<stList_length(shards); i++) {
+        Shard *shard = stList_get(shards, i);
+        if(stList_length(shard->chains) > 0) {
+            Chain *chain = stList_get(shard->chains, shard->next_chain++);
+            stSortedSet_insert(heads, chain);
+            stHash_insert(heads_to_shards, chain, shard);
+        }
+    }
+    stList *output_pafs = stList_construct();
+    while(stSortedSet_size(heads) > 0) {
+        Chain *chain = stSortedSet_remove(heads, stSortedSet_getLast(heads));
+        Shard *shard = stHash_remove(heads_to_shards, chain);
+        if(shard->next_chain < stList_length(shard->chains)) {
+            Chain *next_chain = stList_get(shard->chains, shard->next_chain++);
+            stSortedSet_insert(heads, next_chain);
+            stHash_insert(heads_to_shards, next_chain, shard);
+        }
+        // Convert the chain back to single pafs
+        chain_to_pafs(chain, gap_cost, gap_cost_params, output_pafs, (*chain_id)++);
+    }
+
+    // Cleanup
+    stHash_destruct(heads_to_shards);
+    stSortedSet_destruct(heads);
+    stList_destruct(shards);
+
     return output_pafs;
 }
 
@@ -264,7 +356,7 @@ static int paf_cmp_by_score(const void *a, const void *b) {
 }
 
 stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
-                  int64_t max_gap_length, float percentage_to_trim) {
+                  int64_t max_gap_length, float percentage_to_trim, int64_t threads) {
     // Split into forward and reverse strand alignments
     stList *positive_strand_pafs = stList_construct();
     stList *negative_strand_pafs = stList_construct();
@@ -298,8 +390,8 @@ stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), v
     }
 
     int64_t chain_id = 0;
-    stList *positive_chained_pafs = paf_chain_ignore_strand(positive_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id);
-    stList *negative_chained_pafs = paf_chain_ignore_strand(negative_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id);
+    stList *positive_chained_pafs = paf_chain_sharded(positive_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id, threads);
+    stList *negative_chained_pafs = paf_chain_sharded(negative_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id, threads);
 
     // Correct negative strand coordinates
     for(int64_t i=0; i<stList_length(negative_chained_pafs); i++) {
@@ -2,136 +2,209 @@
 #include <ctype.h>
 #include "../inc/paf.h"
 #include "bioioC.h"
+#include "cactusFile.h"
 
 /*
  * Library functions for manipulating paf files.
  */
 
 void paf_destruct(Paf *paf) {
-    Cigar *c = paf->cigar;
-    while(c != NULL) { // Cleanup the individual cigar records
-        Cigar *c2 = c->next;
-        free(c);
-        c = c2;
+    if(paf->cigar != NULL) {
+        cigar_destruct(paf->cigar);
     }
     free(paf);
 }
 
-static Cigar *parse_cigar_record(char **c) {
-    Cigar *cigar = st_calloc(1, sizeof(Cigar)); // Allocate a cigar record
+Cigar *cigar_construct(int64_t max_length) {
+    Cigar *cigar = st_calloc(1, sizeof(Cigar));
+    cigar->max_length = max_length > 0 ? max_length : 1;
+    cigar->runs = st_malloc(sizeof(uint32_t) * cigar->max_length);
+    return cigar;
+}
+
+void cigar_destruct(Cigar *cigar) {
+    free(cigar->runs);
+    free(cigar);
+}
+
+void cigar_append(Cigar *cigar, CigarOp op, int64_t length) {
+    assert(length >= 0);
+    do { // Runs too long to be packed are split into multiple runs
+        if(cigar->length == cigar->max_length) {
+            cigar->max_length *= 2;
+            cigar->runs = st_realloc(cigar->runs, sizeof(uint32_t) * cigar->max_length);
+        }
+        int64_t l = length > CIGAR_MAX_RUN_LENGTH ? CIGAR_MAX_RUN_LENGTH : length;
+        cigar_set(cigar, cigar->length++, op, l);
+        length -= l;
+    } while(length > 0);
+}
+
+/*
+ * Parses a single cigar run from the string, appending it to the cigar and moving the string pointer
+ * past the run.
+ */
+static void parse_cigar_record(char **c, Cigar *cigar) {
     // Calculate the number of characters representing the length of the record
-    int64_t i=0;
+    int64_t i=0, length=0;
     while(isdigit((*c)[i])) {
+        length = length * 10 + ((*c)[i] - '0');
         i++;
     }
     char t = (*c)[i]; // The type of the cigar operation
+    CigarOp op = match;
     switch(t) {
     case 'M': // match
     case '=': // exact match
     case 'X': // snp match
-        cigar->op = match;
+        op = match;
         break;
     case 'I':
-        cigar->op = query_insert;
+        op = query_insert;
         break;
     case 'D':
-        cigar->op = query_delete;
+        op = query_delete;
         break;
     default:
         st_errAbort("Got an unexpected character paf cigar string: %c\n", t);
         break;
     }
-    (*c)[i] = ' ';
-    cigar->length = atoll(*c);
+    cigar_append(cigar, op, length);
     *c = &((*c)[i+1]);
-    return cigar;
+}
+
+/*
+ * Parses the cigar string into the given cigar, which is emptied first.
+ */
+static void parse_cigar2(Cigar *cigar, char *cigar_string) {
+    cigar->length = 0;
+    while(cigar_string[0] != '\0') {
+        parse_cigar_record(&cigar_string, cigar);
+    }
 }
 
 static Cigar *parse_cigar(char *cigar_string) {
-    if(cigar_string[0] == '\0') { // If is the empty string
+    if(cigar_string == NULL || cigar_string[0] == '\0') { // If is the empty string
         return NULL;
     }
-    Cigar *cigar = parse_cigar_record(&cigar_string);
-    Cigar *pCigar = cigar;
-    while(cigar_string[0] != '\0') {
-        Cigar *nCigar = parse_cigar_record(&cigar_string);
-        pCigar->next = nCigar;
-        pCigar = nCigar;
+    int64_t runs = 0; // Count the runs, so the cigar is allocated at the right size
+    for(char *c = cigar_string; *c != '\0'; c++) {
+        runs += !isdigit(*c);
     }
+    Cigar *cigar = cigar_construct(runs);
+    parse_cigar2(cigar, cigar_string);
     return cigar;
 }
 
-static Cigar *cigar_reverse(Cigar *c) {
-    if(c == NULL) {
+static void cigar_reverse(Cigar *c) {
+    for(int64_t i=0, j=cigar_count(c)-1; i<j; i++, j--) {
+        uint32_t k = c->runs[i];
+        c->runs[i] = c->runs[j];
+        c->runs[j] = k;
+    }
+}
+
+/*
+ * Gets the next whitespace delimited token from the string, terminating it in place and moving the string
+ * pointer past it. Returns NULL if there are no further tokens.
+ */
+static char *next_token(char **c) {
+    char *s = *c;
+    while(isspace(*s)) {
+        s++;
+    }
+    if(*s == '\0') {
+        *c = s;
         return NULL;
     }
-    Cigar *p = NULL;
-    // p -> c -> n -> q
-    while(c->next != NULL) {
-        Cigar *n = c->next;
-        c->next = p; // p <- c , n -> q
-        p = c;
-        c = n;
+    char *t = s;
+    while(*t != '\0' && !isspace(*t)) {
+        t++;
+    }
+    if(*t != '\0') {
+        *t++ = '\0';
     }
-    c->next = p; // p <- c <- n
-    return c;
+    *c = t;
+    return s;
 }
 
-Paf *paf_parse(char *paf_string) {
-    Paf *paf = st_calloc(1, sizeof(Paf));
+static char *next_required_token(char **c) {
+    char *token = next_token(c);
+    if(token == NULL) {
+        st_errAbort("Paf record has fewer than the 12 required fields\n");
+    }
+    return token;
+}
 
-    stList *tokens = stString_split(paf_string); // Tokenize the record
+/*
+ * Parses a paf record, tokenizing the string in place. The name fields of the paf are left pointing into the
+ * string and the cigar string, if present, is returned in cigar_string, so that the caller can decide how
+ * the names and cigar are stored.
+ */
+static void paf_parse_in_place(Paf *paf, char *paf_string, char **cigar_string) {
+    char *c = paf_string;
 
     // Get query coordinates
-    paf->query_name = stString_copy(stList_get(tokens, 0));
-    paf->query_length = atoll(stList_get(tokens, 1));
-    paf->query_start = atoll(stList_get(tokens, 2));
-    paf->query_end = atoll(stList_get(tokens, 3));
+    paf->query_name = next_required_token(&c);
+    paf->query_length = atoll(next_required_token(&c));
+    paf->query_start = atoll(next_required_token(&c));
+    paf->query_end = atoll(next_required_token(&c));
 
     // Is the alignment forward or reverse
-    char strand = ((char *)stList_get(tokens, 4))[0];
+    char strand = next_required_token(&c)[0];
     if(strand != '+' && strand != '-') {
-        st_errAbort("Got an unexpected strand character (%c) in a paf string: %s\n", strand, paf_string);
+        st_errAbort("Got an unexpected strand character (%c) in a paf string for query: %s\n", strand, paf->query_name);
     }
     paf->same_strand = strand == '+';
 
     // Get target coordinates
-    paf->target_name = stString_copy(stList_get(tokens, 5));
-    paf->target_length = atoll(stList_get(tokens, 6));
-    paf->target_start = atoll(stList_get(tokens, 7));
-    paf->target_end = atoll(stList_get(tokens, 8));
+    paf->target_name = next_required_token(&c);
+    paf->target_length = atoll(next_required_token(&c));
+    paf->target_start = atoll(next_required_token(&c));
+    paf->target_end = atoll(next_required_token(&c));
 
     // Get the core alignment metric attributes of the record
-    paf->num_matches = atoll(stList_get(tokens, 9));
-    paf->num_bases = atoll(stList_get(tokens, 10));
-    paf->mapping_quality = atoll(stList_get(tokens, 11));
+    paf->num_matches = atoll(next_required_token(&c));
+    paf->num_bases = atoll(next_required_token(&c));
+    paf->mapping_quality = atoll(next_required_token(&c));
 
     paf->tile_level = -1;
     paf->chain_id = -1;
+    *cigar_string = NULL;
 
-    // Parse the remaining optional tags
-    for(int64_t i=12; i<stList_length(tokens); i++) {
-        stList *tag = stString_splitByString(stList_get(tokens, i), ":");
-        char *type = stList_get(tag, 0);
-        if(strcmp(type, "tp") == 0) {
-            paf->type = ((char *)stList_get(tag, 2))[0];
+    // Parse the remaining optional tags, which are of the form "XX:T:value"
+    char *tag;
+    while((tag = next_token(&c)) != NULL) {
+        if(strlen(tag) < 5 || tag[2] != ':' || tag[4] != ':') {
+            continue; // Not a well formed tag
+        }
+        char *value = &(tag[5]);
+        if(tag[0] == 't' && tag[1] == 'p') {
+            paf->type = value[0];
             assert(paf->type == 'P' || paf->type == 'S' || paf->type == 'I');
-        } else if (strcmp(type, "AS") == 0) {
-            paf->score = atoll(stList_get(tag, 2));
-        } else if(strcmp(type, "cg") == 0) {
-            paf->cigar = parse_cigar(stList_get(tag, 2));
+        } else if (tag[0] == 'A' && tag[1] == 'S') {
+            paf->score = atoll(value);
+        } else if(tag[0] == 'c' && tag[1] == 'g') {
+            *cigar_string = value;
         }
-        else if(strcmp(type, "tl") == 0) {
-            paf->tile_level = atoll(stList_get(tag, 2));
+        else if(tag[0] == 't' && tag[1] == 'l') {
+            paf->tile_level = atoll(value);
         }
-        else if(strcmp(type, "cn") == 0) {
-            paf->chain_id = atoll(stList_get(tag, 2));
+        else if(tag[0] == 'c' && tag[1] == 'n') {
+            paf->chain_id = atoll(value);
         }
-        stList_destruct(tag);
     }
+}
+
+Paf *paf_parse(char *paf_string) {
+    Paf *paf = st_calloc(1, sizeof(Paf));
+    char *cigar_string;
+    paf_parse_in_place(paf, paf_string, &cigar_string);
 
-    // Cleanup
-    stList_destruct(tokens);
+    // Make the record independent of the string
+    paf->query_name = stString_copy(paf->query_name);
+    paf->target_name = stString_copy(paf->target_name);
+    paf->cigar = parse_cigar(cigar_string);
 
     return paf;
 }
@@ -149,19 +222,125 @@ Paf *paf_read(FILE *fh) {
     return paf;
 }
 
-int64_t cigar_number_of_records(Paf *paf) {
-    int64_t i=0;
-    Cigar *c = paf->cigar;
-    while(c != NULL) {
-        i++;
-        c = c->next;
+/*
+ * Reader
+ */
+
+struct _pafReader {
+    FILE *fh;
+    char *file_name; // The file, if the reader opened it, so it can be reopened to reset a compressed stream
+    bool at_start; // If nothing has been read since the file was opened or reset
+    PafBinaryReader *binary_reader; // Non-null if reading a binary file, which then hands out its own reused paf
+    char *line; // The line buffer, reused for each record
+    size_t line_capacity;
+    Paf paf; // The paf record handed out, reused for each record
+    Cigar *cigar; // The cigar of the current paf, reused for each record
+    stHash *names; // The interned sequence names
+};
+
+static PafReader *paf_reader_construct2(void) {
+    PafReader *reader = st_calloc(1, sizeof(PafReader));
+    reader->names = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    reader->cigar = cigar_construct(1024);
+    reader->at_start = 1;
+    return reader;
+}
+
+PafReader *paf_reader_construct(FILE *fh) {
+    PafReader *reader = paf_reader_construct2();
+    reader->fh = fh;
+    return reader;
+}
+
+PafReader *paf_reader_open(const char *file) {
+    if(file == NULL) {
+        return paf_reader_construct(stdin);
     }
-    return i;
+    PafReader *reader = paf_reader_construct2();
+    if(paf_binary_is_binary_file(file)) {
+        reader->binary_reader = paf_binary_reader_construct(file);
+    }
+    else {
+        reader->fh = cactusFile_open(file);
+        if(reader->fh == NULL) {
+            st_errnoAbort("Could not open paf file: %s", file);
+        }
+        reader->file_name = stString_copy(file);
+    }
+    return reader;
+}
+
+static char *intern_name(PafReader *reader, char *name) {
+    char *interned_name = stHash_search(reader->names, name);
+    if(interned_name == NULL) {
+        interned_name = stString_copy(name);
+        stHash_insert(reader->names, interned_name, interned_name);
+    }
+    return interned_name;
+}
+
+Paf *paf_reader_next(PafReader *reader) {
+    if(reader->binary_reader != NULL) { // The names point into the mapped file, so need not be interned
+        return paf_binary_read(reader->binary_reader);
+    }
+
+    Paf *paf = &(reader->paf);
+
+    reader->at_start = 0;
+    ssize_t i = getline(&(reader->line), &(reader->line_capacity), reader->fh);
+    if(i < 0) {
+        return NULL;
+    }
+    memset(paf, 0, sizeof(Paf));
+    char *cigar_string;
+    paf_parse_in_place(paf, reader->line, &cigar_string);
+    paf->query_name = intern_name(reader, paf->query_name);
+    paf->target_name = intern_name(reader, paf->target_name);
+    if(cigar_string != NULL && cigar_string[0] != '\0') {
+        parse_cigar2(reader->cigar, cigar_string);
+        paf->cigar = reader->cigar;
+    }
+
+    paf_check(paf);
+
+    return paf;
+}
+
+void paf_reader_reset(PafReader *reader) {
+    if(reader->binary_reader != NULL) {
+        paf_binary_reader_reset(reader->binary_reader);
+    }
+    else if(!reader->at_start && fseek(reader->fh, 0, SEEK_SET) != 0) {
+        // A compressed file is read through a stream that can not seek, so is opened again
+        if(reader->file_name == NULL) {
+            st_errnoAbort("Could not rewind the paf file");
+        }
+        fclose(reader->fh);
+        reader->fh = cactusFile_open(reader->file_name);
+        if(reader->fh == NULL) {
+            st_errnoAbort("Could not reopen paf file: %s", reader->file_name);
+        }
+    }
+    reader->at_start = 1;
+}
+
+void paf_reader_destruct(PafReader *reader) {
+    if(reader->binary_reader != NULL) {
+        paf_binary_reader_destruct(reader->binary_reader);
+    }
+    if(reader->file_name != NULL) {
+        fclose(reader->fh);
+        free(reader->file_name);
+    }
+    free(reader->line);
+    cigar_destruct(reader->cigar);
+    stHash_destruct(reader->names);
+    free(reader);
 }
 
 char *paf_print(Paf *paf) {
     // Generous estimate of size needed for each paf record.
-    int64_t buf_size = 12 * cigar_number_of_records(paf) + 140 + strlen(paf->query_name) + strlen(paf->target_name);
+    int64_t buf_size = 12 * cigar_count(paf->cigar) + 140 + strlen(paf->query_name) + strlen(paf->target_name);
     char *buffer = st_malloc(sizeof(char) * buf_size); // Giving a generous
     int64_t i = sprintf(buffer, "%s\t%" PRIi64 "\t%" PRIi64"\t%" PRIi64"\t%c\t%s\t%" PRIi64"\t%" PRIi64"\t%" PRIi64
                                 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64,
@@ -194,9 +373,9 @@ char *paf_print(Paf *paf) {
     if(paf->cigar != NULL) {
         i += sprintf(buffer+i, "\tcg:Z:");
         Cigar *c = paf->cigar;
-        while(c != NULL) {
-            i += sprintf(buffer+i, "%" PRIi64 "%c", c->length, c->op == match ? 'M' : (c->op == query_insert ? 'I' : 'D'));
-            c = c->next;
+        for(int64_t j=0; j<cigar_count(c); j++) {
+            CigarOp op = cigar_get_op(c, j);
+            i += sprintf(buffer+i, "%" PRIi64 "%c", cigar_get_length(c, j), op == match ? 'M' : (op == query_insert ? 'I' : 'D'));
             if(i > buf_size) {
                 st_errAbort("Size of paf record exceeded buffer size\n");
             }
@@ -213,9 +392,11 @@ void paf_stats_calc(Paf *paf, char *query_seq, char *target_seq,
     (*matches)=0; (*mismatches)=0; (*query_inserts)=0; (*query_deletes)=0;
     Cigar *c = paf->cigar;
     int64_t i=0, j=paf->target_start;
-    while(c != NULL) {
-        if(c->op == match) {
-            for(int64_t k=0; k<c->length; k++) {
+    for(int64_t l=0; l<cigar_count(c); l++) {
+        CigarOp op = cigar_get_op(c, l);
+        int64_t length = cigar_get_length(c, l);
+        if(op == match) {
+            for(int64_t k=0; k<length; k++) {
                 if(toupper(target_seq[j++]) ==
                    toupper(paf->same_strand ? query_seq[paf->query_start+i++] : stString_reverseComplementChar(query_seq[paf->query_end-(++i)]))) {
                     (*matches)++;
@@ -225,16 +406,15 @@ void paf_stats_calc(Paf *paf, char *query_seq, char *target_seq,
                 }
             }
         }
-        else if(c->op == query_insert) {
+        else if(op == query_insert) {
             (*query_inserts)++;
-            i += c->length;
+            i += length;
         }
         else {
-            assert(c->op == query_delete);
+            assert(op == query_delete);
             (*query_deletes)++;
-            j += c->length;
+            j += length;
         }
-        c = c->next;
     }
 }
 
@@ -260,13 +440,14 @@ void paf_pretty_print(Paf *paf, char *query_seq, char *target_seq, FILE *fh, boo
         char *target_align = st_malloc(sizeof(char) * (max_align_length + 1));
         char *star_align = st_malloc(sizeof(char) * (max_align_length + 1));
         int64_t i = 0, j = paf->target_start, k = 0;
-        while (c != NULL) {
-            for (int64_t l = 0; l < c->length; l++) {
+        for (int64_t r = 0; r < cigar_count(c); r++) {
+            CigarOp op = cigar_get_op(c, r);
+            for (int64_t l = 0; l < cigar_get_length(c, r); l++) {
                 char m = '-', n = '-';
-                if (c->op != query_insert) {
+                if (op != query_insert) {
                     m = target_seq[j++];
                 }
-                if (c->op != query_delete) {
+                if (op != query_delete) {
                     n = paf->same_strand ? query_seq[paf->query_start + i++] :
                         stString_reverseComplementChar(query_seq[paf->query_end - (++i)]);
                 }
@@ -274,7 +455,6 @@ void paf_pretty_print(Paf *paf, char *query_seq, char *target_seq, FILE *fh, boo
                 query_align[k] = n;
                 star_align[k++] = toupper(m) == toupper(n) ? '*' : ' ';
             }
-            c = c->next;
         }
         assert(k <= max_align_length);
         int64_t window = 150;
@@ -312,14 +492,14 @@ void paf_check(Paf *paf) {
         // Check that cigar alignment, if present, matches the alignment:
         int64_t i=0, j=0;
         Cigar *cigar = paf->cigar;
-        while(cigar != NULL) {
-            if(cigar->op == match || cigar->op == query_insert) {
-                i += cigar->length;
+        for(int64_t k=0; k<cigar_count(cigar); k++) {
+            CigarOp op = cigar_get_op(cigar, k);
+            if(op == match || op == query_insert) {
+                i += cigar_get_length(cigar, k);
             }
-            if(cigar->op == match || cigar->op == query_delete) {
-                j += cigar->length;
+            if(op == match || op == query_delete) {
+                j += cigar_get_length(cigar, k);
             }
-            cigar = cigar->next;
         }
         if(i != paf->query_end - paf->query_start) {
             st_errAbort("Paf cigar alignment does not match query length: %" PRIi64 " vs. %" PRIi64 " %s", i,
@@ -347,18 +527,18 @@ void paf_invert(Paf *paf) {
 
     // Switch the query and target in the cigar
     Cigar *c = paf->cigar;
-    while(c != NULL) {
-        if(c->op == query_insert) {
-            c->op = query_delete;
+    for(int64_t i=0; i<cigar_count(c); i++) {
+        CigarOp op = cigar_get_op(c, i);
+        if(op == query_insert) {
+            cigar_set(c, i, query_delete, cigar_get_length(c, i));
         }
-        else if(c->op == query_delete) {
-            c->op = query_insert;
+        else if(op == query_delete) {
+            cigar_set(c, i, query_insert, cigar_get_length(c, i));
         }
-        c = c->next;
     }
     // Now reverse the order if the ordering is swapped
     if(!paf->same_strand) {
-        paf->cigar = cigar_reverse(paf->cigar);
+        cigar_reverse(paf->cigar);
     }
 }
 
@@ -381,57 +561,86 @@ void write_pafs(FILE *fh, stList *pafs) {
 int64_t paf_get_number_of_aligned_bases(Paf *paf) {
     int64_t aligned_bases = 0;
     Cigar *c = paf->cigar;
-    while(c != NULL) {
-        if(c->op == match) {
-            aligned_bases += c->length;
+    for(int64_t i=0; i<cigar_count(c); i++) {
+        if(cigar_get_op(c, i) == match) {
+            aligned_bases += cigar_get_length(c, i);
         }
-        c = c->next;
     }
     return aligned_bases;
 }
 
-static Cigar *cigar_trim(int64_t *query_c, int64_t *target_c, Cigar *c, int64_t end_bases_to_trim, int q_sign, int t_sign) {
-    int64_t bases_trimmed = 0;
-    while(c != NULL && (c->op != match || bases_trimmed < end_bases_to_trim)) {
-        if(c->op == match) { // can trim this alignment
-            if(bases_trimmed + c->length > end_bases_to_trim) {
-                int64_t i = end_bases_to_trim - bases_trimmed;
-                c->length -= i;
-                (*query_c) += q_sign*i;
-                (*target_c) += t_sign*i;
-                assert(c->length > 0);
+/*
+ * Trims end_bases_to_trim aligned bases from the start (or, if from_start is false, the end) of the cigar,
+ * along with any indels left at the new end, updating the given query and target coordinates.
+ * Returns the number of runs to remove from the end of the cigar.
+ */
+static int64_t cigar_trim(int64_t *query_c, int64_t *target_c, Cigar *c, int64_t end_bases_to_trim, int q_sign, int t_sign,
+                          bool from_start) {
+    int64_t bases_trimmed = 0, runs_trimmed = 0;
+    while(runs_trimmed < cigar_count(c)) {
+        int64_t i = from_start ? runs_trimmed : cigar_count(c) - 1 - runs_trimmed;
+        CigarOp op = cigar_get_op(c, i);
+        int64_t length = cigar_get_length(c, i);
+        if(op == match) { // can trim this alignment
+            if(bases_trimmed >= end_bases_to_trim) {
+                break;
+            }
+            if(bases_trimmed + length > end_bases_to_trim) {
+                int64_t j = end_bases_to_trim - bases_trimmed;
+                cigar_set(c, i, match, length - j);
+                (*query_c) += q_sign*j;
+                (*target_c) += t_sign*j;
+                assert(length - j > 0);
                 break;
             }
-            bases_trimmed += c->length;
-            (*query_c) += q_sign*c->length;
-            (*target_c) += t_sign*c->length;
+            bases_trimmed += length;
+            (*query_c) += q_sign*length;
+            (*target_c) += t_sign*length;
         }
-        else if(c->op == query_insert) {
-            (*query_c) += q_sign*c->length;
+        else if(op == query_insert) {
+            (*query_c) += q_sign*length;
         }
         else {
-            assert(c->op == query_delete);
-            (*target_c) += t_sign*c->length;
+            assert(op == query_delete);
+            (*target_c) += t_sign*length;
         }
-        Cigar *c2 = c;
-        c = c->next;
-        free(c2);
+        runs_trimmed++;
     }
-    return c;
+    return runs_trimmed;
+}
+
+/*
+ * Removes the first prefix_length and last suffix_length runs of the cigar.
+ */
+static void cigar_remove_ends(Cigar *c, int64_t prefix_length, int64_t suffix_length) {
+    assert(prefix_length + suffix_length <= cigar_count(c));
+    memmove(c->runs, c->runs + prefix_length, sizeof(uint32_t) * (c->length - prefix_length - suffix_length));
+    c->length -= prefix_length + suffix_length;
 }
 
 void paf_trim_ends(Paf *paf, int64_t end_bases_to_trim) {
+    if(paf->cigar == NULL) {
+        return;
+    }
+    int64_t prefix_length, suffix_length;
     if(paf->same_strand) {
         // Trim front end
-        paf->cigar = cigar_trim(&(paf->query_start), &(paf->target_start), paf->cigar, end_bases_to_trim, 1, 1);
+        prefix_length = cigar_trim(&(paf->query_start), &(paf->target_start), paf->cigar, end_bases_to_trim, 1, 1, 1);
+        cigar_remove_ends(paf->cigar, prefix_length, 0);
         // Trim back end
-        paf->cigar = cigar_reverse(cigar_trim(&(paf->query_end), &(paf->target_end), cigar_reverse(paf->cigar), end_bases_to_trim, -1, -1));
+        suffix_length = cigar_trim(&(paf->query_end), &(paf->target_end), paf->cigar, end_bases_to_trim, -1, -1, 0);
     }
     else {
         // Trim front end
-        paf->cigar = cigar_trim(&(paf->query_end), &(paf->target_start), paf->cigar, end_bases_to_trim, -1, 1);
+        prefix_length = cigar_trim(&(paf->query_end), &(paf->target_start), paf->cigar, end_bases_to_trim, -1, 1, 1);
+        cigar_remove_ends(paf->cigar, prefix_length, 0);
         // Trim back end
-        paf->cigar = cigar_reverse(cigar_trim(&(paf->query_start), &(paf->target_end), cigar_reverse(paf->cigar), end_bases_to_trim, 1, -1));
+        suffix_length = cigar_trim(&(paf->query_start), &(paf->target_end), paf->cigar, end_bases_to_trim, 1, -1, 0);
+    }
+    cigar_remove_ends(paf->cigar, 0, suffix_length);
+    if(cigar_count(paf->cigar) == 0) { // Everything was trimmed
+        cigar_destruct(paf->cigar);
+        paf->cigar = NULL;
     }
 }
 
@@ -460,9 +669,8 @@ Paf *paf_shatter2(Paf *paf, int64_t query_start, int64_t target_start, int64_t l
     s_paf->target_end = target_start + length;
 
     s_paf->same_strand = paf->same_strand;
-    s_paf->cigar = st_calloc(1, sizeof(Cigar)); // Allocate a cigar record
-    s_paf->cigar->length = length;
-    s_paf->cigar->op = match;
+    s_paf->cigar = cigar_construct(1);
+    cigar_append(s_paf->cigar, match, length);
 
     s_paf->score = paf->score;
     s_paf->mapping_quality = paf->mapping_quality;
@@ -482,26 +690,27 @@ stList *paf_shatter(Paf *paf) {
     int64_t query_coordinate = paf->same_strand ? paf->query_start : paf->query_end;
     int64_t target_coordinate = paf->target_start;
     stList *matches = stList_construct3(0, (void (*)(void *))paf_destruct);
-    while (p != NULL) {
-        assert(p->length >= 1);
-        if (p->op == match) {
+    for (int64_t i = 0; i < cigar_count(p); i++) {
+        CigarOp op = cigar_get_op(p, i);
+        int64_t length = cigar_get_length(p, i);
+        assert(length >= 1);
+        if (op == match) {
             if (paf->same_strand) {
-                stList_append(matches, paf_shatter2(paf, query_coordinate, target_coordinate, p->length));
-                query_coordinate += p->length;
+                stList_append(matches, paf_shatter2(paf, query_coordinate, target_coordinate, length));
+                query_coordinate += length;
             } else {
-                query_coordinate -= p->length;
-                stList_append(matches, paf_shatter2(paf, query_coordinate, target_coordinate, p->length));
+                query_coordinate -= length;
+                stList_append(matches, paf_shatter2(paf, query_coordinate, target_coordinate, length));
             }
-            target_coordinate += p->length;
+            target_coordinate += length;
         }
-        else if (p->op == query_insert) {
-            query_coordinate += paf->same_strand ? p->length : -p->length;
+        else if (op == query_insert) {
+            query_coordinate += paf->same_strand ? length : -length;
         }
         else {
-            assert(p->op == query_delete);
-            target_coordinate += p->length;
+            assert(op == query_delete);
+            target_coordinate += length;
         }
-        p = p->next;
     }
     assert(target_coordinate == paf->target_end);
     if (paf->same_strand) {
@@ -536,10 +745,12 @@ SequenceCountArray *get_alignment_count_array(stHash *seq_names_to_alignment_cou
 void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *paf) {
     Cigar *c = paf->cigar;
     int64_t i = paf->query_start;
-    while(c != NULL) {
-        if(c->op != query_delete) {
-            if(c->op == match) {
-                for(int64_t j=0; j<c->length; j++) {
+    for(int64_t k=0; k<cigar_count(c); k++) {
+        CigarOp op = cigar_get_op(c, k);
+        int64_t length = cigar_get_length(c, k);
+        if(op != query_delete) {
+            if(op == match) {
+                for(int64_t j=0; j<length; j++) {
                     assert(i + j < paf->query_end && i + j >= 0 && i + j < paf->query_length);
                     assert(i + j < seq_count_array->length);
                     if(seq_count_array->counts[i + j] < INT16_MAX - 1) { // prevent overflow
@@ -547,13 +758,173 @@ void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *p
                     }
                 }
             }
-            i += c->length;
+            i += length;
         }
-        c = c->next;
     }
     assert(i == paf->query_end);
 }
 
+static int count_interval_cmp(const void *a, const void *b) {
+    int64_t i = ((CountInterval *)a)->start, j = ((CountInterval *)b)->start;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static CountInterval *count_interval_construct(int64_t start, int64_t end, int64_t count) {
+    CountInterval *interval = st_malloc(sizeof(CountInterval));
+    interval->start = start;
+    interval->end = end;
+    interval->count = count;
+    return interval;
+}
+
+SequenceCountIntervals *get_alignment_count_intervals(stHash *seq_names_to_alignment_count_intervals, Paf *paf) {
+    SequenceCountIntervals *seq_count_intervals = stHash_search(seq_names_to_alignment_count_intervals, paf->query_name);
+    if(seq_count_intervals == NULL) { // If the counts have not been initialized yet
+        seq_count_intervals = st_calloc(1, sizeof(SequenceCountIntervals));
+        seq_count_intervals->name = paf->query_name;
+        seq_count_intervals->length = paf->query_length;
+        seq_count_intervals->intervals = stSortedSet_construct3(count_interval_cmp, free);
+        if(paf->query_length > 0) { // A single interval with zero count covers the sequence
+            stSortedSet_insert(seq_count_intervals->intervals, count_interval_construct(0, paf->query_length, 0));
+        }
+        stHash_insert(seq_names_to_alignment_count_intervals, paf->query_name, seq_count_intervals); // adds to the hash
+    }
+    else {
+        assert(seq_count_intervals->length == paf->query_length); // Check the name is unique
+    }
+    return seq_count_intervals;
+}
+
+void sequence_count_intervals_destruct(SequenceCountIntervals *seq_count_intervals) {
+    stSortedSet_destruct(seq_count_intervals->intervals);
+    free(seq_count_intervals);
+}
+
+/*
+ * Splits the interval containing the given coordinate so that an interval starts at the coordinate, returning it.
+ */
+static CountInterval *split_count_intervals(stSortedSet *intervals, int64_t coordinate) {
+    CountInterval probe = { coordinate, coordinate, 0 };
+    CountInterval *interval = stSortedSet_searchLessThanOrEqual(intervals, &probe);
+    assert(interval != NULL && interval->start <= coordinate && coordinate < interval->end);
+    if(interval->start == coordinate) {
+        return interval;
+    }
+    CountInterval *interval2 = count_interval_construct(coordinate, interval->end, interval->count);
+    interval->end = coordinate;
+    stSortedSet_insert(intervals, interval2);
+    return interval2;
+}
+
+/*
+ * Merges the interval with the interval that follows it if they have the same count.
+ */
+static void merge_count_intervals(stSortedSet *intervals, CountInterval *interval) {
+    CountInterval probe = { interval->end, interval->end, 0 };
+    CountInterval *interval2 = stSortedSet_search(intervals, &probe);
+    if(interval2 != NULL && interval2->count == interval->count) {
+        interval->end = interval2->end;
+        stSortedSet_remove(intervals, interval2);
+        free(interval2);
+    }
+}
+
+/*
+ * Adds one to the counts of the bases in [start, end), adding the number of bases with each resulting count to the
+ * level_counts list, as pairs of count and length.
+ */
+static void increase_count_intervals(SequenceCountIntervals *seq_count_intervals, int64_t start, int64_t end,
+                                     stList *level_counts) {
+    assert(0 <= start && start < end && end <= seq_count_intervals->length);
+    stSortedSet *intervals = seq_count_intervals->intervals;
+    CountInterval *first = split_count_intervals(intervals, start);
+    if(end < seq_count_intervals->length) {
+        split_count_intervals(intervals, end);
+    }
+    stSortedSetIterator *it = stSortedSet_getIteratorFrom(intervals, first);
+    CountInterval *interval, *last = NULL;
+    while((interval = stSortedSet_getNext(it)) != NULL && interval->start < end) {
+        if(interval->count < INT16_MAX - 1) { // prevent overflow, as with the count arrays
+            interval->count++;
+        }
+        stList_append(level_counts, stIntTuple_construct2(interval->count, interval->end - interval->start));
+        last = interval;
+    }
+    stSortedSet_destructIterator(it);
+
+    // Merge the ends of the range with their neighbours, if they now have the same count, to keep the set small
+    merge_count_intervals(intervals, last);
+    CountInterval probe = { start - 1, start - 1, 0 };
+    CountInterval *previous = start > 0 ? stSortedSet_searchLessThanOrEqual(intervals, &probe) : NULL;
+    if(previous != NULL) {
+        merge_count_intervals(intervals, previous);
+    }
+}
+
+int64_t increase_alignment_level_counts_and_get_median(SequenceCountIntervals *seq_count_intervals, Paf *paf) {
+    // Increase the counts of each run of aligned bases, runs of matches separated only by query deletes
+    // being contiguous in the query
+    stList *level_counts = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    Cigar *c = paf->cigar;
+    int64_t i = paf->query_start, run_start = -1;
+    for(int64_t k=0; k<cigar_count(c); k++) {
+        CigarOp op = cigar_get_op(c, k);
+        int64_t length = cigar_get_length(c, k);
+        if(op == match) {
+            if(run_start == -1) {
+                run_start = i;
+            }
+            i += length;
+        }
+        else if(op == query_insert) {
+            if(run_start != -1 && run_start < i) {
+                increase_count_intervals(seq_count_intervals, run_start, i, level_counts);
+            }
+            run_start = -1;
+            i += length;
+        }
+    }
+    if(run_start != -1 && run_start < i) {
+        increase_count_intervals(seq_count_intervals, run_start, i, level_counts);
+    }
+    assert(i == paf->query_end);
+
+    // Calc the median from the (count, length) pairs
+    stList_sort(level_counts, (int (*)(const void *, const void *))stIntTuple_cmpFn);
+    int64_t matches = 0;
+    for(int64_t j=0; j<stList_length(level_counts); j++) {
+        matches += stIntTuple_get(stList_get(level_counts, j), 1);
+    }
+    int64_t median = INT16_MAX; // If there are no matches
+    int64_t j = 0;
+    for(int64_t k=0; k<stList_length(level_counts); k++) {
+        stIntTuple *level_count = stList_get(level_counts, k);
+        j += stIntTuple_get(level_count, 1);
+        if(j >= matches/2.0) {
+            median = stIntTuple_get(level_count, 0);
+            break;
+        }
+    }
+
+    // Print the alignment levels
+    if(st_getLogLevel() >= debug && matches > 0) {
+        st_logDebug("Got alignment levels: ");
+        for(int64_t k=0; k<stList_length(level_counts);) {
+            int64_t level = stIntTuple_get(stList_get(level_counts, k), 0), bases = 0;
+            for(; k<stList_length(level_counts) && stIntTuple_get(stList_get(level_counts, k), 0) == level; k++) {
+                bases += stIntTuple_get(stList_get(level_counts, k), 1);
+            }
+            st_logDebug("%" PRIi64 ":%f ", level, ((float)bases)/matches);
+        }
+        char *paf_string = paf_print(paf);
+        st_logDebug(" for paf: %s\n", paf_string);
+        free(paf_string);
+    }
+
+    stList_destruct(level_counts);
+    return median;
+}
+
 Interval *decode_fasta_header(char *fasta_header) {
     Interval *i = st_calloc(1, sizeof(Interval));
     stList *attributes = fastaDecodeHeader(fasta_header);
@@ -0,0 +1,416 @@
+#include "paf.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Reading and writing of binary paf files.
+ *
+ * File layout (all integers are in native byte order):
+ *
+ * header: char magic[8], uint64 version
+ * blocks: each block is
+ *      uint64 record_number (n), uint64 cigar_run_number (m)
+ *      int64 columns[PAF_BINARY_INT_COLUMNS][n] (query_length, query_start, ..., chain_id, see below)
+ *      uint64 cigar_offsets[n+1] (index of the first cigar run of each record in the block's cigar column)
+ *      uint32 query_names[n], uint32 target_names[n] (indexes into the name table), padded to 8 bytes
+ *      uint8 same_strand[n], uint8 type[n], padded to 8 bytes
+ *      uint32 cigar[m] (run length << 4 | op, as packed in memory by Cigar), padded to 8 bytes
+ * name table: the interned sequence names, each '\0' terminated
+ * footer: uint64 name_table_offset, uint64 name_number, uint64 block_number, uint64 record_number, char magic[8]
+ */
+
+#define PAF_BINARY_MAGIC "CPAFBIN1"
+#define PAF_BINARY_VERSION 1
+#define PAF_BINARY_BLOCK_SIZE 65536 // Max number of records in a block
+#define PAF_BINARY_INT_COLUMNS 12
+#define PAF_BINARY_HEADER_SIZE 16
+#define PAF_BINARY_FOOTER_SIZE 40
+
+static int64_t round_up_to_8(int64_t i) {
+    return (i + 7) & ~((int64_t)7);
+}
+
+/*
+ * Pointers to the int64 fields of a paf, in the order of the int64 columns.
+ */
+static void get_int_fields(Paf *paf, int64_t **fields) {
+    fields[0] = &paf->query_length;
+    fields[1] = &paf->query_start;
+    fields[2] = &paf->query_end;
+    fields[3] = &paf->target_length;
+    fields[4] = &paf->target_start;
+    fields[5] = &paf->target_end;
+    fields[6] = &paf->num_matches;
+    fields[7] = &paf->num_bases;
+    fields[8] = &paf->mapping_quality;
+    fields[9] = &paf->score;
+    fields[10] = &paf->tile_level;
+    fields[11] = &paf->chain_id;
+}
+
+/*
+ * Writer
+ */
+
+struct _pafBinaryWriter {
+    FILE *fh;
+    int64_t bytes_written; // Offset of the next byte to be written in the file
+    stHash *names_to_indexes; // Interned sequence names
+    stList *names; // Names in order of their index
+    int64_t record_number; // Records in the current block
+    int64_t *int_columns[PAF_BINARY_INT_COLUMNS];
+    uint64_t *cigar_offsets;
+    uint32_t *query_names, *target_names;
+    uint8_t *same_strands, *types;
+    uint32_t *cigar;
+    int64_t cigar_length, cigar_max_length;
+    int64_t total_block_number, total_record_number;
+};
+
+PafBinaryWriter *paf_binary_writer_construct(FILE *fh) {
+    PafBinaryWriter *writer = st_calloc(1, sizeof(PafBinaryWriter));
+    writer->fh = fh;
+    writer->names_to_indexes = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                 (void (*)(void *))stIntTuple_destruct);
+    writer->names = stList_construct();
+    for(int64_t i=0; i<PAF_BINARY_INT_COLUMNS; i++) {
+        writer->int_columns[i] = st_malloc(sizeof(int64_t) * PAF_BINARY_BLOCK_SIZE);
+    }
+    writer->cigar_offsets = st_malloc(sizeof(uint64_t) * (PAF_BINARY_BLOCK_SIZE + 1));
+    writer->query_names = st_malloc(sizeof(uint32_t) * PAF_BINARY_BLOCK_SIZE);
+    writer->target_names = st_malloc(sizeof(uint32_t) * PAF_BINARY_BLOCK_SIZE);
+    writer->same_strands = st_malloc(sizeof(uint8_t) * PAF_BINARY_BLOCK_SIZE);
+    writer->types = st_malloc(sizeof(uint8_t) * PAF_BINARY_BLOCK_SIZE);
+    writer->cigar_max_length = PAF_BINARY_BLOCK_SIZE;
+    writer->cigar = st_malloc(sizeof(uint32_t) * writer->cigar_max_length);
+
+    // Write the header
+    char header[PAF_BINARY_HEADER_SIZE];
+    memset(header, 0, PAF_BINARY_HEADER_SIZE);
+    memcpy(header, PAF_BINARY_MAGIC, 8);
+    uint64_t version = PAF_BINARY_VERSION;
+    memcpy(header+8, &version, sizeof(uint64_t));
+    if(fwrite(header, 1, PAF_BINARY_HEADER_SIZE, fh) != PAF_BINARY_HEADER_SIZE) {
+        st_errnoAbort("Failed to write binary paf header");
+    }
+    writer->bytes_written = PAF_BINARY_HEADER_SIZE;
+
+    return writer;
+}
+
+static void write_bytes(PafBinaryWriter *writer, const void *data, int64_t length) {
+    if(length > 0 && fwrite(data, 1, length, writer->fh) != (size_t)length) {
+        st_errnoAbort("Failed to write to binary paf file");
+    }
+    writer->bytes_written += length;
+}
+
+static void write_padding(PafBinaryWriter *writer) {
+    static const char zeros[8] = { 0 };
+    write_bytes(writer, zeros, round_up_to_8(writer->bytes_written) - writer->bytes_written);
+}
+
+static uint32_t get_name_index(PafBinaryWriter *writer, char *name) {
+    stIntTuple *i = stHash_search(writer->names_to_indexes, name);
+    if(i == NULL) {
+        if(stList_length(writer->names) >= UINT32_MAX) {
+            st_errAbort("Too many distinct sequence names for a binary paf file");
+        }
+        i = stIntTuple_construct1(stList_length(writer->names));
+        char *name_copy = stString_copy(name);
+        stHash_insert(writer->names_to_indexes, name_copy, i);
+        stList_append(writer->names, name_copy);
+    }
+    return stIntTuple_get(i, 0);
+}
+
+static void add_cigar_run(PafBinaryWriter *writer, uint32_t run) {
+    if(writer->cigar_length == writer->cigar_max_length) {
+        writer->cigar_max_length *= 2;
+        writer->cigar = st_realloc(writer->cigar, sizeof(uint32_t) * writer->cigar_max_length);
+    }
+    writer->cigar[writer->cigar_length++] = run;
+}
+
+static void flush_block(PafBinaryWriter *writer) {
+    if(writer->record_number == 0) {
+        return;
+    }
+    int64_t n = writer->record_number;
+    uint64_t block_header[2] = { n, writer->cigar_length };
+    write_bytes(writer, block_header, sizeof(block_header));
+    for(int64_t i=0; i<PAF_BINARY_INT_COLUMNS; i++) {
+        write_bytes(writer, writer->int_columns[i], sizeof(int64_t) * n);
+    }
+    writer->cigar_offsets[n] = writer->cigar_length;
+    write_bytes(writer, writer->cigar_offsets, sizeof(uint64_t) * (n + 1));
+    write_bytes(writer, writer->query_names, sizeof(uint32_t) * n);
+    write_bytes(writer, writer->target_names, sizeof(uint32_t) * n);
+    write_padding(writer);
+    write_bytes(writer, writer->same_strands, sizeof(uint8_t) * n);
+    write_bytes(writer, writer->types, sizeof(uint8_t) * n);
+    write_padding(writer);
+    write_bytes(writer, writer->cigar, sizeof(uint32_t) * writer->cigar_length);
+    write_padding(writer);
+
+    writer->total_block_number++;
+    writer->record_number = 0;
+    writer->cigar_length = 0;
+}
+
+void paf_binary_write(PafBinaryWriter *writer, Paf *paf) {
+    int64_t i = writer->record_number++;
+    int64_t *fields[PAF_BINARY_INT_COLUMNS];
+    get_int_fields(paf, fields);
+    for(int64_t j=0; j<PAF_BINARY_INT_COLUMNS; j++) {
+        writer->int_columns[j][i] = *fields[j];
+    }
+    writer->query_names[i] = get_name_index(writer, paf->query_name);
+    writer->target_names[i] = get_name_index(writer, paf->target_name);
+    writer->same_strands[i] = paf->same_strand;
+    writer->types[i] = paf->type;
+
+    // The cigar runs are already packed, so are copied verbatim
+    writer->cigar_offsets[i] = writer->cigar_length;
+    for(int64_t j=0; j<cigar_count(paf->cigar); j++) {
+        add_cigar_run(writer, paf->cigar->runs[j]);
+    }
+
+    writer->total_record_number++;
+    if(writer->record_number == PAF_BINARY_BLOCK_SIZE) {
+        flush_block(writer);
+    }
+}
+
+void paf_binary_writer_destruct(PafBinaryWriter *writer) {
+    flush_block(writer);
+
+    // Write the name table
+    uint64_t name_table_offset = writer->bytes_written;
+    for(int64_t i=0; i<stList_length(writer->names); i++) {
+        char *name = stList_get(writer->names, i);
+        write_bytes(writer, name, strlen(name) + 1);
+    }
+    write_padding(writer);
+
+    // Write the footer
+    uint64_t footer[4] = { name_table_offset, stList_length(writer->names), writer->total_block_number,
+                           writer->total_record_number };
+    write_bytes(writer, footer, sizeof(footer));
+    write_bytes(writer, PAF_BINARY_MAGIC, 8);
+
+    // Cleanup
+    for(int64_t i=0; i<PAF_BINARY_INT_COLUMNS; i++) {
+        free(writer->int_columns[i]);
+    }
+    free(writer->cigar_offsets);
+    free(writer->query_names);
+    free(writer->target_names);
+    free(writer->same_strands);
+    free(writer->types);
+    free(writer->cigar);
+    stList_destruct(writer->names);
+    stHash_destruct(writer->names_to_indexes); // Frees the names
+    free(writer);
+}
+
+/*
+ * Reader
+ */
+
+struct _pafBinaryReader {
+    char *data; // The mmap'd file
+    int64_t data_length;
+    char **names; // Pointers into the name table of the mapped file
+    int64_t name_number, block_number, record_number;
+    int64_t next_block_offset; // Offset of the block following the current block
+    int64_t block_index; // Number of blocks loaded so far
+    // The columns of the current block
+    int64_t block_record_number, block_record_index;
+    const int64_t *int_columns[PAF_BINARY_INT_COLUMNS];
+    const uint64_t *cigar_offsets;
+    const uint32_t *query_names, *target_names;
+    const uint8_t *same_strands, *types;
+    const uint32_t *cigar;
+    Paf paf; // The paf handed out, reused for each record
+    Cigar *paf_cigar; // The cigar of the paf, reused for each record
+};
+
+bool paf_binary_is_binary_file(const char *file) {
+    FILE *fh = fopen(file, "r");
+    if(fh == NULL) {
+        return 0;
+    }
+    char magic[8];
+    bool is_binary = fread(magic, 1, 8, fh) == 8 && memcmp(magic, PAF_BINARY_MAGIC, 8) == 0;
+    fclose(fh);
+    return is_binary;
+}
+
+PafBinaryReader *paf_binary_reader_construct(const char *file) {
+    int fd = open(file, O_RDONLY);
+    if(fd == -1) {
+        st_errnoAbort("Could not open binary paf file: %s", file);
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) != 0) {
+        st_errnoAbort("Could not stat binary paf file: %s", file);
+    }
+    if(file_stat.st_size < PAF_BINARY_HEADER_SIZE + PAF_BINARY_FOOTER_SIZE) {
+        st_errAbort("Binary paf file is truncated: %s", file);
+    }
+
+    PafBinaryReader *reader = st_calloc(1, sizeof(PafBinaryReader));
+    reader->data_length = file_stat.st_size;
+    reader->data = mmap(NULL, reader->data_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(reader->data == MAP_FAILED) {
+        st_errnoAbort("Could not mmap binary paf file: %s", file);
+    }
+    close(fd); // The mapping remains valid after the file descriptor is closed
+    madvise(reader->data, reader->data_length, MADV_SEQUENTIAL);
+
+    // Check the header and footer
+    char *footer = reader->data + reader->data_length - PAF_BINARY_FOOTER_SIZE;
+    if(memcmp(reader->data, PAF_BINARY_MAGIC, 8) != 0 || memcmp(footer + 32, PAF_BINARY_MAGIC, 8) != 0) {
+        st_errAbort("File is not a (complete) binary paf file: %s", file);
+    }
+    uint64_t f[4];
+    memcpy(f, footer, sizeof(f));
+    // Every name takes at least a byte of the name table, and every block at least its header
+    int64_t name_table_length = (footer - reader->data) - (int64_t)f[0];
+    if(f[0] < PAF_BINARY_HEADER_SIZE || f[0] > (uint64_t)(footer - reader->data) ||
+       f[1] > (uint64_t)name_table_length || f[2] > (f[0] - PAF_BINARY_HEADER_SIZE) / 16 ||
+       f[3] > f[2] * PAF_BINARY_BLOCK_SIZE) {
+        st_errAbort("Binary paf file has a corrupt footer: %s", file);
+    }
+    int64_t name_table_offset = f[0];
+    reader->name_number = f[1];
+    reader->block_number = f[2];
+    reader->record_number = f[3];
+
+    // Build the name index, the names are used in place in the mapped file
+    reader->names = st_malloc(sizeof(char *) * (reader->name_number > 0 ? reader->name_number : 1));
+    char *c = reader->data + name_table_offset;
+    for(int64_t i=0; i<reader->name_number; i++) {
+        reader->names[i] = c;
+        char *end = memchr(c, '\0', footer - c);
+        if(end == NULL) {
+            st_errAbort("Binary paf name table is corrupt: %s", file);
+        }
+        c = end + 1;
+    }
+    reader->paf_cigar = cigar_construct(1024);
+
+    paf_binary_reader_reset(reader);
+    return reader;
+}
+
+void paf_binary_reader_reset(PafBinaryReader *reader) {
+    reader->next_block_offset = PAF_BINARY_HEADER_SIZE;
+    reader->block_index = 0;
+    reader->block_record_number = 0;
+    reader->block_record_index = 0;
+}
+
+int64_t paf_binary_reader_get_record_number(PafBinaryReader *reader) {
+    return reader->record_number;
+}
+
+/*
+ * Set the column pointers to the next block in the file. Returns zero if no more blocks.
+ */
+static bool load_next_block(PafBinaryReader *reader) {
+    if(reader->block_index == reader->block_number) {
+        return 0;
+    }
+    char *c = reader->data + reader->next_block_offset;
+    if(reader->data_length - PAF_BINARY_FOOTER_SIZE - reader->next_block_offset < 16) {
+        st_errAbort("Binary paf file is corrupt, block %" PRIi64 " starts past the end of the file", reader->block_index);
+    }
+    uint64_t block_header[2];
+    memcpy(block_header, c, sizeof(block_header));
+    // Check the sizes before computing the column pointers, so they can not overflow
+    if(block_header[0] > PAF_BINARY_BLOCK_SIZE ||
+       block_header[1] > (uint64_t)(reader->data_length - reader->next_block_offset) / sizeof(uint32_t)) {
+        st_errAbort("Binary paf file is corrupt, block %" PRIi64 " has an invalid size", reader->block_index);
+    }
+    int64_t n = block_header[0], m = block_header[1];
+    c += sizeof(block_header);
+    for(int64_t i=0; i<PAF_BINARY_INT_COLUMNS; i++) {
+        reader->int_columns[i] = (const int64_t *)c;
+        c += sizeof(int64_t) * n;
+    }
+    reader->cigar_offsets = (const uint64_t *)c;
+    c += sizeof(uint64_t) * (n + 1);
+    reader->query_names = (const uint32_t *)c;
+    c += sizeof(uint32_t) * n;
+    reader->target_names = (const uint32_t *)c;
+    c += round_up_to_8(sizeof(uint32_t) * 2 * n) - sizeof(uint32_t) * n;
+    reader->same_strands = (const uint8_t *)c;
+    c += n;
+    reader->types = (const uint8_t *)c;
+    c += round_up_to_8(2 * n) - n;
+    reader->cigar = (const uint32_t *)c;
+    c += round_up_to_8(sizeof(uint32_t) * m);
+    if(c > reader->data + reader->data_length - PAF_BINARY_FOOTER_SIZE || reader->cigar_offsets[n] != (uint64_t)m) {
+        st_errAbort("Binary paf file is corrupt, block %" PRIi64 " extends past the end of the file", reader->block_index);
+    }
+
+    reader->next_block_offset = c - reader->data;
+    reader->block_index++;
+    reader->block_record_number = n;
+    reader->block_record_index = 0;
+    return 1;
+}
+
+Paf *paf_binary_read(PafBinaryReader *reader) {
+    while(reader->block_record_index == reader->block_record_number) {
+        if(!load_next_block(reader)) {
+            return NULL;
+        }
+    }
+    int64_t i = reader->block_record_index++;
+
+    Paf *paf = &(reader->paf);
+    memset(paf, 0, sizeof(Paf));
+    int64_t *fields[PAF_BINARY_INT_COLUMNS];
+    get_int_fields(paf, fields);
+    for(int64_t j=0; j<PAF_BINARY_INT_COLUMNS; j++) {
+        *fields[j] = reader->int_columns[j][i];
+    }
+    if(reader->query_names[i] >= reader->name_number || reader->target_names[i] >= reader->name_number) {
+        st_errAbort("Binary paf file is corrupt, a record has an unknown sequence name");
+    }
+    paf->query_name = reader->names[reader->query_names[i]]; // Borrowed from the mapped file
+    paf->target_name = reader->names[reader->target_names[i]];
+    paf->same_strand = reader->same_strands[i];
+    paf->type = reader->types[i];
+
+    // Copy the cigar runs into the reused cigar, as the mapping is read-only
+    uint64_t cigar_start = reader->cigar_offsets[i], cigar_end = reader->cigar_offsets[i+1];
+    if(cigar_start > cigar_end || cigar_end > reader->cigar_offsets[reader->block_record_number]) {
+        st_errAbort("Binary paf file is corrupt, a record has an invalid cigar");
+    }
+    int64_t cigar_length = cigar_end - cigar_start;
+    if(cigar_length > 0) {
+        Cigar *cigar = reader->paf_cigar;
+        if(cigar_length > cigar->max_length) {
+            cigar->max_length = cigar_length * 2;
+            cigar->runs = st_realloc(cigar->runs, sizeof(uint32_t) * cigar->max_length);
+        }
+        memcpy(cigar->runs, reader->cigar + cigar_start, sizeof(uint32_t) * cigar_length);
+        cigar->length = cigar_length;
+        paf->cigar = cigar;
+    }
+
+    return paf;
+}
+
+void paf_binary_reader_destruct(PafBinaryReader *reader) {
+    munmap(reader->data, reader->data_length);
+    free(reader->names);
+    cigar_destruct(reader->paf_cigar);
+    free(reader);
+}
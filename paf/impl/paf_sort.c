@@ -0,0 +1,170 @@
+#include "paf.h"
+
+/*
+ * External sorting of paf files by descending score.
+ *
+ * The input is read in runs that fit in the memory budget, each run is sorted and written as a binary paf file next to
+ * the output file, and the runs are then merged with a heap into the output file. Pafs with equal scores are kept in
+ * the order of the input, so the output does not depend on the memory budget.
+ */
+
+typedef struct _sortRecord {
+    Paf *paf;
+    int64_t index; // Position of the paf in the input (or of its run, when merging)
+} SortRecord;
+
+static int sort_record_cmp(const void *a, const void *b) {
+    const SortRecord *r1 = a, *r2 = b;
+    if(r1->paf->score != r2->paf->score) {
+        return r1->paf->score > r2->paf->score ? -1 : 1; // Descending score
+    }
+    return r1->index < r2->index ? -1 : (r1->index > r2->index ? 1 : 0);
+}
+
+/*
+ * Copies a paf, including its cigar. The names are not copied.
+ */
+static Paf *paf_copy(Paf *paf) {
+    Paf *paf2 = st_malloc(sizeof(Paf));
+    *paf2 = *paf;
+    if(paf->cigar != NULL) {
+        paf2->cigar = cigar_construct(cigar_count(paf->cigar));
+        memcpy(paf2->cigar->runs, paf->cigar->runs, sizeof(uint32_t) * cigar_count(paf->cigar));
+        paf2->cigar->length = cigar_count(paf->cigar);
+    }
+    return paf2;
+}
+
+static int64_t paf_memory(Paf *paf) {
+    return sizeof(Paf) + sizeof(SortRecord) + (paf->cigar == NULL ? 0 : sizeof(Cigar) + sizeof(uint32_t) * cigar_count(paf->cigar));
+}
+
+/*
+ * Sorts the records and writes them as binary pafs to the given file, then cleans them up.
+ */
+static void write_run(SortRecord *records, int64_t record_number, const char *file) {
+    qsort(records, record_number, sizeof(SortRecord), sort_record_cmp);
+    FILE *fh = fopen(file, "w");
+    if(fh == NULL) {
+        st_errAbort("Could not open file to write sorted pafs to: %s\n", file);
+    }
+    PafBinaryWriter *writer = paf_binary_writer_construct(fh);
+    for(int64_t i=0; i<record_number; i++) {
+        paf_binary_write(writer, records[i].paf);
+        paf_destruct(records[i].paf);
+    }
+    paf_binary_writer_destruct(writer);
+    fclose(fh);
+}
+
+/*
+ * Restores the heap property for the subtree rooted at i.
+ */
+static void sift_down(SortRecord *heap, int64_t heap_size, int64_t i) {
+    while(1) {
+        int64_t j = i, l = 2*i + 1, r = 2*i + 2;
+        if(l < heap_size && sort_record_cmp(&heap[l], &heap[j]) < 0) {
+            j = l;
+        }
+        if(r < heap_size && sort_record_cmp(&heap[r], &heap[j]) < 0) {
+            j = r;
+        }
+        if(j == i) {
+            return;
+        }
+        SortRecord k = heap[i];
+        heap[i] = heap[j];
+        heap[j] = k;
+        i = j;
+    }
+}
+
+/*
+ * Merges the sorted runs into the output file, using a heap holding the next paf of each run. Each paf is the
+ * record reused by the reader of its run, so is valid until the next paf is read from that run.
+ */
+static void merge_runs(stList *run_files, const char *output_file) {
+    int64_t run_number = stList_length(run_files);
+    PafBinaryReader **readers = st_malloc(sizeof(PafBinaryReader *) * run_number);
+    SortRecord *heap = st_malloc(sizeof(SortRecord) * run_number);
+    int64_t heap_size = 0;
+    for(int64_t i=0; i<run_number; i++) {
+        readers[i] = paf_binary_reader_construct(stList_get(run_files, i));
+        Paf *paf = paf_binary_read(readers[i]);
+        if(paf != NULL) {
+            heap[heap_size].paf = paf;
+            heap[heap_size++].index = i; // Ties are broken by run, which keeps the input order as runs are in input order
+        }
+    }
+    for(int64_t i=heap_size/2-1; i>=0; i--) {
+        sift_down(heap, heap_size, i);
+    }
+
+    FILE *fh = fopen(output_file, "w");
+    if(fh == NULL) {
+        st_errAbort("Could not open file to write sorted pafs to: %s\n", output_file);
+    }
+    PafBinaryWriter *writer = paf_binary_writer_construct(fh);
+    while(heap_size > 0) {
+        paf_binary_write(writer, heap[0].paf);
+        Paf *paf = paf_binary_read(readers[heap[0].index]);
+        if(paf != NULL) { // Replace with the next paf from the same run
+            heap[0].paf = paf;
+        }
+        else { // Run is exhausted
+            heap[0] = heap[--heap_size];
+        }
+        sift_down(heap, heap_size, 0);
+    }
+    paf_binary_writer_destruct(writer);
+    fclose(fh);
+
+    for(int64_t i=0; i<run_number; i++) {
+        paf_binary_reader_destruct(readers[i]);
+    }
+    free(readers);
+    free(heap);
+}
+
+void paf_sort_file_by_descending_score(const char *input_file, const char *output_file, int64_t max_memory) {
+    PafReader *reader = paf_reader_open(input_file);
+    int64_t max_record_number = 1024, record_number = 0, memory = 0, index = 0;
+    SortRecord *records = st_malloc(sizeof(SortRecord) * max_record_number);
+    stList *run_files = stList_construct3(0, free);
+
+    Paf *paf;
+    while((paf = paf_reader_next(reader)) != NULL) {
+        if(record_number > 0 && memory + paf_memory(paf) > max_memory) { // Over budget, so write out a run
+            char *run_file = stString_print("%s.run_%" PRIi64 "", output_file, stList_length(run_files));
+            write_run(records, record_number, run_file);
+            stList_append(run_files, run_file);
+            record_number = 0;
+            memory = 0;
+        }
+        if(record_number == max_record_number) {
+            max_record_number *= 2;
+            records = st_realloc(records, sizeof(SortRecord) * max_record_number);
+        }
+        records[record_number].paf = paf_copy(paf); // Names point into the reader's name table
+        records[record_number++].index = index++;
+        memory += paf_memory(paf);
+    }
+
+    if(stList_length(run_files) == 0) { // Everything fitted in memory, so no merge is needed
+        write_run(records, record_number, output_file);
+    }
+    else {
+        char *run_file = stString_print("%s.run_%" PRIi64 "", output_file, stList_length(run_files));
+        write_run(records, record_number, run_file);
+        stList_append(run_files, run_file);
+        st_logDebug("Merging %" PRIi64 " sorted runs of pafs\n", stList_length(run_files));
+        merge_runs(run_files, output_file);
+        for(int64_t i=0; i<stList_length(run_files); i++) {
+            remove(stList_get(run_files, i));
+        }
+    }
+
+    free(records);
+    stList_destruct(run_files);
+    paf_reader_destruct(reader); // The names are no longer needed
+}
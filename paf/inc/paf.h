@@ -55,12 +55,61 @@ typedef enum _cigarOp {
     query_delete = 2 // substring in the target and not the query
 } CigarOp;
 
-typedef struct _cigar Cigar;
-struct _cigar {
-    CigarOp op;
-    int64_t length;
-    Cigar *next;
-};
+/*
+ * A cigar is a contiguous array of runs, each run packed with its op into a single 32-bit word
+ * (length << 4 | op), as in BAM. Runs longer than CIGAR_MAX_RUN_LENGTH are split into consecutive runs of
+ * the same op.
+ */
+typedef struct _cigar {
+    int64_t length; // The number of runs
+    int64_t max_length; // The number of runs allocated
+    uint32_t *runs;
+} Cigar;
+
+#define CIGAR_MAX_RUN_LENGTH 0xFFFFFFF
+
+/*
+ * Create an empty cigar, with space for the given number of runs.
+ */
+Cigar *cigar_construct(int64_t max_length);
+
+/*
+ * Cleanup the cigar.
+ */
+void cigar_destruct(Cigar *cigar);
+
+/*
+ * Add a run to the end of the cigar.
+ */
+void cigar_append(Cigar *cigar, CigarOp op, int64_t length);
+
+/*
+ * Gets the number of runs in the cigar, which may be NULL.
+ */
+static inline int64_t cigar_count(Cigar *cigar) {
+    return cigar == NULL ? 0 : cigar->length;
+}
+
+/*
+ * Gets the op of the ith run of the cigar.
+ */
+static inline CigarOp cigar_get_op(Cigar *cigar, int64_t i) {
+    return (CigarOp)(cigar->runs[i] & 0xF);
+}
+
+/*
+ * Gets the length of the ith run of the cigar.
+ */
+static inline int64_t cigar_get_length(Cigar *cigar, int64_t i) {
+    return cigar->runs[i] >> 4;
+}
+
+/*
+ * Sets the op and length of the ith run of the cigar.
+ */
+static inline void cigar_set(Cigar *cigar, int64_t i, CigarOp op, int64_t length) {
+    cigar->runs[i] = ((uint32_t)length << 4) | op;
+}
 
 typedef struct _paf {
     char *query_name;
@@ -72,7 +121,7 @@ typedef struct _paf {
     int64_t target_start; // Zero-based
     int64_t target_end; // Zero-based
     bool same_strand; // If 0 then query substring is reverse complement with respect to the target
-    Cigar *cigar; // Ordered by the target sequence
+    Cigar *cigar; // Ordered by the target sequence, NULL if the paf has no cigar
     int64_t score; // the dp alignment score
     int64_t mapping_quality;
     int64_t num_matches;
@@ -98,6 +147,43 @@ Paf *paf_parse(char *paf_string);
  */
 Paf *paf_read(FILE *fh);
 
+/*
+ * A reader for streaming through a paf file. Lines are tokenized in place in a buffer owned by the reader,
+ * and the reader hands out a single paf record (and its cigar) that is reused for each line, so reading
+ * a record does not allocate memory. The name fields of the records point into a table of interned names
+ * owned by the reader, or, for binary files, into the name table of the mapped file.
+ */
+typedef struct _pafReader PafReader;
+
+/*
+ * Create a reader for the text paf alignments in the given file handle. The file handle is not closed by the reader.
+ */
+PafReader *paf_reader_construct(FILE *fh);
+
+/*
+ * Create a reader for the paf alignments in the given file, which may be a text or binary paf file.
+ * If file is NULL reads text pafs from stdin.
+ */
+PafReader *paf_reader_open(const char *file);
+
+/*
+ * Read the next paf record. Returns NULL if no record available. The returned paf belongs to the reader and is
+ * only valid until the next call, it must not be passed to paf_destruct, or have its cigar freed.
+ * The names of the paf are valid until the reader is destructed.
+ */
+Paf *paf_reader_next(PafReader *reader);
+
+/*
+ * Return to the start of the file. A compressed file opened by paf_reader_open is opened again, unless nothing has
+ * been read from it yet; other files that can not seek, such as stdin, can only be reset before anything is read.
+ */
+void paf_reader_reset(PafReader *reader);
+
+/*
+ * Cleanup the reader, closing any file it opened.
+ */
+void paf_reader_destruct(PafReader *reader);
+
 /*
  * Prints a paf record
  */
@@ -134,10 +220,78 @@ stList *read_pafs(FILE *paf_file);
 void write_pafs(FILE *paf_file, stList *pafs);
 
 /*
- * Chain a set of pafs into larger alignments
+ * Binary paf format. This is a compact, columnar alternative to the text format, intended for passing alignments
+ * between the different tools without re-tokenizing them. Records are written in blocks, within each block the
+ * coordinates are stored as fixed width columns, the sequence names as indexes into a table of interned names
+ * (stored once at the end of the file) and the cigars as a single column of run-length encoded 32-bit words.
+ * Binary files are read by mmap'ing them.
+ */
+typedef struct _pafBinaryWriter PafBinaryWriter;
+typedef struct _pafBinaryReader PafBinaryReader;
+
+/*
+ * Create a writer that writes binary pafs to the given file handle. The file handle must be at the start of
+ * the file (or stream) being written.
+ */
+PafBinaryWriter *paf_binary_writer_construct(FILE *fh);
+
+/*
+ * Add a paf to the binary file.
+ */
+void paf_binary_write(PafBinaryWriter *writer, Paf *paf);
+
+/*
+ * Flush any buffered pafs, write the name table and cleanup the writer. Does not close the file handle.
+ */
+void paf_binary_writer_destruct(PafBinaryWriter *writer);
+
+/*
+ * Returns non-zero if the given file exists and is a binary paf file.
+ */
+bool paf_binary_is_binary_file(const char *file);
+
+/*
+ * Open (mmap) a binary paf file for reading. Error aborts if the file is truncated or its footer is corrupt.
+ */
+PafBinaryReader *paf_binary_reader_construct(const char *file);
+
+/*
+ * Read the next paf from a binary paf file. Returns NULL if no record available. As for paf_reader_next, the
+ * returned paf belongs to the reader and is only valid until the next call: its names point into the mapped
+ * file, and are valid until the reader is destructed, and its cigar is reused, so reading a record does not
+ * allocate memory.
+ */
+Paf *paf_binary_read(PafBinaryReader *reader);
+
+/*
+ * Return the reader to the first record of the file.
+ */
+void paf_binary_reader_reset(PafBinaryReader *reader);
+
+/*
+ * Gets the total number of pafs in the binary file.
+ */
+int64_t paf_binary_reader_get_record_number(PafBinaryReader *reader);
+
+/*
+ * Unmap the file and cleanup the reader.
+ */
+void paf_binary_reader_destruct(PafBinaryReader *reader);
+
+/*
+ * Sorts the pafs in the input file (text or binary) by descending score, writing them to the output file as a binary
+ * paf file. Pafs with equal scores keep their input order. At most about max_memory bytes of pafs are held in memory,
+ * larger inputs are sorted by writing sorted runs to temporary files (named by appending a suffix to the
+ * output file) which are then merged.
+ */
+void paf_sort_file_by_descending_score(const char *input_file, const char *output_file, int64_t max_memory);
+
+/*
+ * Chain a set of pafs into larger alignments. Uses the given number of threads, the output does not depend
+ * on the number of threads.
  */
 stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
-                  int64_t max_gap_length, float percentage_to_trim);
+                  int64_t max_gap_length, float percentage_to_trim, int64_t threads);
 
 /*
  * Gets the number of aligned bases in the alignment between the query
@@ -186,6 +340,43 @@ SequenceCountArray *get_alignment_count_array(stHash *seq_names_to_alignment_cou
  */
 void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *paf);
 
+/*
+ * A run of bases with the same alignment count.
+ */
+typedef struct _countInterval {
+    int64_t start, end; // Zero-based, end is exclusive
+    int64_t count; // Number of alignments to each base of the interval
+} CountInterval;
+
+/*
+ * Structure used to represent alignment coverage along a sequence as a set of intervals, each covering a run of
+ * bases with the same count, so its size is proportional to the number of alignment boundaries rather than the
+ * length of the sequence.
+ */
+typedef struct _sequenceCountIntervals {
+    char *name; // Sequence name
+    int64_t length; // Sequence length
+    stSortedSet *intervals; // Disjoint CountIntervals covering the sequence, sorted by start coordinate
+} SequenceCountIntervals;
+
+/*
+ * Get the count intervals for the query sequence of a paf record, creating them if they don't exist.
+ * The hash should be constructed with sequence_count_intervals_destruct as its value destructor.
+ */
+SequenceCountIntervals *get_alignment_count_intervals(stHash *seq_names_to_alignment_count_intervals, Paf *paf);
+
+/*
+ * Cleanup the count intervals.
+ */
+void sequence_count_intervals_destruct(SequenceCountIntervals *seq_count_intervals);
+
+/*
+ * Increase the count of alignment coverages for the query bases covered by a paf record, as
+ * increase_alignment_level_counts, returning the median count of the aligned bases after the increase, or INT16_MAX
+ * if the paf has no aligned bases.
+ */
+int64_t increase_alignment_level_counts_and_get_median(SequenceCountIntervals *seq_count_intervals, Paf *paf);
+
 typedef struct _interval {
     char *name;
     int64_t start, end, length;
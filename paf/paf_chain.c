@@ -12,6 +12,7 @@
 
 #include "paf.h"
 #include "inc/paf.h"
+#include "cactusFile.h"
 #include <getopt.h>
 #include <time.h>
 
@@ -19,6 +20,7 @@ static int64_t max_gap_length = 10000;
 static float percentage_to_trim = 0.02;
 static int64_t chain_gap_open = 5000;
 static int64_t chain_gap_extend = 1;
+static int64_t threads = 1;
 
 void usage() {
     fprintf(stderr, "paf_chain [options], version 0.1\n");
@@ -30,6 +32,7 @@ void usage() {
     fprintf(stderr, "-e --chainGapExtend [INT] : The cost of extending a chain gap (default:%" PRIi64 "bp)\n", chain_gap_extend);
     fprintf(stderr, "-t --trimFraction : Fraction (from 0 to 1) of aligned bases to discount from the ends of the alignments when chaining"
                     "to trim from each end of the alignment when chaining, allowing slightly overlapping alignments to be chained (default:%f)\n", percentage_to_trim);
+    fprintf(stderr, "-T --threads [INT] : Number of threads to chain with, the output is the same for any number of threads (default:%" PRIi64 ")\n", threads);
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -67,11 +70,12 @@ int main(int argc, char *argv[]) {
                                                 { "trimFraction", required_argument, 0, 't' },
                                                 { "chainGapOpen", required_argument, 0, 'd' },
                                                 { "chainGapExtend", required_argument, 0, 'e' },
+                                                { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:hg:t:d:e:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:hg:t:d:e:T:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -98,6 +102,12 @@ int main(int argc, char *argv[]) {
             case 'e':
                 chain_gap_extend = atoi(optarg);
                 break;
+            case 'T':
+                threads = atoi(optarg);
+                if(threads < 1) {
+                    st_errAbort("Invalid number of threads: %s\n", optarg);
+                }
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -118,16 +128,17 @@ int main(int argc, char *argv[]) {
     st_logInfo("Maximum gap length : %" PRIi64 "\n", max_gap_length);
     st_logInfo("Chain gap open : %" PRIi64 "\n", chain_gap_open);
     st_logInfo("Chain gap extend : %" PRIi64 "\n", chain_gap_extend);
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
 
     //////////////////////////////////////////////
     // Tile the paf records
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    FILE *input = inputFile == NULL ? stdin : cactusFile_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
     stList *pafs = read_pafs(input); // Load local alignments files (PAF)
-    stList *chained_pafs = paf_chain(pafs, gap_cost, NULL, max_gap_length, percentage_to_trim); // Convert to set of chains
+    stList *chained_pafs = paf_chain(pafs, gap_cost, NULL, max_gap_length, percentage_to_trim, threads); // Convert to set of chains
 
     // Output chained alignments file
     write_pafs(output, chained_pafs);
@@ -10,6 +10,7 @@
 #include <time.h>
 #include "bioioC.h"
 #include "sonLib.h"
+#include "cactusFile.h"
 
  void usage() {
      fprintf(stderr, "paf_dechunk [options], version 0.1\n");
@@ -104,7 +105,7 @@ int main(int argc, char *argv[]) {
      // De-chunk the paf
      //////////////////////////////////////////////
 
-     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+     FILE *input = inputFile == NULL ? stdin : cactusFile_open(inputFile);
      FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
      Paf *paf;
@@ -14,6 +14,7 @@
 #include <getopt.h>
 #include <time.h>
 #include "bioioC.h"
+#include "cactusFile.h"
 
 void usage() {
     fprintf(stderr, "paf_dedupe [options], version 0.1\n");
@@ -109,7 +110,7 @@ int main(int argc, char *argv[]) {
     // Remove duplicate paf records
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    FILE *input = inputFile == NULL ? stdin : cactusFile_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
     stHash *pafs = stHash_construct3(paf_hash_key, paf_equal_key, NULL, (void (*)(void *))paf_destruct);
     Paf *paf;
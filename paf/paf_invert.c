@@ -11,7 +11,7 @@
  void usage() {
      fprintf(stderr, "paf_invert [options], version 0.1\n");
      fprintf(stderr, "Inverts the query and target in a PAF file\n");
-     fprintf(stderr, "-i --inputFile : Input paf file to invert. If not specified reads from stdin\n");
+     fprintf(stderr, "-i --inputFile : Input paf file (text or binary) to invert. If not specified reads (text paf) from stdin\n");
      fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
      fprintf(stderr, "-l --logLevel : Set the log level\n");
      fprintf(stderr, "-h --help : Print this help message\n");
@@ -75,24 +75,21 @@
      // Invert the paf
      //////////////////////////////////////////////
 
-     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+     PafReader *input = paf_reader_open(inputFile);
      FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
      Paf *paf;
-     while((paf = paf_read(input)) != NULL) {
+     while((paf = paf_reader_next(input)) != NULL) {
          paf_invert(paf); // the invert routine
          paf_check(paf);
          paf_write(paf, output);
-         paf_destruct(paf);
      }
 
      //////////////////////////////////////////////
      // Cleanup
      //////////////////////////////////////////////
 
-     if(inputFile != NULL) {
-         fclose(input);
-     }
+     paf_reader_destruct(input);
      if(outputFile != NULL) {
          fclose(output);
      }
@@ -16,7 +16,7 @@
 void usage() {
     fprintf(stderr, "paf_shatter [options], version 0.1\n");
     fprintf(stderr, "Break up paf alignments into individual matches\n");
-    fprintf(stderr, "-i --inputFile : Input paf file to invert. If not specified reads from stdin\n");
+    fprintf(stderr, "-i --inputFile : Input paf file (text or binary) to shatter. If not specified reads (text paf) from stdin\n");
     fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
@@ -80,26 +80,23 @@ int main(int argc, char *argv[]) {
     // Shatter the paf records
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    PafReader *input = paf_reader_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
     Paf *paf;
-    while((paf = paf_read(input)) != NULL) {
+    while((paf = paf_reader_next(input)) != NULL) {
         stList *matches = paf_shatter(paf);
         for(int64_t i=0; i<stList_length(matches); i++) {
             paf_write(stList_get(matches, i), output);
         }
         stList_destruct(matches);
-        paf_destruct(paf);
     }
 
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
-    if(inputFile != NULL) {
-        fclose(input);
-    }
+    paf_reader_destruct(input);
     if(outputFile != NULL) {
         fclose(output);
     }
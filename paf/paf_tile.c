@@ -14,6 +14,7 @@
 
 #include "paf.h"
 #include "inc/paf.h"
+#include "cactusFile.h"
 #include <getopt.h>
 #include <time.h>
 
@@ -31,63 +32,6 @@ int paf_cmp_by_descending_score(const void *a, const void *b) {
     return p1->score > p2->score ? -1 : (p1->score < p2->score ? 1 : 0);
 }
 
-int64_t get_median_alignment_level(uint16_t *counts, Paf *paf) {
-    Cigar *c = paf->cigar;
-    int64_t i = paf->query_start, max_level=0, matches=0;
-    int64_t *level_counts = st_calloc(UINT16_MAX, sizeof(int64_t)); // An array of counts of the number of bases with the given alignment level
-    // such that level_counts[i] is the number of bases in the query with level_counts[i] number of alignments to it (at this point in the tiling)
-    while(c != NULL) {
-        if(c->op != query_delete) {
-            if(c->op == match) {
-                for(int64_t j=0; j<c->length; j++) {
-                    assert(i + j < paf->query_end && i + j >= 0 && i + j < paf->query_length);
-                    assert(counts[i + j] < UINT16_MAX); // paranoid check
-                    level_counts[counts[i + j]]++;
-                    matches++;
-                    if(counts[i + j] > max_level) {
-                        max_level = counts[i + j];
-                    }
-                }
-            }
-            i += c->length;
-        }
-        c = c->next;
-    }
-    assert(i == paf->query_end);
-
-    if(matches == 0) { // avoid divide by zero
-        free(level_counts);
-        return INT16_MAX;
-    }
-
-    // Print the alignment levels
-    if(st_getLogLevel() >= debug) {
-        st_logDebug("Got alignment levels: ");
-        for (i = 0; i <= max_level; i++) {
-            st_logDebug("%"
-            PRIi64
-            ":%f ", i, ((float)level_counts[i])/matches);
-        }
-        char *paf_string = paf_print(paf);
-        st_logDebug(" for paf: %s\n", paf_string);
-        free(paf_string);
-    }
-
-    // Calc the median from the level_counts array
-    int64_t j=0;
-    for(i=0; i<=max_level; i++) {
-        j += level_counts[i];
-        if(j >= matches/2.0) {
-            free(level_counts);
-            assert(i > 0);
-            return i;
-        }
-    }
-    assert(0); // This should be unreachable.
-    free(level_counts);
-    return INT16_MAX;
-}
-
 int main(int argc, char *argv[]) {
     time_t startTime = time(NULL);
 
@@ -146,21 +90,22 @@ int main(int argc, char *argv[]) {
     // Tile the paf records
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    FILE *input = inputFile == NULL ? stdin : cactusFile_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
     stList *pafs = read_pafs(input); // Load local alignments files (PAF)
     stList_sort(pafs, paf_cmp_by_descending_score); // Sort alignments by score, from best-to-worst
 
-    // Create integer array representing counts of alignments to bases in the genome, setting values initially to 0.
-    stHash *seq_names_to_alignment_count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, free);
+    // Create sets of intervals representing counts of alignments to bases in the genome, setting values initially to 0.
+    stHash *seq_names_to_alignment_count_intervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                                                       (void (*)(void *))sequence_count_intervals_destruct);
 
-    // For each alignment: set the "level" of the alignment to q+1, increase by one the aligned bases count of each base covered by the alignment.
+    // For each alignment: increase by one the aligned bases count of each base covered by the alignment, and set the
+    // "level" of the alignment to the median count of its aligned bases.
     for(int64_t i=0; i<stList_length(pafs); i++) {
         Paf *paf = stList_get(pafs, i);
-        SequenceCountArray *seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
-        increase_alignment_level_counts(seq_count_array, paf);
-        paf->tile_level = get_median_alignment_level(seq_count_array->counts, paf); // Store the tile_level
+        SequenceCountIntervals *seq_count_intervals = get_alignment_count_intervals(seq_names_to_alignment_count_intervals, paf);
+        paf->tile_level = increase_alignment_level_counts_and_get_median(seq_count_intervals, paf); // Store the tile_level
         assert(paf->tile_level > 0); // Tile levels should start at 1
     }
 
@@ -171,7 +116,7 @@ int main(int argc, char *argv[]) {
     // Cleanup
     //////////////////////////////////////////////
 
-    stHash_destruct(seq_names_to_alignment_count_arrays);
+    stHash_destruct(seq_names_to_alignment_count_intervals);
     stList_destruct(pafs);
     if(inputFile != NULL) {
         fclose(input);
@@ -18,7 +18,7 @@
 void usage() {
     fprintf(stderr, "paf_to_bed [options], version 0.1\n");
     fprintf(stderr, "Creates a bed file representing the coverage of alignments on the query sequences of the paf alignments\n");
-    fprintf(stderr, "-i --inputFile : Input paf file. If not specified reads from stdin\n");
+    fprintf(stderr, "-i --inputFile : Input paf file (text or binary). If not specified reads (text paf) from stdin\n");
     fprintf(stderr, "-o --outputFile : Output bed file. If not specified outputs to stdout\n");
     fprintf(stderr, "-b --binary : Output 0 for unaligned and 1 for aligned, rather than reporting the actual number of alignments\n");
     fprintf(stderr, "-e --excludeUnaligned : Exclude any interval with 0 alignment coverage from the output\n");
@@ -136,7 +136,7 @@ int main(int argc, char *argv[]) {
     // Calculate the paf coverages
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    PafReader *input = paf_reader_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
     // Create integer array representing counts of alignments to bases in the genome, setting values initially to 0.
@@ -144,7 +144,7 @@ int main(int argc, char *argv[]) {
 
     // For each alignment: increase by one the aligned bases count of each base covered by the alignment.
     Paf *paf;
-    while((paf = paf_read(input)) != NULL) {
+    while((paf = paf_reader_next(input)) != NULL) { // The names of the pafs, used as keys below, are owned by the reader
         SequenceCountArray *seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
         increase_alignment_level_counts(seq_count_array, paf);
 
@@ -163,9 +163,7 @@ int main(int argc, char *argv[]) {
     //////////////////////////////////////////////
 
     stHash_destruct(seq_names_to_alignment_count_arrays);
-    if(inputFile != NULL) {
-        fclose(input);
-    }
+    paf_reader_destruct(input);
     if(outputFile != NULL) {
         fclose(output);
     }
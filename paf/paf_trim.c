@@ -8,6 +8,7 @@
  */
 
 #include "paf.h"
+#include "cactusFile.h"
 #include <getopt.h>
 #include <time.h>
 
@@ -87,7 +88,7 @@ static float trim_end_fraction = 0.02;
      // Invert the paf
      //////////////////////////////////////////////
 
-     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+     FILE *input = inputFile == NULL ? stdin : cactusFile_open(inputFile);
      FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
      Paf *paf;
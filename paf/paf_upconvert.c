@@ -14,6 +14,7 @@
 #include "commonC.h"
 #include "sonLib.h"
 #include "paf.h"
+#include "cactusFile.h"
 
 void usage() {
     fprintf(stderr, "paf_upconvert [fasta_file]xN [options], version 0.1\n");
@@ -129,7 +130,7 @@ int main(int argc, char *argv[]) {
     while(optind < argc) {
         char *seq_file = argv[optind++];
         st_logInfo("Parsing sequence file : %s\n", seq_file);
-        FILE *seq_file_handle = fopen(seq_file, "r");
+        FILE *seq_file_handle = cactusFile_open(seq_file);
         fastaReadToFunction(seq_file_handle, intervals, fastaRead_readCoordinates);
         fclose(seq_file_handle);
     }
@@ -140,7 +141,7 @@ int main(int argc, char *argv[]) {
     // Now parse the bed file and extract the sequences, ensuring they are non-overlapping
     //////////////////////////////////////////////
 
-    FILE *input = paf_file == NULL ? stdin : fopen(paf_file, "r");
+    FILE *input = paf_file == NULL ? stdin : cactusFile_open(paf_file);
     FILE *output = output_file == NULL ? stdout : fopen(output_file, "w");
     Paf *paf;
     while((paf = paf_read(input)) != NULL) {
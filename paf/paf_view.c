@@ -6,6 +6,8 @@
  * Overview:
  * (1) Load query and target sequences
  * (2) For each input PAF record pretty print the alignment
+ *
+ * Alternatively, converts PAF files between the text and binary formats.
 */
 
 #include "paf.h"
@@ -13,13 +15,16 @@
 #include <getopt.h>
 #include <time.h>
 #include "bioioC.h"
+#include "cactusFile.h"
 
 void usage() {
     fprintf(stderr, "paf_view [fasta_files]xN [options], version 0.1\n");
     fprintf(stderr, "Pretty print PAF alignments\n");
-    fprintf(stderr, "-i --inputFile : Input paf file to invert. If not specified reads from stdin\n");
+    fprintf(stderr, "-i --inputFile : Input paf file (text or binary) to view. If not specified reads (text paf) from stdin\n");
     fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
     fprintf(stderr, "-a --includeAlignment : Include base level alignment in output\n");
+    fprintf(stderr, "-b --binaryOutput : Rather than pretty printing, convert the input to a binary paf file (no fasta files needed)\n");
+    fprintf(stderr, "-t --textOutput : Rather than pretty printing, convert the input to a text paf file (no fasta files needed)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -34,6 +39,8 @@ int main(int argc, char *argv[]) {
     char *inputFile = NULL;
     char *outputFile = NULL;
     bool include_alignment=0;
+    bool binary_output=0;
+    bool text_output=0;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -43,11 +50,13 @@ int main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inputFile", required_argument, 0, 'i' },
                                                 { "outputFile", required_argument, 0, 'o' },
+                                                { "binaryOutput", no_argument, 0, 'b' },
+                                                { "textOutput", no_argument, 0, 't' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:ha", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:habt", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -65,6 +74,12 @@ int main(int argc, char *argv[]) {
             case 'a':
                 include_alignment = 1;
                 break;
+            case 'b':
+                binary_output = 1;
+                break;
+            case 't':
+                text_output = 1;
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -74,7 +89,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (optind >= argc) {
+    if (binary_output && text_output) {
+        fprintf(stderr, "Only one of --binaryOutput and --textOutput can be specified\n");
+        exit(1);
+    }
+    bool convert = binary_output || text_output;
+
+    if (!convert && optind >= argc) {
         fprintf(stderr, "Expected at least one sequence file\n");
         exit(1);
     }
@@ -95,21 +116,32 @@ int main(int argc, char *argv[]) {
     while(optind < argc) {
         char *seq_file = argv[optind++];
         st_logInfo("Parsing sequence file : %s\n", seq_file);
-        FILE *seq_file_handle = fopen(seq_file, "r");
+        FILE *seq_file_handle = cactusFile_open(seq_file);
         fastaReadToFunction(seq_file_handle, sequences, fastaRead_readToMapFunction);
         fclose(seq_file_handle);
     }
     st_logInfo("Read %i sequences from sequence files\n", (int)stHash_size(sequences));
 
     //////////////////////////////////////////////
-    // Shatter the paf records
+    // View the paf records
     //////////////////////////////////////////////
 
-    FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
+    PafReader *input = paf_reader_open(inputFile);
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
+    PafBinaryWriter *binary_output_writer = binary_output ? paf_binary_writer_construct(output) : NULL;
 
     Paf *paf;
-    while((paf = paf_read(input)) != NULL) {
+    while((paf = paf_reader_next(input)) != NULL) {
+        if(convert) { // Just convert the format
+            if(binary_output) {
+                paf_binary_write(binary_output_writer, paf);
+            }
+            else {
+                paf_write(paf, output);
+            }
+            continue;
+        }
+
         // Get the query sequence
         char *query_seq = stHash_search(sequences, paf->query_name);
         if(query_seq == NULL) {
@@ -126,18 +158,16 @@ int main(int argc, char *argv[]) {
 
         // Now print the alignment
         paf_pretty_print(paf, query_seq, target_seq, output, include_alignment);
-
-        // Cleanup
-        paf_destruct(paf);
     }
 
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
-    if(inputFile != NULL) {
-        fclose(input);
+    if(binary_output_writer != NULL) {
+        paf_binary_writer_destruct(binary_output_writer);
     }
+    paf_reader_destruct(input);
     if(outputFile != NULL) {
         fclose(output);
     }
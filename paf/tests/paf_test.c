@@ -48,6 +48,247 @@ static void test_paf(CuTest *testCase) {
     }
 }
 
+static void test_cigar(CuTest *testCase) {
+    // Runs too long to pack are split into runs of the same op
+    Cigar *cigar = cigar_construct(1);
+    cigar_append(cigar, query_insert, 5);
+    cigar_append(cigar, match, CIGAR_MAX_RUN_LENGTH + 10);
+    cigar_append(cigar, query_delete, 1);
+    CuAssertIntEquals(testCase, 4, cigar_count(cigar));
+    CuAssertIntEquals(testCase, query_insert, cigar_get_op(cigar, 0));
+    CuAssertIntEquals(testCase, 5, cigar_get_length(cigar, 0));
+    CuAssertIntEquals(testCase, match, cigar_get_op(cigar, 1));
+    CuAssertIntEquals(testCase, CIGAR_MAX_RUN_LENGTH, cigar_get_length(cigar, 1));
+    CuAssertIntEquals(testCase, match, cigar_get_op(cigar, 2));
+    CuAssertIntEquals(testCase, 10, cigar_get_length(cigar, 2));
+    CuAssertIntEquals(testCase, query_delete, cigar_get_op(cigar, 3));
+    CuAssertIntEquals(testCase, 1, cigar_get_length(cigar, 3));
+    cigar_destruct(cigar);
+
+    // Trimming removes the trimmed runs from the packed cigar, and inversion flips the ops
+    char paf_string[] = "q\t100\t10\t41\t+\tt\t100\t20\t49\t0\t0\t255\tcg:Z:2I5M3D10M4I8M1D2M";
+    Paf *paf = paf_parse(paf_string);
+    paf_check(paf);
+    paf_trim_ends(paf, 6);
+    paf_check(paf);
+    char *s = paf_print(paf);
+    CuAssertStrEquals(testCase, "q\t100\t18\t35\t+\tt\t100\t29\t42\t0\t0\t255\tAS:i:0\tcg:Z:9M4I4M", s);
+    free(s);
+    paf_invert(paf);
+    s = paf_print(paf);
+    CuAssertStrEquals(testCase, "t\t100\t29\t42\t+\tq\t100\t18\t35\t0\t0\t255\tAS:i:0\tcg:Z:9M4D4M", s);
+    free(s);
+    paf_trim_ends(paf, 100); // Trims everything
+    CuAssertPtrEquals(testCase, NULL, paf->cigar);
+    free(paf->query_name);
+    free(paf->target_name);
+    paf_destruct(paf);
+}
+
+static void test_paf_reader(CuTest *testCase) {
+    // Read the pafs from the test file
+    FILE *fh = fopen(test_paf_file, "r");
+    assert(fh != NULL);
+    stList *pafs = read_pafs(fh);
+    fclose(fh);
+
+    // Make a binary copy, to check the reader reads both formats
+    char *test_paf_binary = "./paf/tests/human_chimp_reader.paf.bin";
+    fh = fopen(test_paf_binary, "w");
+    PafBinaryWriter *writer = paf_binary_writer_construct(fh);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        paf_binary_write(writer, stList_get(pafs, i));
+    }
+    paf_binary_writer_destruct(writer);
+    fclose(fh);
+
+    // Now read them with a reader, twice to check the reader can be reset
+    char *files[] = { test_paf_file, test_paf_binary };
+    for(int64_t k=0; k<2; k++) {
+        PafReader *reader = paf_reader_open(files[k]);
+        for(int64_t j=0; j<2; j++) {
+            for(int64_t i=0; i<stList_length(pafs); i++) {
+                Paf *paf = paf_reader_next(reader);
+                CuAssertTrue(testCase, paf != NULL);
+
+                // Check they are equals
+                char *s1 = paf_print(stList_get(pafs, i)), *s2 = paf_print(paf);
+                CuAssertStrEquals(testCase, s1, s2);
+                free(s1);
+                free(s2);
+            }
+            CuAssertPtrEquals(testCase, NULL, paf_reader_next(reader));
+            paf_reader_reset(reader);
+        }
+        paf_reader_destruct(reader);
+    }
+    st_system("rm -f %s", test_paf_binary);
+    stList_destruct(pafs);
+}
+
+static void test_paf_binary(CuTest *testCase) {
+    // Read the pafs from the test file
+    FILE *fh = fopen(test_paf_file, "r");
+    assert(fh != NULL);
+    stList *pafs = read_pafs(fh);
+    fclose(fh);
+
+    // Write the pafs to a binary file
+    char *test_paf_binary = "./paf/tests/human_chimp_copy.paf.bin";
+    fh = fopen(test_paf_binary, "w");
+    PafBinaryWriter *writer = paf_binary_writer_construct(fh);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        paf_binary_write(writer, stList_get(pafs, i));
+    }
+    paf_binary_writer_destruct(writer);
+    fclose(fh);
+
+    // Read them back, twice to check the reader can be reset
+    CuAssertTrue(testCase, paf_binary_is_binary_file(test_paf_binary));
+    CuAssertTrue(testCase, !paf_binary_is_binary_file(test_paf_file));
+    PafBinaryReader *reader = paf_binary_reader_construct(test_paf_binary);
+    CuAssertIntEquals(testCase, stList_length(pafs), paf_binary_reader_get_record_number(reader));
+    for(int64_t j=0; j<2; j++) {
+        for(int64_t i=0; i<stList_length(pafs); i++) {
+            Paf *paf = paf_binary_read(reader);
+            CuAssertTrue(testCase, paf != NULL);
+            paf_check(paf);
+
+            // Check they are equals
+            char *s1 = paf_print(stList_get(pafs, i)), *s2 = paf_print(paf);
+            CuAssertStrEquals(testCase, s1, s2);
+            free(s1);
+            free(s2);
+        }
+        CuAssertPtrEquals(testCase, NULL, paf_binary_read(reader));
+        paf_binary_reader_reset(reader);
+    }
+    paf_binary_reader_destruct(reader);
+    st_system("rm -f %s", test_paf_binary); // Remove the binary file
+    stList_destruct(pafs);
+}
+
+static stList *read_binary_pafs(char *file) {
+    stList *pafs = stList_construct3(0, (void (*)(void *))paf_destruct);
+    PafBinaryReader *reader = paf_binary_reader_construct(file);
+    Paf *paf;
+    while((paf = paf_binary_read(reader)) != NULL) { // The paf is reused by the reader, so keep a copy
+        char *paf_string = paf_print(paf);
+        stList_append(pafs, paf_parse(paf_string));
+        free(paf_string);
+    }
+    paf_binary_reader_destruct(reader);
+    return pafs;
+}
+
+static void test_paf_sort(CuTest *testCase) {
+    FILE *fh = fopen(test_paf_file, "r");
+    assert(fh != NULL);
+    stList *pafs = read_pafs(fh);
+    fclose(fh);
+
+    // Sort in memory and with a small memory budget, so that the sort is done in many runs that are merged
+    char *sorted_file = "./test_paf_sort.bin", *sorted_file2 = "./test_paf_sort2.bin";
+    paf_sort_file_by_descending_score(test_paf_file, sorted_file, INT64_MAX);
+    paf_sort_file_by_descending_score(test_paf_file, sorted_file2, 20000);
+    stList *sorted_pafs = read_binary_pafs(sorted_file), *sorted_pafs2 = read_binary_pafs(sorted_file2);
+
+    // Check the results are the same, and sorted
+    CuAssertIntEquals(testCase, stList_length(pafs), stList_length(sorted_pafs));
+    CuAssertIntEquals(testCase, stList_length(pafs), stList_length(sorted_pafs2));
+    for(int64_t i=0; i<stList_length(sorted_pafs); i++) {
+        Paf *paf = stList_get(sorted_pafs, i);
+        if(i > 0) {
+            CuAssertTrue(testCase, ((Paf *)stList_get(sorted_pafs, i-1))->score >= paf->score);
+        }
+        char *s1 = paf_print(paf), *s2 = paf_print(stList_get(sorted_pafs2, i));
+        CuAssertStrEquals(testCase, s1, s2);
+        free(s1);
+        free(s2);
+    }
+
+    stList_destruct(sorted_pafs);
+    stList_destruct(sorted_pafs2);
+    stList_destruct(pafs);
+    stFile_rmtree(sorted_file);
+    stFile_rmtree(sorted_file2);
+}
+
+static void test_alignment_count_intervals(CuTest *testCase) {
+    FILE *fh = fopen(test_paf_file, "r");
+    assert(fh != NULL);
+    stList *pafs = read_pafs(fh);
+    fclose(fh);
+
+    // Add the pafs to both the per-base count arrays and the count intervals
+    stHash *count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, free);
+    stHash *count_intervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                                (void (*)(void *))sequence_count_intervals_destruct);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        Paf *paf = stList_get(pafs, i);
+        SequenceCountArray *seq_count_array = get_alignment_count_array(count_arrays, paf);
+        increase_alignment_level_counts(seq_count_array, paf);
+        int64_t median = increase_alignment_level_counts_and_get_median(get_alignment_count_intervals(count_intervals, paf), paf);
+        CuAssertTrue(testCase, median > 0);
+    }
+
+    // Check the intervals cover each sequence, with the same counts as the arrays
+    stHashIterator *it = stHash_getIterator(count_arrays);
+    char *name;
+    while((name = stHash_getNext(it)) != NULL) {
+        SequenceCountArray *seq_count_array = stHash_search(count_arrays, name);
+        SequenceCountIntervals *seq_count_intervals = stHash_search(count_intervals, name);
+        CuAssertTrue(testCase, seq_count_intervals != NULL);
+        stSortedSetIterator *it2 = stSortedSet_getIterator(seq_count_intervals->intervals);
+        CountInterval *interval;
+        int64_t j = 0;
+        while((interval = stSortedSet_getNext(it2)) != NULL) {
+            CuAssertIntEquals(testCase, j, interval->start);
+            for(; j<interval->end; j++) {
+                CuAssertIntEquals(testCase, seq_count_array->counts[j], interval->count);
+            }
+        }
+        CuAssertIntEquals(testCase, seq_count_array->length, j);
+        stSortedSet_destructIterator(it2);
+    }
+    stHash_destructIterator(it);
+
+    stHash_destruct(count_arrays);
+    stHash_destruct(count_intervals);
+    stList_destruct(pafs);
+}
+
+static int64_t test_gap_cost(int64_t query_gap_length, int64_t target_gap_length, void *params) {
+    return query_gap_length + target_gap_length == 0 ? 0 : 5000 + query_gap_length + target_gap_length;
+}
+
+static stList *chain_test_pafs(int64_t threads) {
+    FILE *fh = fopen(test_paf_file, "r");
+    assert(fh != NULL);
+    stList *pafs = read_pafs(fh);
+    fclose(fh);
+    stList *chained_pafs = paf_chain(pafs, test_gap_cost, NULL, 10000, 0.02, threads);
+    stList_setDestructor(pafs, NULL); // the pafs are now owned by the chained list
+    stList_destruct(pafs);
+    stList_setDestructor(chained_pafs, (void (*)(void *))paf_destruct);
+    return chained_pafs;
+}
+
+static void test_paf_chain_threads(CuTest *testCase) {
+    // Chaining must give the same output whatever the number of threads
+    stList *chained_pafs = chain_test_pafs(1);
+    stList *chained_pafs2 = chain_test_pafs(4);
+    CuAssertIntEquals(testCase, stList_length(chained_pafs), stList_length(chained_pafs2));
+    for(int64_t i=0; i<stList_length(chained_pafs); i++) {
+        char *s1 = paf_print(stList_get(chained_pafs, i)), *s2 = paf_print(stList_get(chained_pafs2, i));
+        CuAssertStrEquals(testCase, s1, s2);
+        free(s1);
+        free(s2);
+    }
+    stList_destruct(chained_pafs);
+    stList_destruct(chained_pafs2);
+}
+
 static void test_paf_align_human_mouse(CuTest *testCase) {
     // Run a complete alignment and compare to the true alignment
     st_system("./paf/tests/pair_align_human_mouse_test.sh %s %s\n", params_file, example_file);
@@ -63,6 +304,12 @@ static void test_paf_tools(CuTest *testCase) {
 CuSuite* addPafTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_paf);
+    SUITE_ADD_TEST(suite, test_cigar);
+    SUITE_ADD_TEST(suite, test_paf_reader);
+    SUITE_ADD_TEST(suite, test_paf_binary);
+    SUITE_ADD_TEST(suite, test_paf_sort);
+    SUITE_ADD_TEST(suite, test_alignment_count_intervals);
+    SUITE_ADD_TEST(suite, test_paf_chain_threads);
     SUITE_ADD_TEST(suite, test_paf_align_human_mouse);
     SUITE_ADD_TEST(suite, test_paf_tools);
     return suite;
@@ -43,6 +43,7 @@ void usage() {
     fprintf(stderr, "-g --speciesTree : [Required] The species tree, which will form the skeleton of the event tree\n");
     fprintf(stderr, "-o --outgroupEvents : Leaf events in the species tree identified as outgroups\n");
     fprintf(stderr, "-r --referenceEvent : [Required] The name of the reference event\n");
+    fprintf(stderr, "-B --binaryC2h : Write the output file in the compact binary c2h format, rather than as text\n");
     fprintf(stderr, "-t --runChecks : Run cactus checks after each stage, used for debugging\n");
     fprintf(stderr, "-T --threads : (int > 0) Use up to this many threads [default: all available]\n");
     fprintf(stderr, "-h --help : Print this help message\n");
@@ -71,8 +72,17 @@ static void callBottomUp(Flower *flower, RecordHolder *rh, void *extraArg) {
     bottomUpNoDb(flower, rh, (Name)extraArg, 0, generateJukesCantorMatrix);
 }
 
+/*
+ * The arguments of callHalFn.
+ */
+typedef struct _halArgs {
+    Name referenceEventName;
+    bool binary;
+} HalArgs;
+
 static void callHalFn(Flower *flower, RecordHolder *rh, void *extraArg) {
-    makeHalFormatNoDb(flower, rh, (Name)extraArg, NULL);
+    HalArgs *halArgs = extraArg;
+    makeHalFormatNoDb(flower, rh, halArgs->referenceEventName, halArgs->binary, NULL);
 }
 
 static RecordHolder *doBottomUpTraversal(stList *flowerLayers,
@@ -147,6 +157,7 @@ int main(int argc, char *argv[]) {
     char *outgroupEvents = NULL;
     char *referenceEventString = NULL;
     bool runChecks = 0;
+    bool binaryC2h = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -175,12 +186,13 @@ int main(int argc, char *argv[]) {
                 { "help", no_argument, 0, 'h' },
                 { "referenceEvent", required_argument, 0, 'r' },
                 { "runChecks", no_argument, 0, 't' },
+                { "binaryC2h", no_argument, 0, 'B' },
                 { "threads", required_argument, 0, 'T' }, 
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:tT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:tBT:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -226,6 +238,9 @@ int main(int argc, char *argv[]) {
             case 't':
                 runChecks = 1;
                 break;
+            case 'B':
+                binaryC2h = 1;
+                break;
             case 'T':
             {
                 int num_threads = 0;
@@ -364,9 +379,7 @@ int main(int argc, char *argv[]) {
 
     if (cactusParams_get_int(params, 2, "bar", "runBar")) {
         stList *leafFlowers = stList_construct();
-        extendFlowers(flower, leafFlowers, 1); // Get nested flowers to complete
-        stList_sort(leafFlowers, flower_sizeCmpFn); // Sort by descending order of size, so that we start processing the
-// largest flower as quickly as possible
+        extendFlowers(flower, leafFlowers, 1); // Get nested flowers to complete, bar() orders them by estimated cost
         st_logInfo("Ran extended flowers ready for bar, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
 
@@ -437,9 +450,10 @@ int main(int argc, char *argv[]) {
     //Make c2h files, then build hal
     //////////////////////////////////////////////
 
-    rh = doBottomUpTraversal(flowerLayers, callHalFn, (void *)referenceEventName);
+    HalArgs halArgs = { referenceEventName, binaryC2h };
+    rh = doBottomUpTraversal(flowerLayers, callHalFn, &halArgs);
     FILE *fileHandle = fopen(outputFile, "w");
-    makeHalFormatNoDb(flower, rh, referenceEventName, fileHandle);
+    makeHalFormatNoDb(flower, rh, referenceEventName, binaryC2h, fileHandle);
     fclose(fileHandle);
     assert(recordHolder_size(rh) == 0);
     recordHolder_destruct(rh);
@@ -70,10 +70,8 @@ static void convertCoordinates(Paf *paf, FILE *outputCigarFileHandle,
     if (cap2 == NULL) {
         st_errAbort("Could not match contig name in alignment to cactus cap: '%s'", paf->target_name);
     }
-    //Fix the names
-    free(paf->query_name);
+    //Fix the names, the original names belong to the paf reader
     paf->query_name = cactusMisc_nameToString(cap_getName(cap1));
-    free(paf->target_name);
     paf->target_name = cactusMisc_nameToString(cap_getName(cap2));
     //Now fix the coordinates by adding one
     paf->query_start += 2;
@@ -99,21 +97,32 @@ void convertAlignmentCoordinates(char *inputAlignmentFile, char *outputAlignment
     stHash *sequenceHeaderToCapHash = makeSequenceHeaderToCapHash(flower);
     st_logDebug("Set up the flower disk and built hash\n");
 
-    FILE *inputAlignmentFileHandle = fopen(inputAlignmentFile, "r");
+    // Binary paf input is kept binary, so that the pinch iterator can also skip parsing the converted alignments
+    PafReader *reader = paf_reader_open(inputAlignmentFile);
     FILE *outputAlignmentFileHandle = fopen(outputAlignmentFile, "w");
+    PafBinaryWriter *binaryWriter = paf_binary_is_binary_file(inputAlignmentFile) ?
+                                    paf_binary_writer_construct(outputAlignmentFileHandle) : NULL;
     st_logDebug("Opened files for writing\n");
 
     Paf *paf;
-    while ((paf = paf_read(inputAlignmentFileHandle)) != NULL) {
+    while ((paf = paf_reader_next(reader)) != NULL) {
         convertCoordinates(paf, outputAlignmentFileHandle, sequenceHeaderToCapHash);
         paf_check(paf);
-        paf_write(paf, outputAlignmentFileHandle);
-        paf_destruct(paf);
+        if (binaryWriter != NULL) {
+            paf_binary_write(binaryWriter, paf);
+        } else {
+            paf_write(paf, outputAlignmentFileHandle);
+        }
+        free(paf->query_name); // Cleanup the converted names
+        free(paf->target_name);
     }
     st_logDebug("Finished converting alignments\n");
 
     //Cleanup
-    fclose(inputAlignmentFileHandle);
+    if (binaryWriter != NULL) {
+        paf_binary_writer_destruct(binaryWriter);
+    }
+    paf_reader_destruct(reader);
     fclose(outputAlignmentFileHandle);
     stHash_destruct(sequenceHeaderToCapHash);
 }
@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include "sonLib.h"
+#include "cactusFile.h"
 
 typedef int8_t   s8;
 typedef uint8_t  u8;
@@ -295,6 +296,7 @@ int main
     u32     rStart, rEnd, qStart, qEnd, qStartOriginal, qEndOriginal;
     u32     ix;
     int     ok;
+    FILE*   input;
 
     parse_options (argc, argv);
 
@@ -307,6 +309,11 @@ int main
 
     chromsSeen = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
 
+    // stdin may be gzip compressed
+
+    input = cactusFile_open (NULL);
+    if (input == NULL) goto cant_open_input;
+
     //////////
     // process intervals
     //////////
@@ -319,7 +326,7 @@ int main
 
     while (true)
         {
-        ok = read_alignment (stdin, lineBuffer, sizeof(lineBuffer), &lineNumber,
+        ok = read_alignment (input, lineBuffer, sizeof(lineBuffer), &lineNumber,
                              &rChrom, &rStart, &rEnd, &qChrom, &qStart, &qEnd);
         if (!ok) break;
 
@@ -423,6 +430,7 @@ int main
     //////////
 
     free (window);
+    fclose (input);
 
     stHash_destruct(chromsSeen);
     chromsSeen = NULL;
@@ -441,6 +449,10 @@ cant_allocate_window:
                      windowSize);
     return EXIT_FAILURE;
 
+cant_open_input:
+    fprintf (stderr, "failed to open stdin\n");
+    return EXIT_FAILURE;
+
 cant_allocate_info:
     fprintf (stderr, "failed to allocate %d-entry info record for %s\n",
                      (int) sizeof(chr_info), qChrom);
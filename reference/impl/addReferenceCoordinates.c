@@ -365,12 +365,14 @@ void bottomUpNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName,
             getPhylogeneticTreeRootedAtGivenEvent(eventTree_getEvent(flower_getEventTree(flower), referenceEventName),
                                                   generateSubstitutionMatrix);
 
+    // The records are written serially, as segmentWriteFn breaks ties between bases with the shared random number
+    // generator, so the reference sequence only depends on the seed if they are written in order
     if (isTop) {
         stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, segmentWriteFn,
-                                                            terminalAdjacencyWriteFn, phylogeneticTree);
+                                                            terminalAdjacencyWriteFn, phylogeneticTree, 0);
         bottomUp2(threadStrings, caps);
     } else {
-        buildRecursiveThreadsNoDb(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, phylogeneticTree);
+        buildRecursiveThreadsNoDb(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, phylogeneticTree, 0);
     }
     cleanupPhylogeneticTree(phylogeneticTree);
     stList_destruct(caps);
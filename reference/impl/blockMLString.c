@@ -29,14 +29,40 @@ Event *getEvent(stTree *tree) {
     return ((void **) stTree_getClientData(tree))[1];
 }
 
+static double *getBranchTable(stTree *tree) {
+    /*
+     * Gets back the substitution probabilities for the parent branch of a given node, as an array in which
+     * entry i * 5 + j, for j < 4, is the probability of base i given base j at the other end of the branch and
+     * entry i * 5 + 4 is the sum of those probabilities, i.e. the probability of base i given an N.
+     */
+    return ((void **) stTree_getClientData(tree))[2];
+}
+
+static double *getBranchTableFromMatrix(stMatrix *matrix) {
+    /*
+     * Builds the array of substitution probabilities returned by getBranchTable from the substitution matrix.
+     */
+    assert(stMatrix_n(matrix) == 4);
+    double *table = st_malloc(sizeof(double) * 20);
+    for (int64_t i = 0; i < 4; i++) {
+        table[i * 5 + 4] = 0.0;
+        for (int64_t j = 0; j < 4; j++) {
+            table[i * 5 + j] = *stMatrix_getCell(matrix, i, j);
+            table[i * 5 + 4] += table[i * 5 + j];
+        }
+    }
+    return table;
+}
+
 static stTree *getPhylogeneticTree(Event *event, Event *eventToTreatAsParent,
         stMatrix *(*generateSubstitutionMatrix)(double)) {
     stTree *tree = stTree_construct();
     stMatrix *matrix = generateSubstitutionMatrix(
             event_getBranchLength(eventToTreatAsParent == NULL ? event : eventToTreatAsParent));
-    void **attributes = st_malloc(sizeof(void *) * 2);
+    void **attributes = st_malloc(sizeof(void *) * 3);
     attributes[0] = matrix;
     attributes[1] = event;
+    attributes[2] = getBranchTableFromMatrix(matrix);
     stTree_setClientData(tree, attributes);
     for (int64_t i = 0; i < event_getChildNumber(event); i++) {
         if (eventToTreatAsParent != event_getChild(event, i)) {
@@ -49,15 +75,19 @@ static stTree *getPhylogeneticTree(Event *event, Event *eventToTreatAsParent,
 stTree *getPhylogeneticTreeRootedAtGivenEvent(Event *event, stMatrix *(*generateSubstitutionMatrix)(double)) {
     /*
      * Creates a stTree isomorphic to the eventTree that 'event' is part of, but rooted at 'event'.
-     * Each node is the returned tree has two attributes, arranged in an array (see getSubMatrix and getEvent above).
+     * Each node is the returned tree has three attributes, arranged in an array (see getSubMatrix, getEvent and
+     * getBranchTable above).
      * The first is a substitution matrix giving substitution probabilities for bases along the incident parent branch of
      * the re-rooted tree.
      * The second is the event that it maps to in the original event tree.
+     * The third is the substitution probabilities of the first laid out for base calling.
      */
     stTree *tree = getPhylogeneticTree(event, NULL, generateSubstitutionMatrix); //This builds the subtree rooted at the given event
     stMatrix_destruct(getSubMatrix(tree)); //This cleans up the substitution matrix for the root of the remodeled tree.
+    free(getBranchTable(tree));
     ((void **) stTree_getClientData(tree))[0] = generateSubstitutionMatrix(0.0); //And this parameterizes the substitution matrix of
     //the parent branch of the root to have zero length.
+    ((void **) stTree_getClientData(tree))[2] = getBranchTableFromMatrix(getSubMatrix(tree));
 
     //The following builds out the subtree of the eventTree not represented by tree
     Event *pEvent = NULL;
@@ -76,6 +106,7 @@ void cleanupPhylogeneticTreeP(stTree *tree) {
         cleanupPhylogeneticTreeP(stTree_getChild(tree, i));
     }
     stMatrix_destruct(getSubMatrix(tree));
+    free(getBranchTable(tree));
     free(stTree_getClientData(tree));
 }
 
@@ -117,11 +148,12 @@ char indexToChar(int64_t i) {
 static char *getMaxLikelihoodString(double *baseProbs, int64_t length) {
     /*
      * For the "baseProbs" 2d array of base probabilities generates a ML string of bases.
-     * The baseProbs array is organised as
-     * [ Prob of A at position 0, Prob of C at position 0, Prob of G at position 0, Prob of T at position 0,
-     *   Prob of A at position 1, Prob of C at position 1, Prob of G at position 1, Prob of T at position 1,
+     * The baseProbs array is organised by base, so that the probabilities of a base at consecutive positions
+     * are contiguous and can be computed on together, as
+     * [ Prob of A at position 0, Prob of A at position 1, ..., Prob of A at position length-1,
+     *   Prob of C at position 0, Prob of C at position 1, ..., Prob of C at position length-1,
      *   ...
-     *  etc.
+     *  etc. for G and T.
      *  The returned string is a an upper case string of A, C, G and T.
      *  Length is the length of the string.
      *  In case of bases at a position with equal probability a (somewhat) random base is chosen.
@@ -129,9 +161,9 @@ static char *getMaxLikelihoodString(double *baseProbs, int64_t length) {
     char *mlString = st_malloc(sizeof(char) * (length+1));
     for (int64_t i = 0; i < length; i++) {
         int64_t k = 0;
-        double m = baseProbs[i * 4];
+        double m = baseProbs[i];
         for (int64_t j = 1; j < 4; j++) {
-            double n = baseProbs[i * 4 + j];
+            double n = baseProbs[j * length + i];
             if (n > m || (n == m && st_random() > 0.5)) {
                 k = j;
                 m = n;
@@ -147,66 +179,77 @@ static char *getMaxLikelihoodString(double *baseProbs, int64_t length) {
 // The following functions are the meat of the Felsenstein's algorithm implementation.
 ///
 
-static double *transformBaseProbsBySubstitutionMatrix(double *baseProbs, int64_t length, stMatrix *substitutionMatrix) {
+static void transformBaseProbsBySubstitutionMatrix(double *baseProbs, int64_t length, const double *table) {
     /*
-     * Updates the array of base probs, as described in getMaxLikelihoodString by multiplying the vector of base
-     * probabilities at each position by the given substitution matrix.
-     * Returns the input array.
+     * Updates the array of base probs, as described in getMaxLikelihoodString, by multiplying the vector of base
+     * probabilities at each position by the substitution matrix given by the table (see getBranchTable).
+     * Written over the positions of each base in turn, so the compiler can vectorise it.
      */
-    assert(stMatrix_n(substitutionMatrix) == 4);
-    double v[4];
+    double *a = baseProbs, *c = baseProbs + length, *g = baseProbs + 2 * length, *t = baseProbs + 3 * length;
     for (int64_t i = 0; i < length; i++) {
-        stMatrix_multiplySquareMatrixAndColumnVector2(substitutionMatrix, &(baseProbs[i * 4]), v);
-        memcpy(&(baseProbs[i * 4]), v, sizeof(double) * 4);
+        double pA = a[i], pC = c[i], pG = g[i], pT = t[i];
+        a[i] = table[0] * pA + table[1] * pC + table[2] * pG + table[3] * pT;
+        c[i] = table[5] * pA + table[6] * pC + table[7] * pG + table[8] * pT;
+        g[i] = table[10] * pA + table[11] * pC + table[12] * pG + table[13] * pT;
+        t[i] = table[15] * pA + table[16] * pC + table[17] * pG + table[18] * pT;
     }
-    return baseProbs;
 }
 
-double *getEmptyBaseProbsString(int64_t length) {
+static void setEmptyBaseProbs(double *baseProbs, int64_t length) {
     /*
-     * Gets an array of base probs, as described in getMaxLikelihoodString,
-     * for a block of 'length' positions, in which each position is initialised to 1.0.
+     * Initialises each position of an array of base probs, as described in getMaxLikelihoodString, to 1.0.
      */
-    double *baseProbs = st_malloc(length * 4 * sizeof(double));
     for (int64_t i = 0; i < length * 4; i++) {
         baseProbs[i] = 1.0;
     }
-    return baseProbs;
 }
 
-double *getBaseProbsString(Segment *segment) {
+static SequenceView getSegmentView(Segment *segment) {
+    /*
+     * Gets a view of the string of the segment, as returned by segment_getString, without copying it.
+     */
+    assert(segment_getSequence(segment) != NULL);
+    return sequence_getView(segment_getSequence(segment),
+            segment_getStart(segment_getStrand(segment) ? segment : segment_getReverse(segment)),
+            segment_getLength(segment), segment_getStrand(segment));
+}
+
+static void multiplyBaseProbsBySegment(double *baseProbs, Segment *segment, const double *table) {
     /*
-     * Gets an array of base probs, as described in getMaxLikelihoodString, representing
-     * the input string.
+     * Multiplies the array of base probs, as described in getMaxLikelihoodString, by the probabilities of the bases
+     * given the string of the segment at the other end of a branch with the given table (see getBranchTable).
+     * As the string has a single base, or an N, at each position this is a look up in the table,
+     * rather than a multiplication by the substitution matrix.
      */
-    char *string = segment_getString(segment);
+    SequenceView view = getSegmentView(segment);
+    SequenceViewIterator it;
+    sequenceView_getIterator(&view, &it);
     int64_t length = segment_getLength(segment);
-    double *baseProbs = st_calloc(length * 4, sizeof(double)); //Gets the initial array initialised to 0.0 values
+    double *a = baseProbs, *c = baseProbs + length, *g = baseProbs + 2 * length, *t = baseProbs + 3 * length;
     for (int64_t i = 0; i < length; i++) {
-        switch (toupper(string[i])) {
+        int64_t j;
+        switch (toupper(sequenceView_getNext(&it))) {
         case 'A':
-            assert(baseProbs[i * 4] == 0.0);
-            baseProbs[i * 4] = 1.0;
+            j = 0;
             break;
         case 'C':
-            baseProbs[i * 4 + 1] = 1.0;
+            j = 1;
             break;
         case 'G':
-            baseProbs[i * 4 + 2] = 1.0;
+            j = 2;
             break;
         case 'T':
-            baseProbs[i * 4 + 3] = 1.0;
+            j = 3;
             break;
         default: //If N we treat marginalise over all possibilities.
-            baseProbs[i * 4] = 1.0;
-            baseProbs[i * 4 + 1] = 1.0;
-            baseProbs[i * 4 + 2] = 1.0;
-            baseProbs[i * 4 + 3] = 1.0;
+            j = 4;
             break;
         }
+        a[i] *= table[j];
+        c[i] *= table[5 + j];
+        g[i] *= table[10 + j];
+        t[i] *= table[15 + j];
     }
-    free(string);
-    return baseProbs;
 }
 
 static void multiply(double *baseProbs1, double *baseProbs2, int64_t blockLength) {
@@ -214,12 +257,10 @@ static void multiply(double *baseProbs1, double *baseProbs2, int64_t blockLength
      * Convenience function.
      * Updates baseProbs1, so that at each position i, baseProbs1[i] = baseProbs1[i] * baseProbs2[i], each
      * being the probability of a given base at a given position whose probability if the product of the initial probabilities.
-     * Frees base probs2.
      */
     for (int64_t j = 0; j < blockLength * 4; j++) {
         baseProbs1[j] *= baseProbs2[j];
     }
-    free(baseProbs2);
 }
 
 static int getFirstSegmentMatchingEvent(const void *a, const void *b) {
@@ -228,43 +269,57 @@ static int getFirstSegmentMatchingEvent(const void *a, const void *b) {
     return e1 < e2 ? -1 : (e1 > e2 ? 1 : 0);
 }
 
-static double *computeBaseProbs(stTree *tree, stList *eventSortedSegments, int64_t blockLength) {
+static int64_t getTreeHeight(stTree *tree) {
+    int64_t height = 0;
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        int64_t j = getTreeHeight(stTree_getChild(tree, i)) + 1;
+        height = j > height ? j : height;
+    }
+    return height;
+}
+
+static bool computeBaseProbs(stTree *tree, stList *eventSortedSegments, int64_t blockLength, double *baseProbs) {
     /*
      * This is the Felsenstein's function to compute the probabilities of each base at each position of the block for the given root node of tree
      * (which is a phylogenetic tree and attached substitution matrices created by getSubstitutionTreeRootedAtGivenEvent).
+     * The probabilities are written to the first 4 * blockLength entries of baseProbs, the remainder being workspace
+     * for the subtrees, so baseProbs must have room for 4 * blockLength * (getTreeHeight(tree) + 1) entries.
+     * Returns false, with baseProbs undefined, if there are no segments in the subtree.
      */
     //The code is recursive.
     if (stTree_getChildNumber(tree) > 0) { //Case root is an internal node.
-        double *baseProbs = computeBaseProbs(stTree_getChild(tree, 0), eventSortedSegments, blockLength);
+        bool nonEmpty = computeBaseProbs(stTree_getChild(tree, 0), eventSortedSegments, blockLength, baseProbs);
         int64_t i=1;
         // While there are no base probs, cos the subtree is empty replace base probs with those from another branch
-        while(baseProbs == NULL && i < stTree_getChildNumber(tree)) {
-            baseProbs = computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength);
+        while(!nonEmpty && i < stTree_getChildNumber(tree)) {
+            nonEmpty = computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength, baseProbs);
         }
         // Now that we have base probs combine the remaining branches
+        double *baseProbs2 = baseProbs + 4 * blockLength;
         while(i < stTree_getChildNumber(tree)) {
-            double *baseProbs2 = computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength);
-            if(baseProbs2 != NULL) {
+            if(computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength, baseProbs2)) {
                 multiply(baseProbs, baseProbs2, blockLength);
             }
         }
-        return baseProbs == NULL ? NULL : transformBaseProbsBySubstitutionMatrix(baseProbs, blockLength, getSubMatrix(tree));
+        if(nonEmpty) {
+            transformBaseProbsBySubstitutionMatrix(baseProbs, blockLength, getBranchTable(tree));
+        }
+        return nonEmpty;
     } else { //Case root is a leaf
         Event *event = getEvent(tree);
         int64_t i = stList_binarySearchFirstIndex(eventSortedSegments, event, getFirstSegmentMatchingEvent);
         if(i == -1) {
-            return NULL;
+            return 0;
         }
-        double *baseProbs = transformBaseProbsBySubstitutionMatrix(getBaseProbsString(stList_get(eventSortedSegments, i)),
-                                                                   blockLength, getSubMatrix(tree));
-        while(++i < stList_length(eventSortedSegments)) {
+        setEmptyBaseProbs(baseProbs, blockLength);
+        for(; i < stList_length(eventSortedSegments); i++) {
             Segment *segment = stList_get(eventSortedSegments, i);
             if(segment_getEvent(segment) != event) {
                 break;
             }
-            multiply(baseProbs, transformBaseProbsBySubstitutionMatrix(getBaseProbsString(segment), blockLength, getSubMatrix(tree)), blockLength);
+            multiplyBaseProbsBySegment(baseProbs, segment, getBranchTable(tree));
         }
-        return baseProbs;
+        return 1;
     }
 }
 
@@ -287,13 +342,15 @@ void maskAncestralRepeatBases(Block *block, stList *segments, char *mlString) {
     for(int64_t i=0; i<j; i++) {
         Segment *segment = stList_get(segments, i);
         assert(segment_getSequence(segment) != NULL);
-        char *string = segment_getString(segment);
+        SequenceView view = getSegmentView(segment);
+        SequenceViewIterator it;
+        sequenceView_getIterator(&view, &it);
         for (int64_t k = 0; k < l; k++) {
-            char uC = toupper(string[k]);
-            upperCounts[k] += uC == string[k] ? 1 : 0;
+            char c = sequenceView_getNext(&it);
+            char uC = toupper(c);
+            upperCounts[k] += uC == c ? 1 : 0;
             nCounts[k] += (uC != 'A' && uC != 'C' && uC != 'G' && uC != 'T' ? 1 : 0);
         }
-        free(string);
     }
 
     //Convert any upper case character to lower case if the majority of bases
@@ -356,9 +413,9 @@ char *getMaximumLikelihoodString(stTree *tree, Block *block) {
         mlString[block_getLength(block)] = '\0';
     } else {
         stList *eventSortedSegments = segmentsSortedByEvent(block);
-        double *baseProbs = computeBaseProbs(tree, eventSortedSegments, block_getLength(block));
-        if(baseProbs == NULL) {
-            baseProbs = getEmptyBaseProbsString(block_getLength(block));
+        double *baseProbs = st_malloc(sizeof(double) * 4 * block_getLength(block) * (getTreeHeight(tree) + 1));
+        if(!computeBaseProbs(tree, eventSortedSegments, block_getLength(block), baseProbs)) {
+            setEmptyBaseProbs(baseProbs, block_getLength(block));
         }
         mlString = getMaxLikelihoodString(baseProbs, block_getLength(block));
         maskAncestralRepeatBases(block, eventSortedSegments, mlString);
@@ -1022,28 +1022,37 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
             (int (*)(const void *, const void *)) stIntTuple_equalsFn, (void (*)(void *)) stIntTuple_destruct, NULL);
 
     /*
-     * Determine which adjacencies between stubs must be preserved (i.e. scaffolded if necessary)
-     */
-    stList *referenceIntervalsToPreserve = NULL;
-    if (makeScaffolds) {
-        stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubTangleEnds, endsToNodes);
-        refAdjList *stubDAL = calculateZ(flower, stubEndsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
-        stHash_destruct(stubEndsToNodes);
-        referenceIntervalsToPreserve = getReferenceIntervalsToPreserve(ref, stubDAL, minNumberOfSequencesToSupportAdjacency); //List of int-tuple pairs identifying the matchings between ends that should be preserved.
-        refAdjList_destruct(stubDAL);
-    }
-
-    /*
-     * Calculate z functions, using phylogenetic weighting.
+     * Calculate the adjacency lists used to build the reference. These are independent, so each is a task that an
+     * idle thread of the enclosing parallel region can take on, which matters for large flowers such as the root.
+     *
+     * aL holds the z functions, using phylogenetic weighting, and dAL the direct adjacencies. If making scaffolds,
+     * the adjacencies between stub ends are used to determine which adjacencies between stubs must be preserved
+     * (i.e. scaffolded if necessary), and are freed by their task as soon as that is done, so at most three lists
+     * are held at once.
      */
     stSet *chosenEvents = getEventsWithSequences(flower);
     stHash *eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
     stSet_destruct(chosenEvents);
+    double directTheta = 0.0;
     void *zArgs[2] = { &theta, eventWeighting };
-    refAdjList *aL = calculateZ(flower, endsToNodes, nodeNumber, maxWalkForCalculatingZ, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs);
-    int64_t directTheta = 0.0;
-    zArgs[0] = &directTheta;
-    refAdjList *dAL = calculateZ(flower, endsToNodes, nodeNumber, 1, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs); //Gets set of direct of direct adjacencies
+    void *directZArgs[2] = { &directTheta, eventWeighting };
+    refAdjList *aL, *dAL;
+    stList *referenceIntervalsToPreserve = NULL;
+#pragma omp task shared(aL)
+    aL = calculateZ(flower, endsToNodes, nodeNumber, maxWalkForCalculatingZ, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs);
+#pragma omp task shared(dAL)
+    dAL = calculateZ(flower, endsToNodes, nodeNumber, 1, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, directZArgs);
+    if (makeScaffolds) {
+#pragma omp task shared(referenceIntervalsToPreserve)
+        {
+            stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubTangleEnds, endsToNodes);
+            refAdjList *stubDAL = calculateZ(flower, stubEndsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
+            stHash_destruct(stubEndsToNodes);
+            referenceIntervalsToPreserve = getReferenceIntervalsToPreserve(ref, stubDAL, minNumberOfSequencesToSupportAdjacency); //List of int-tuple pairs identifying the matchings between ends that should be preserved.
+            refAdjList_destruct(stubDAL);
+        }
+    }
+#pragma omp taskwait
     stHash_destruct(eventWeighting);
 
     /*
@@ -1206,13 +1215,21 @@ void cactus_make_reference(stList *flowers, char *referenceEventString,
 
     double (*temperatureFn)(double) = useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn : constantTemperatureFn;
 
-#pragma omp parallel for
+    /*
+     * Each flower is a task, rather than an iteration of a parallel loop, so that threads without a flower, as when
+     * the layer is just the root flower, run the tasks buildReferenceTopDown makes within a flower.
+     */
+#pragma omp parallel
+#pragma omp single
     for(int64_t i=0; i<stList_length(flowers); i++) {
-        Flower *flower = stList_get(flowers, i);
-        st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
-        buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
-                              phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
-                              minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+#pragma omp task firstprivate(i)
+        {
+            Flower *flower = stList_get(flowers, i);
+            st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
+            buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
+                                  phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
+                                  minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+        }
     }
 }
 
@@ -8,13 +8,122 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "cactus.h"
 #include "sonLib.h"
 #include "recursiveThreadBuilder.h"
 
+/*
+ * A record is either a string, such as that written for a segment or terminal adjacency, or a thread, the sequence of
+ * records of its segments and adjacencies. A long thread is not concatenated as it is built, else the string of the
+ * thread would be copied again at every level of the flower hierarchy above it, instead it is flattened into a string
+ * just once, by record_getString. Runs of short records are concatenated as the thread is built, so a thread only
+ * refers to pieces of at least about RECORD_MIN_PIECE_LENGTH, which bounds the memory used by the records.
+ */
+#define RECORD_MIN_PIECE_LENGTH 65536
+
+typedef struct _record {
+    char *string; // The string, if not a thread, else NULL
+    stList *records; // The records of the thread, if a thread, else NULL
+    int64_t length; // The length of the string the record represents
+} Record;
+
+static Record *record_construct2(char *string, int64_t length) {
+    Record *record = st_calloc(1, sizeof(Record));
+    record->string = string;
+    record->length = length;
+    return record;
+}
+
+static Record *record_construct(char *string) {
+    return record_construct2(string, strlen(string));
+}
+
+static void record_destruct(Record *record) {
+    free(record->string);
+    if (record->records != NULL) {
+        stList_destruct(record->records);
+    }
+    free(record);
+}
+
+static char *record_write(Record *record, char *string) {
+    /*
+     * Writes the string of the record to the given string, returning the position after it.
+     */
+    if (record->records == NULL) {
+        memcpy(string, record->string, record->length);
+        return string + record->length;
+    }
+    for (int64_t i = 0; i < stList_length(record->records); i++) {
+        string = record_write(stList_get(record->records, i), string);
+    }
+    return string;
+}
+
+static Record *record_constructThread(stList *records) {
+    /*
+     * Makes the record of a thread from the list of the records of its pieces, which it takes ownership of. Runs of
+     * consecutive short pieces are concatenated into single strings, and if only one piece is left it is returned.
+     */
+    stList *pieces = stList_construct3(0, (void (*)(void *)) record_destruct);
+    int64_t length = 0;
+    for (int64_t i = 0; i < stList_length(records);) {
+        int64_t j = i, runLength = 0;
+        while (j < stList_length(records) && runLength < RECORD_MIN_PIECE_LENGTH &&
+               ((Record *) stList_get(records, j))->length < RECORD_MIN_PIECE_LENGTH) {
+            runLength += ((Record *) stList_get(records, j++))->length;
+        }
+        if (j - i <= 1) { // A long piece, or a short piece on its own, is kept as is
+            Record *record = stList_get(records, i++);
+            stList_append(pieces, record);
+            length += record->length;
+            continue;
+        }
+        char *string = st_malloc(sizeof(char) * (runLength + 1));
+        char *end = string;
+        for (; i < j; i++) {
+            end = record_write(stList_get(records, i), end);
+            record_destruct(stList_get(records, i));
+        }
+        *end = '\0';
+        stList_append(pieces, record_construct2(string, runLength));
+        length += runLength;
+    }
+    stList_destruct(records);
+    if (stList_length(pieces) == 1) {
+        Record *record = stList_pop(pieces);
+        stList_destruct(pieces);
+        return record;
+    }
+    Record *record = st_calloc(1, sizeof(Record));
+    record->records = pieces;
+    record->length = length;
+    return record;
+}
+
+static void record_writeToFile(Record *record, FILE *fileHandle) {
+    /*
+     * Writes the string of the record to the file, piece by piece, without making the string.
+     */
+    if (record->records == NULL) {
+        fwrite(record->string, sizeof(char), record->length, fileHandle);
+        return;
+    }
+    for (int64_t i = 0; i < stList_length(record->records); i++) {
+        record_writeToFile(stList_get(record->records, i), fileHandle);
+    }
+}
+
+static char *record_getString(Record *record) {
+    char *string = st_malloc(sizeof(char) * (record->length + 1));
+    *record_write(record, string) = '\0';
+    return string;
+}
+
 RecordHolder *recordHolder_construct() {
-    return stHash_construct2(NULL, free);
+    return stHash_construct2(NULL, (void (*)(void *)) record_destruct);
 }
 
 void recordHolder_destruct(RecordHolder *rh) {
@@ -25,24 +134,24 @@ int64_t recordHolder_size(RecordHolder *rh) {
     return stHash_size(rh);
 }
 
-static void recordHolder_add(RecordHolder *rh, Name name, char *string) {
+static void recordHolder_add(RecordHolder *rh, Name name, Record *record) {
     assert(stHash_search(rh, (void *)name) == NULL);
-    stHash_insert(rh, (void *)name, string);
+    stHash_insert(rh, (void *)name, record);
 }
 
-static char *recordHolder_remove(RecordHolder *rh, Name name) {
-    char *string = stHash_remove(rh, (void *)name);
-    return string;
+static Record *recordHolder_remove(RecordHolder *rh, Name name) {
+    Record *record = stHash_remove(rh, (void *)name);
+    return record;
 }
 
 void recordHolder_transferAll(RecordHolder *rhToAddTo, RecordHolder *rhToAdd) {
     stHashIterator *it = stHash_getIterator(rhToAdd);
     void *name;
     while((name = stHash_getNext(it)) != NULL) {
-        char *string = stHash_remove(rhToAdd, name);
-        assert(string != NULL);
+        Record *record = stHash_remove(rhToAdd, name);
+        assert(record != NULL);
         assert(stHash_search(rhToAddTo, name) == NULL);
-        stHash_insert(rhToAddTo, name, string);
+        stHash_insert(rhToAddTo, name, record);
     }
     stHash_destructIterator(it);
     assert(stHash_size(rhToAdd) == 0);
@@ -50,28 +159,50 @@ void recordHolder_transferAll(RecordHolder *rhToAddTo, RecordHolder *rhToAdd) {
 }
 
 static void cacheNonNestedRecords(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
+        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg, bool parallel) {
     /*
      * Caches the set of terminal adjacency and segment records present in the threads.
+     * The records are independent, so if parallel they are written concurrently, then added to the cache, which
+     * the caller must only ask for if its write functions are thread safe and do not depend on the order they are
+     * called in. The database path is not parallel, as the write functions may then load sequences from the database.
      */
+    stList *terminalCaps = stList_construct();
+    stList *segments = stList_construct();
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        //int64_t recordSize;
         while (1) {
             Cap *adjacentCap = cap_getAdjacency(cap);
             assert(adjacentCap != NULL);
             Group *group = end_getGroup(cap_getEnd(cap));
             assert(group != NULL);
             if (group_isLeaf(group)) { //Record must not be in the database already
-                recordHolder_add(rh, cap_getName(cap), terminalAdjacencyWriteFn(cap, extraArg));
+                stList_append(terminalCaps, cap);
             }
             if ((cap = cap_getOtherSegmentCap(adjacentCap)) == NULL) {
                 break;
             }
-            Segment *segment = cap_getSegment(adjacentCap);
-            recordHolder_add(rh, segment_getName(segment), segmentWriteFn(segment, extraArg));
+            stList_append(segments, cap_getSegment(adjacentCap));
         }
     }
+
+    int64_t capNumber = stList_length(terminalCaps), recordNumber = capNumber + stList_length(segments);
+    char **strings = st_malloc(sizeof(char *) * (recordNumber + 1));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 64) if(parallel)
+#endif
+    for (int64_t i = 0; i < recordNumber; i++) {
+        strings[i] = i < capNumber ? terminalAdjacencyWriteFn(stList_get(terminalCaps, i), extraArg) :
+                     segmentWriteFn(stList_get(segments, i - capNumber), extraArg);
+    }
+    for (int64_t i = 0; i < recordNumber; i++) {
+        Name name = i < capNumber ? cap_getName(stList_get(terminalCaps, i)) :
+                    segment_getName(stList_get(segments, i - capNumber));
+        recordHolder_add(rh, name, record_construct(strings[i]));
+    }
+
+    free(strings);
+    stList_destruct(terminalCaps);
+    stList_destruct(segments);
 }
 
 static stList *getNestedRecordNames(stList *caps) {
@@ -125,7 +256,7 @@ static void cacheNestedRecords(stKVDatabase *database, RecordHolder *rh, stList
         int64_t recordSize;
         void *record = stKVDatabaseBulkResult_getRecord(result, &recordSize);
         assert(record != NULL);
-        recordHolder_add(rh, *recordName, stString_copy(record));
+        recordHolder_add(rh, *recordName, record_construct(stString_copy(record)));
         stKVDatabaseBulkResult_destruct(result); //Cleanup the memory as we go.
         free(recordName);
     }
@@ -141,7 +272,7 @@ static RecordHolder *cacheRecords(stKVDatabase *database, stList *caps, char *(*
      */
     RecordHolder *rh = recordHolder_construct(); //stCache_construct();
     cacheNestedRecords(database, rh, caps);
-    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
+    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg, 0);
     return rh;
 }
 
@@ -167,16 +298,16 @@ static void deleteNestedRecords(stKVDatabase *database, stList *caps) {
     stList_destruct(deleteRequests);
 }
 
-static char *getThread(RecordHolder *rh, Cap *startCap, bool deleteUsedRecords) {
+static Record *getThread(RecordHolder *rh, Cap *startCap) {
     /*
-     * Iterate through, first calculating the length of the final record, then concatenating the results.
+     * Iterate through, taking the records that make up the thread, in order, to make the record of the thread.
      */
     Cap *cap = startCap;
-    stList *strings = stList_construct3(0, free);
-    while (1) { //Calculate the size of the entries in the DB that represent the thread.
-        char *s = recordHolder_remove(rh, cap_getName(cap));
-        assert(s != NULL);
-        stList_append(strings, s);
+    stList *records = stList_construct();
+    while (1) {
+        Record *record = recordHolder_remove(rh, cap_getName(cap));
+        assert(record != NULL);
+        stList_append(records, record);
 
         Cap *adjacentCap = cap_getAdjacency(cap);
         assert(adjacentCap != NULL);
@@ -184,13 +315,11 @@ static char *getThread(RecordHolder *rh, Cap *startCap, bool deleteUsedRecords)
         if ((cap = cap_getOtherSegmentCap(adjacentCap)) == NULL) {
             break;
         }
-        s = recordHolder_remove(rh, segment_getName(cap_getSegment(adjacentCap)));
-        assert(s != NULL);
-        stList_append(strings, s);
+        record = recordHolder_remove(rh, segment_getName(cap_getSegment(adjacentCap)));
+        assert(record != NULL);
+        stList_append(records, record);
     }
-    char *string = stString_join2("", strings);
-    stList_destruct(strings);
-    return string;
+    return record_constructThread(records);
 }
 
 void buildRecursiveThreads(stKVDatabase *database, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
@@ -202,10 +331,11 @@ void buildRecursiveThreads(stKVDatabase *database, stList *caps, char *(*segment
     stList *records = stList_construct3(stList_length(caps), (void(*)(void *)) stKVDatabaseBulkRequest_destruct);
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        char *string = getThread(rh, cap, 0);
-        assert(string != NULL);
+        Record *thread = getThread(rh, cap);
+        char *string = record_getString(thread);
         stList_set(records, i, stKVDatabaseBulkRequest_constructInsertRequest(cap_getName(cap),
-                                                                              string, sizeof(char)*(strlen(string)+1)));
+                                                                              string, sizeof(char)*(thread->length+1)));
+        record_destruct(thread);
         free(string);
     }
 
@@ -224,12 +354,14 @@ void buildRecursiveThreads(stKVDatabase *database, stList *caps, char *(*segment
     stList_destruct(records);
 }
 
-stList *buildRecursiveThreadsInListP(RecordHolder *rh, stList *caps, bool deleteUsedRecords) {
+stList *buildRecursiveThreadsInListP(RecordHolder *rh, stList *caps) {
     //Build new threads
     stList *threadStrings = stList_construct3(stList_length(caps), free);
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        stList_set(threadStrings, i, getThread(rh, cap, deleteUsedRecords));
+        Record *thread = getThread(rh, cap);
+        stList_set(threadStrings, i, record_getString(thread)); //The only place the threads are concatenated
+        record_destruct(thread);
     }
     return threadStrings;
 }
@@ -238,29 +370,41 @@ stList *buildRecursiveThreadsInList(stKVDatabase *database, stList *caps, char *
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
     //Cache records
     RecordHolder *rh = cacheRecords(database, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
-    stList *threadStrings = buildRecursiveThreadsInListP(rh, caps, 0);
+    stList *threadStrings = buildRecursiveThreadsInListP(rh, caps);
     recordHolder_destruct(rh);
     return threadStrings;
 }
 
 void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
+                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg, bool parallel) {
     //Cache records
-    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
+    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg, parallel);
 
-    //Build new threads and add to cache
+    //Build new threads and add to cache, without concatenating them
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        char *string = getThread(rh, cap, 1);
-        assert(string != NULL);
-        recordHolder_add(rh, cap_getName(cap), string);
+        recordHolder_add(rh, cap_getName(cap), getThread(rh, cap));
     }
 }
 
 stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
-    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
-    return buildRecursiveThreadsInListP(rh, caps, 1);
+                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg,
+                                        bool parallel) {
+    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg, parallel);
+    return buildRecursiveThreadsInListP(rh, caps);
 }
 
-
+void writeRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
+                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg, bool parallel,
+                               bool (*threadHeaderWriteFn)(Cap *, void *, FILE *), FILE *fileHandle) {
+    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg, parallel);
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        Cap *cap = stList_get(caps, i);
+        Record *thread = getThread(rh, cap);
+        if (threadHeaderWriteFn(cap, extraArg, fileHandle)) {
+            record_writeToFile(thread, fileHandle);
+            fputc('\n', fileHandle);
+        }
+        record_destruct(thread); // Free the pieces of the thread as soon as it is written
+    }
+}
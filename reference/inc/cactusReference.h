@@ -27,7 +27,8 @@ extern const char *REFERENCE_BUILDING_EXCEPTION;
 void cactus_make_reference(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params);
 
 /*
- * Construct a reference for the flower, top down.
+ * Construct a reference for the flower, top down. The adjacency lists of the flower are calculated
+ * as concurrent OpenMP tasks, so a call from within a parallel region is helped by the idle threads of the region.
  */
 void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader,
         int64_t permutations,
@@ -16,6 +16,11 @@ stList *buildRecursiveThreadsInList(stKVDatabase *database, stList *caps,
         char *(*segmentWriteFn)(Segment *, void *),
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
 
+/*
+ * Holds, by name, the records of the segments, terminal adjacencies and threads built so far. The record of a
+ * thread refers to the records of its long pieces rather than copying them, short pieces being concatenated, and
+ * is only made into a single string when returned by buildRecursiveThreadsInListNoDb.
+ */
 typedef stHash RecordHolder;
 
 RecordHolder *recordHolder_construct();
@@ -29,10 +34,31 @@ int64_t recordHolder_size(RecordHolder *rh);
  */
 void recordHolder_transferAll(RecordHolder *rhToAddTo, RecordHolder *rhToAdd);
 
+/*
+ * Builds the threads of the caps in the record holder. If parallel the segment and terminal adjacency records are
+ * written concurrently, so the write functions must then be thread safe and give the same records whatever order
+ * they are called in.
+ */
 void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
+                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg, bool parallel);
 
+/*
+ * As buildRecursiveThreadsNoDb, but returns the strings of the threads, in the order of the caps.
+ */
 stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
+                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg,
+                                        bool parallel);
+
+/*
+ * As buildRecursiveThreadsInListNoDb, but rather than returning the thread strings writes them, in the order of the
+ * caps, to the file. For each cap threadHeaderWriteFn is called, with extraArg, which writes any header for the
+ * thread and returns non-zero if the thread is to be written, in which case the thread string follows, ended by a
+ * newline.
+ * Each thread is written straight from the records it is made of, which are freed as soon as it is written,
+ * so the strings of the threads are never held in memory.
+ */
+void writeRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
+                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg, bool parallel,
+                               bool (*threadHeaderWriteFn)(Cap *, void *, FILE *), FILE *fileHandle);
 
 #endif /* RECURSIVETHREADBUILDER_H_ */
@@ -25,7 +25,16 @@ static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
     return stString_print("%" PRIi64 " %s ", cap_getCoordinate(cap), sequence_getString(sequence, cap_getCoordinate(cap)+1, cap_getCoordinate(cap_getAdjacency(cap)) - cap_getCoordinate(cap) - 1, 1));
 }
 
-static void recursiveFileBuilder_test(CuTest *testCase) {
+static bool writeThreadHeader(Cap *cap, void *extraArg, FILE *fileHandle) {
+    fprintf(fileHandle, "%s\n", sequence_getHeader(cap_getSequence(cap)));
+    return 1;
+}
+
+/*
+ * Builds the threads of the sequence, which is aligned in a flower with one child, in which the first blockLength
+ * bases of the sequence form a block.
+ */
+static void testRecursiveThreads(CuTest *testCase, const char *sequenceString, int64_t blockLength) {
     //Make flower with two ends and 2 blocks, and one child, one empty adjacency and two containing additional blocks.
 
     const char *tempDir = "recursiveFileBuilderTestTempDir";
@@ -43,11 +52,12 @@ static void recursiveFileBuilder_test(CuTest *testCase) {
     Event *referenceEvent = eventTree_getRootEvent(flower_getEventTree(flower));
 
     //Make sequence and thread
-    Sequence *sequence1 = sequence_construct(1, 5, "ACGTA", "ref sequence", referenceEvent, cactusDisk);
+    int64_t sequenceLength = strlen(sequenceString);
+    Sequence *sequence1 = sequence_construct(1, sequenceLength, (char *)sequenceString, "ref sequence", referenceEvent, cactusDisk);
     flower_addSequence(flower, sequence1);
     //First reference thread
     Cap *cap1 = cap_construct2(end1, 0, 1, sequence1);
-    Cap *cap2 = cap_construct2(end2, 6, 1, sequence1);
+    Cap *cap2 = cap_construct2(end2, sequenceLength + 1, 1, sequence1);
     cap_makeAdjacent(cap1, cap2);
 
     //Make a group
@@ -59,7 +69,7 @@ static void recursiveFileBuilder_test(CuTest *testCase) {
     Flower *nestedFlower = group_makeNestedFlower(group1);
 
     //Now will fill in blocks at lower level
-    Block *block1 = block_construct(3, nestedFlower);
+    Block *block1 = block_construct(blockLength, nestedFlower);
     Segment *segment1 = segment_construct2(block1, 1, 1, flower_getSequence(nestedFlower, sequence_getName(sequence1)));
 
     //Add adjacencies at lower level
@@ -78,20 +88,65 @@ static void recursiveFileBuilder_test(CuTest *testCase) {
     RecordHolder *rh = recordHolder_construct();
     stList *caps = stList_construct();
     stList_append(caps, flower_getCap(nestedFlower, cap_getName(cap1)));
-    buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
+    buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL, 0);
 
     //Now complete the alignment
     stList_pop(caps);
     stList_append(caps, cap1);
-    stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
+    stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL, 0);
 
+    char *expectedThreadString = stString_print("1 %.*s %" PRIi64 " %s ", (int)blockLength, sequenceString, blockLength,
+                                                sequenceString + blockLength);
     CuAssertIntEquals(testCase, 1, stList_length(threadStrings));
-    CuAssertStrEquals(testCase, "1 ACG 3 TA ", stList_get(threadStrings, 0));
+    CuAssertStrEquals(testCase, expectedThreadString, stList_get(threadStrings, 0));
+
+    recordHolder_destruct(rh);
 
+    //Now write the threads to a file, rather than to a list
+    rh = recordHolder_construct();
+    stList_pop(caps);
+    stList_append(caps, flower_getCap(nestedFlower, cap_getName(cap1)));
+    buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL, 0);
+    stList_pop(caps);
+    stList_append(caps, cap1);
+    char *threadFile = stFile_pathJoin(tempDir, "threads");
+    FILE *fileHandle = fopen(threadFile, "w");
+    writeRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL, 1, writeThreadHeader, fileHandle);
+    fclose(fileHandle);
+    CuAssertIntEquals(testCase, 0, recordHolder_size(rh));
+
+    fileHandle = fopen(threadFile, "r");
+    char *header = stFile_getLineFromFile(fileHandle);
+    char *threadString = stFile_getLineFromFile(fileHandle);
+    CuAssertStrEquals(testCase, "ref sequence", header);
+    CuAssertStrEquals(testCase, expectedThreadString, threadString);
+    CuAssertTrue(testCase, stFile_getLineFromFile(fileHandle) == NULL);
+    fclose(fileHandle);
+
+    free(header);
+    free(threadString);
+    free(threadFile);
+    free(expectedThreadString);
+    stList_destruct(threadStrings);
+    stList_destruct(caps);
     recordHolder_destruct(rh);
     stFile_rmtree(tempDir);
 }
 
+static void recursiveFileBuilder_test(CuTest *testCase) {
+    testRecursiveThreads(testCase, "ACGTA", 3);
+
+    //Long enough that the thread is made of pieces rather than concatenated
+    int64_t sequenceLength = 300000;
+    char *sequenceString = st_malloc(sizeof(char) * (sequenceLength + 1));
+    for (int64_t i = 0; i < sequenceLength; i++) {
+        sequenceString[i] = "ACGT"[st_randomInt(0, 4)];
+    }
+    sequenceString[sequenceLength] = '\0';
+    testRecursiveThreads(testCase, sequenceString, 100000);
+    free(sequenceString);
+}
+
 CuSuite* recursiveThreadBuilderTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, recursiveFileBuilder_test);
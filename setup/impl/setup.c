@@ -3,6 +3,12 @@
 #include "bioioC.h"
 #include <stdio.h>
 #include <ctype.h>
+#include <sys/stat.h>
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 void checkBranchLengthsAreDefined(stTree *tree) {
     if (isinf(stTree_getBranchLength(tree))) {
@@ -83,7 +89,74 @@ void processSequence(void* destination, const char *fastaHeader, const char *str
     p->totalSequenceNumber++;
 }
 
-static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree *eventTree, char *sequenceFilesAndEvents) {
+/*
+ * A fasta file to add the sequences of, and the sequences once read.
+ */
+typedef struct _inputFile {
+    char *fileName;
+    Event *event;
+    bool isComplete;
+    int64_t size; // The size of the file on disk, an estimate of the memory its sequences take once read
+    stList *headers;
+    stList *strings;
+    stList *lengths;
+} InputFile;
+
+static InputFile *inputFile_construct(const char *fileName, Event *event) {
+    InputFile *inputFile = st_calloc(1, sizeof(InputFile));
+    inputFile->fileName = stString_copy(fileName);
+    inputFile->event = event;
+    inputFile->isComplete = getCompleteStatus(fileName); //decide if the sequences in the file should be free or attached.
+    struct stat fileStat;
+    inputFile->size = stat(fileName, &fileStat) == 0 ? fileStat.st_size : 0;
+    return inputFile;
+}
+
+static void inputFile_destruct(InputFile *inputFile) {
+    free(inputFile->fileName);
+    free(inputFile);
+}
+
+static void readSequence(void* destination, const char *fastaHeader, const char *string, int64_t length) {
+    InputFile *inputFile = destination;
+    stList_append(inputFile->headers, stString_copy(fastaHeader));
+    stList_append(inputFile->strings, stString_copy(string));
+    stList_append(inputFile->lengths, stIntTuple_construct1(length));
+}
+
+/*
+ * Reads the sequences of the file into memory.
+ */
+static void inputFile_read(InputFile *inputFile) {
+    st_logInfo("Processing file: %s\n", inputFile->fileName);
+    inputFile->headers = stList_construct3(0, free);
+    inputFile->strings = stList_construct3(0, free);
+    inputFile->lengths = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    FILE *fileHandle = cactusFile_open(inputFile->fileName);
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open file: %s\n", inputFile->fileName);
+    }
+    fastaReadToFunction(fileHandle, inputFile, readSequence);
+    fclose(fileHandle);
+}
+
+/*
+ * Adds the sequences read from the file to the flower, then frees them.
+ */
+static void inputFile_addSequences(InputFile *inputFile, ProcessSequenceVars *p) {
+    p->event = inputFile->event;
+    p->isComplete = inputFile->isComplete;
+    for (int64_t i = 0; i < stList_length(inputFile->headers); i++) {
+        processSequence(p, stList_get(inputFile->headers, i), stList_get(inputFile->strings, i),
+                        stIntTuple_get(stList_get(inputFile->lengths, i), 0));
+    }
+    stList_destruct(inputFile->headers);
+    stList_destruct(inputFile->strings);
+    stList_destruct(inputFile->lengths);
+}
+
+static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree *eventTree, char *sequenceFilesAndEvents,
+                               int64_t readAheadMemory) {
     stList *sequenceFilesAndEventsList = stString_split(sequenceFilesAndEvents);
     if (stList_length(sequenceFilesAndEventsList) % 2 != 0) {
         stList_destruct(sequenceFilesAndEventsList);
@@ -96,6 +169,8 @@ static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree
     p.flower = flower;
     p.cactusDisk = cactusDisk;
 
+    // Make the list of files to read, in the order their sequences are added
+    stList *inputFiles = stList_construct3(0, (void (*)(void *))inputFile_destruct);
     for (int64_t i = 0; i < stList_length(sequenceFilesAndEventsList); i += 2) {
         char *eventName = stList_get(sequenceFilesAndEventsList, i);
         char *fileName = stList_get(sequenceFilesAndEventsList, i+1);
@@ -106,10 +181,8 @@ static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree
             st_errAbort("File does not exist: %s\n", fileName);
         }
 
-        // Set the global "event" variable, which is needed for the
-        // function provided to fastaReadToFunction.
-        p.event = eventTree_getEventByHeader(eventTree, eventName);
-        if (p.event == NULL) {
+        Event *event = eventTree_getEventByHeader(eventTree, eventName);
+        if (event == NULL) {
             st_errAbort("No such event: %s", eventName);
         }
         if (stFile_isDir(fileName)) {
@@ -118,23 +191,44 @@ static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree
             for (int64_t j = 0; j < stList_length(filesInDir); j++) {
                 char *absChildFileName = stFile_pathJoin(fileName, stList_get(filesInDir, j));
                 assert(stFile_exists(absChildFileName));
-                p.isComplete = getCompleteStatus(absChildFileName); //decide if the sequences in the file should be free or attached.
-                FILE *fileHandle = fopen(absChildFileName, "r");
-                fastaReadToFunction(fileHandle, &p, processSequence);
-                fclose(fileHandle);
+                stList_append(inputFiles, inputFile_construct(absChildFileName, event));
                 free(absChildFileName);
             }
             stList_destruct(filesInDir);
         } else {
-            st_logInfo("Processing file: %s\n", fileName);
-            p.isComplete = getCompleteStatus(fileName); //decide if the sequences in the file should be free or attached.
-            FILE *fileHandle = fopen(fileName, "r");
-            fastaReadToFunction(fileHandle, &p, processSequence);
-            fclose(fileHandle);
+            stList_append(inputFiles, inputFile_construct(fileName, event));
         }
     }
     stList_destruct(sequenceFilesAndEventsList);
 
+    // Read the files in parallel, but add their sequences to the flower in the order of the files, so the
+    // sequences are named as if the files were read one after another. The files are taken in batches of
+    // consecutive files whose summed sizes fit in readAheadMemory (0 for no limit), or of one file if it alone
+    // does not, so at most a batch of files is held in memory while the earlier files of the batch are added.
+    int64_t inputFileNumber = stList_length(inputFiles);
+    for (int64_t first = 0, last; first < inputFileNumber; first = last) {
+        int64_t batchSize = ((InputFile *)stList_get(inputFiles, first))->size;
+        for (last = first + 1; last < inputFileNumber; last++) {
+            int64_t size = ((InputFile *)stList_get(inputFiles, last))->size;
+            if (readAheadMemory > 0 && batchSize + size > readAheadMemory) {
+                break;
+            }
+            batchSize += size;
+        }
+#if defined(_OPENMP)
+#pragma omp parallel for ordered schedule(dynamic, 1)
+#endif
+        for (int64_t i = first; i < last; i++) {
+            InputFile *inputFile = stList_get(inputFiles, i);
+            inputFile_read(inputFile);
+#if defined(_OPENMP)
+#pragma omp ordered
+#endif
+            inputFile_addSequences(inputFile, &p);
+        }
+    }
+    stList_destruct(inputFiles);
+
     return p.totalSequenceNumber;
 }
 
@@ -214,7 +308,9 @@ Flower *cactus_setup_first_flower(CactusDisk *cactusDisk, CactusParams *params,
     //Construct the sequences and associate them with events
     //////////////////////////////////////////////
 
-    int64_t totalSequenceNumber = assignSequences(cactusDisk, flower, eventTree, sequenceFilesAndEvents);
+    int64_t readAheadMemory = cactusParams_get_int_with_default(params, 0, 2, "setup", "readAheadMemory");
+    int64_t totalSequenceNumber = assignSequences(cactusDisk, flower, eventTree, sequenceFilesAndEvents,
+                                                  readAheadMemory);
 
     //////////////////////////////////////////////
     //Log the constructed event tree and sequences
@@ -243,6 +243,7 @@ def chain_alignments(job, alignment_files, reference_event_name, params):
                                            "--chainGapOpen", params.find("blast").attrib["chainGapOpen"],
                                            "--chainGapExtend", params.find("blast").attrib["chainGapExtend"],
                                            "--trimFraction", params.find("blast").attrib["chainTrimFraction"],
+                                           "--threads", str(max(1, int(job.cores))),
                                            "--logLevel", getLogLevelString()],
                                outfile=chained_alignment_file, outappend=True, returnStdErr=True)
         logger.info("paf_chain {}\n{}".format(reference_event_name, messages[:-1]))  # Log paf_chain
@@ -312,9 +313,10 @@ def make_paf_alignments(job, event_tree_string, event_names_to_sequences, ancest
                                                       disk=2*total_sequence_size).rv()
                                for ingroup in ingroup_events for outgroup in outgroup_events]
 
-    # Now do the chaining
+    # Now do the chaining, with the cores paf_chain will use to chain the sequence pairs in parallel
+    chain_cores = getOptionalAttrib(params.find("blast"), 'chainCpu', typeFn=int, default=1)
     return root_job.addFollowOnJobFn(chain_alignments, ingroup_alignments + outgroup_alignments,
-                                     ancestor_event_string, params, disk=2*total_sequence_size).rv()
+                                     ancestor_event_string, params, cores=chain_cores, disk=2*total_sequence_size).rv()
 
 
 def trim_unaligned_sequences(job, sequences, alignments, params):